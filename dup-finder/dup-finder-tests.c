@@ -0,0 +1,263 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Runs dup-finder on a small tree and checks the groups it prints. The tree
+// has empty files, files of the same size with other bytes, large files
+// that only differ between their edges, small ones hashed whole in stage 2
+// and hard links. Everything runs a second time with a hash that gives
+// every file the same value, so the byte compare alone has to keep files
+// apart. dup-finder.c is built in with its main renamed and each run is
+// forked so its globals start fresh. Everything happens under
+// dup-finder-tests.tmp in the current directory.
+// make dup-finder-tests && ./dup-finder-tests
+
+// The same as dup-finder.c, the system headers have to see it first.
+#define _XOPEN_SOURCE 700
+#include <stdint.h>
+#include <stddef.h>
+
+#include "kc-hash.h"
+
+static int weak_hash = 0;
+
+static void test_hash(const KcHashSeed *seed, const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    if(weak_hash) {
+        *upper = 0;
+        *lower = 0;
+        return;
+    }
+    kc_hash_seeded(seed, data, length, upper, lower);
+}
+
+#define kc_hash_seeded test_hash
+#define main dup_finder_main
+#include "dup-finder.c"
+#undef main
+#undef kc_hash_seeded
+
+#include <dirent.h>
+#include <sys/wait.h>
+
+#define TEST_DIR "dup-finder-tests.tmp"
+#define OUT_FILE TEST_DIR "/out.json"
+
+static int failures = 0;
+
+static uint64_t rng_state = 0x3c6ef372fe94f82b;
+
+// splitmix64, used for the file contents.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+static void fail_setup(const char *what, const char *path) {
+    fprintf(stderr, "dup-finder-tests: fatal error: can't %s ‘%s’: %s\n", what, path, strerror(errno));
+    exit(1);
+}
+
+static void write_bytes(const char *path, const uint8_t *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if(f == NULL || fwrite(data, 1, size, f) != size || fclose(f) != 0) {
+        fail_setup("write", path);
+    }
+}
+
+static void remove_tree(void) {
+    // Only this directory and one level below are ever made.
+    static const char *dirs[] = { TEST_DIR "/tree/sub", TEST_DIR "/tree", TEST_DIR };
+    for(size_t d = 0; d < sizeof(dirs) / sizeof(dirs[0]); d++) {
+        DIR *dir = opendir(dirs[d]);
+        if(dir == NULL) {
+            continue;
+        }
+        struct dirent *ent;
+        while((ent = readdir(dir)) != NULL) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dirs[d], ent->d_name);
+            if(ent->d_name[0] != '.' && unlink(path) != 0 && errno != EISDIR && errno != EPERM) {
+                fail_setup("remove", path);
+            }
+        }
+        closedir(dir);
+        rmdir(dirs[d]);
+    }
+}
+
+// The tree every run looks at:
+//   empty1 empty2      no bytes
+//   diff1 diff2        100 random bytes each
+//   big1 big2 sub/big4 20000 bytes, the same
+//   big3               20000 bytes, the edges of big1 but not the middle
+//   big1.link          a hard link to big1
+//   lone lone.link     a file with only a hard link to match it
+//   small1 sub/small2  10 bytes, the same
+static void make_tree(void) {
+    static uint8_t big[20000];
+    uint8_t        bytes[100];
+    remove_tree();
+    if(mkdir(TEST_DIR, 0755) != 0 || mkdir(TEST_DIR "/tree", 0755) != 0 || mkdir(TEST_DIR "/tree/sub", 0755) != 0) {
+        fail_setup("make", TEST_DIR);
+    }
+    write_bytes(TEST_DIR "/tree/empty1", NULL, 0);
+    write_bytes(TEST_DIR "/tree/empty2", NULL, 0);
+    for(int f = 0; f < 2; f++) {
+        for(size_t i = 0; i < sizeof(bytes); i++) {
+            bytes[i] = rng_next();
+        }
+        write_bytes(f ? TEST_DIR "/tree/diff2" : TEST_DIR "/tree/diff1", bytes, sizeof(bytes));
+    }
+    for(size_t i = 0; i < sizeof(big); i++) {
+        big[i] = rng_next();
+    }
+    write_bytes(TEST_DIR "/tree/big1", big, sizeof(big));
+    write_bytes(TEST_DIR "/tree/big2", big, sizeof(big));
+    write_bytes(TEST_DIR "/tree/sub/big4", big, sizeof(big));
+    big[10000] ^= 1;
+    write_bytes(TEST_DIR "/tree/big3", big, sizeof(big));
+    write_bytes(TEST_DIR "/tree/lone", big, 5000);
+    if(link(TEST_DIR "/tree/big1", TEST_DIR "/tree/big1.link") != 0) {
+        fail_setup("link", TEST_DIR "/tree/big1.link");
+    }
+    if(link(TEST_DIR "/tree/lone", TEST_DIR "/tree/lone.link") != 0) {
+        fail_setup("link", TEST_DIR "/tree/lone.link");
+    }
+    write_bytes(TEST_DIR "/tree/small1", (const uint8_t*)"0123456789", 10);
+    write_bytes(TEST_DIR "/tree/sub/small2", (const uint8_t*)"0123456789", 10);
+}
+
+// Runs dup-finder with args in a child writing to OUT_FILE, then puts the
+// groups it printed in got, one line per group with its paths in order.
+// Groups of the same size come out in hash order, so the lines are sorted.
+static int run(char **args, int arg_cnt, char *got, size_t got_sz) {
+    char *argv[8] = { "dup-finder" };
+    for(int i = 0; i < arg_cnt; i++) {
+        argv[i + 1] = args[i];
+    }
+    argv[arg_cnt + 1] = TEST_DIR "/tree";
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0) {
+        if(freopen(OUT_FILE, "w", stdout) == NULL) {
+            _exit(2);
+        }
+        int res = dup_finder_main(arg_cnt + 2, argv);
+        fflush(stdout);
+        _exit(res == 0 ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return 0;
+    }
+    FILE *f = fopen(OUT_FILE, "r");
+    if(f == NULL) {
+        return 0;
+    }
+    char   lines[16][256];
+    char  *order[16];
+    int    groups = -1;
+    char   line[512];
+    while(fgets(line, sizeof(line), f) != NULL) {
+        char *quote = strchr(line, '"');
+        if(strncmp(line, "  {\"size\"", 9) == 0) {
+            // More groups than the tree can make.
+            if(++groups == 16) {
+                fclose(f);
+                return 0;
+            }
+            lines[groups][0] = '\0';
+            order[groups]    = lines[groups];
+        } else if(groups >= 0 && quote != NULL && strncmp(line, "    \"", 5) == 0) {
+            // Just the name under the tree.
+            char *name = quote + 1 + strlen(TEST_DIR "/tree/");
+            *strchr(name, '"') = '\0';
+            if(lines[groups][0] != '\0') {
+                strcat(lines[groups], " ");
+            }
+            strcat(lines[groups], name);
+        }
+    }
+    fclose(f);
+    for(int i = 1; i <= groups; i++) {
+        for(int j = i; j > 0 && strcmp(order[j - 1], order[j]) > 0; j--) {
+            char *tmp    = order[j];
+            order[j]     = order[j - 1];
+            order[j - 1] = tmp;
+        }
+    }
+    got[0] = '\0';
+    for(int i = 0; i <= groups; i++) {
+        if(strlen(got) + strlen(order[i]) + 2 > got_sz) {
+            return 0;
+        }
+        strcat(got, order[i]);
+        strcat(got, "\n");
+    }
+    return 1;
+}
+
+static void check_run(const char *name, char **args, int arg_cnt, const char *want) {
+    char got[2048];
+    int  ok = run(args, arg_cnt, got, sizeof(got)) && strcmp(got, want) == 0;
+    printf("  %-34s %s\n", name, verdict(ok));
+    if(!ok) {
+        printf("want:\n%sgot:\n%s", want, got);
+    }
+}
+
+int main(void) {
+    char *one[]   = { "-t", "1" };
+    char *four[]  = { "-t", "4" };
+    char *empty[] = { "-m", "0" };
+    char *big[]   = { "-m", "11" };
+    make_tree();
+    for(weak_hash = 0; weak_hash < 2; weak_hash++) {
+        printf("%s\n", weak_hash ? "Every file hashing the same" : "Seeded hash");
+        check_run("one thread", one, 2,
+                  "big1 big2 sub/big4\nsmall1 sub/small2\n");
+        check_run("four threads", four, 2,
+                  "big1 big2 sub/big4\nsmall1 sub/small2\n");
+        check_run("empty files with -m 0", empty, 2,
+                  "big1 big2 sub/big4\nempty1 empty2\nsmall1 sub/small2\n");
+        check_run("small files left out with -m 11", big, 2,
+                  "big1 big2 sub/big4\n");
+    }
+    remove_tree();
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
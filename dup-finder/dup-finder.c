@@ -0,0 +1,519 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Finds duplicate files under one or more directories and prints them as
+// JSON groups. Files are only compared in stages, so most are never read
+// in full:
+//   1. Files with a size nothing else has can't have a duplicate.
+//   2. The first and last 4 KiB are hashed, files up to 8 KiB are done here.
+//   3. Whatever still matches is mapped once per file, hashed in full and
+//      compared byte for byte with the earlier file of its group that has
+//      the same hash, while both are still mapped. The hash only picks what
+//      to compare against, the bytes decide.
+// Stages 2 and 3 are spread across threads, stage 3 a group at a time. The
+// hashes are seeded with a secret picked each run, so nobody can plant
+// files that all collide and push a group into comparing every file
+// against every other.
+
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kc-hash.h"
+
+#define EDGE_SZ     4096
+#define MAX_THREADS 256
+
+typedef struct Entry {
+    char     *path;
+    uint64_t  size;
+    uint64_t  dev;
+    uint64_t  ino;
+    uint64_t  upper;
+    uint64_t  lower;
+    int       whole;  // The hash covers the whole file already.
+    int       failed; // Couldn't be read, left out of the results.
+    // The file in its group its bytes matched in stage 3, or itself if no
+    // earlier one did.
+    struct Entry *rep;
+} Entry;
+
+typedef struct EntryList {
+    Entry  *items;
+    size_t  count;
+    size_t  cap;
+} EntryList;
+
+// Files that matched on size and edges, handled together in stage 3.
+typedef struct Group {
+    Entry  **items;
+    size_t   count;
+} Group;
+
+typedef struct Job {
+    void    *items;
+    size_t   count;
+    size_t   next; // Next item to claim, shared by all workers.
+    void   (*func)(void *items, size_t i);
+} Job;
+
+// nftw doesn't take a context pointer.
+static EntryList  found;
+static uint64_t   min_size = 1;
+static KcHashSeed seed;
+
+static void* dup_alloc(size_t size) {
+    void *tmp = malloc(size > 0 ? size : 1);
+    if(tmp == NULL) {
+        fprintf(stderr, "dup-finder: fatal error: out of memory.\n");
+        exit(-1);
+    }
+    return tmp;
+}
+
+static int walk_visit(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if(type == FTW_DNR) {
+        fprintf(stderr, "dup-finder: warning: can't read directory ‘%s’\n", path);
+        return 0;
+    }
+    if(type != FTW_F || !S_ISREG(st->st_mode) || (uint64_t)st->st_size < min_size) {
+        return 0;
+    }
+    if(found.count == found.cap) {
+        found.cap   = found.cap ? found.cap * 2 : 1024;
+        found.items = realloc(found.items, found.cap * sizeof(Entry));
+        if(found.items == NULL) {
+            fprintf(stderr, "dup-finder: fatal error: out of memory.\n");
+            exit(-1);
+        }
+    }
+    Entry *entry = &found.items[found.count++];
+    size_t len   = strlen(path);
+    entry->path   = memcpy(dup_alloc(len + 1), path, len + 1);
+    entry->size   = st->st_size;
+    entry->dev    = st->st_dev;
+    entry->ino    = st->st_ino;
+    entry->upper  = 0;
+    entry->lower  = 0;
+    entry->whole  = 0;
+    entry->failed = 0;
+    entry->rep    = NULL;
+    return 0;
+}
+
+// Reads exactly size bytes unless the file got shorter.
+static int read_at(int fd, uint8_t *buf, size_t size, off_t offset) {
+    while(size > 0) {
+        ssize_t got = pread(fd, buf, size, offset);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            return -1;
+        }
+        buf    += got;
+        size   -= got;
+        offset += got;
+    }
+    return 0;
+}
+
+static void hash_edges(Entry *entry) {
+    uint8_t buf[EDGE_SZ * 2];
+    int     fd = open(entry->path, O_RDONLY);
+    if(fd < 0) {
+        entry->failed = 1;
+        return;
+    }
+    size_t size = entry->size;
+    int    res;
+    if(size <= sizeof(buf)) {
+        res = read_at(fd, buf, size, 0);
+        entry->whole = 1;
+    } else {
+        res = read_at(fd, buf, EDGE_SZ, 0);
+        if(res == 0) {
+            res = read_at(fd, buf + EDGE_SZ, EDGE_SZ, entry->size - EDGE_SZ);
+        }
+        size = sizeof(buf);
+    }
+    close(fd);
+    if(res < 0) {
+        entry->failed = 1;
+        return;
+    }
+    kc_hash_seeded(&seed, buf, size, &entry->upper, &entry->lower);
+}
+
+static void* map_file(const char *path, uint64_t size) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
+    }
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return NULL;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    return map;
+}
+
+static int same_hash(const Entry *x, const Entry *y) {
+    return x->size == y->size && x->upper == y->upper && x->lower == y->lower;
+}
+
+// Stage 3 for one group. Only the files that are still the first with
+// their bytes stay mapped, which is usually just the first file.
+static void confirm_group(Group *group) {
+    Entry  **items = group->items;
+    uint64_t size  = items[0]->size;
+    void   **maps  = dup_alloc(group->count * sizeof(void*));
+    for(size_t i = 0; i < group->count; i++) {
+        Entry *entry = items[i];
+        entry->rep = entry;
+        maps[i]    = NULL;
+        // mmap refuses empty files, and they're all the same anyway.
+        if(size == 0) {
+            entry->rep = items[0];
+            continue;
+        }
+        maps[i] = map_file(entry->path, size);
+        if(maps[i] == NULL) {
+            entry->failed = 1;
+            continue;
+        }
+        if(!entry->whole) {
+            kc_hash_seeded(&seed, maps[i], size, &entry->upper, &entry->lower);
+            entry->whole = 1;
+        }
+        for(size_t j = 0; j < i; j++) {
+            if(maps[j] != NULL && same_hash(items[j], entry) && memcmp(maps[j], maps[i], size) == 0) {
+                entry->rep = items[j];
+                break;
+            }
+        }
+        if(entry->rep != entry) {
+            munmap(maps[i], size);
+            maps[i] = NULL;
+        }
+    }
+    for(size_t i = 0; i < group->count; i++) {
+        if(maps[i] != NULL) {
+            munmap(maps[i], size);
+        }
+    }
+    free(maps);
+}
+
+static void hash_edges_at(void *items, size_t i) {
+    hash_edges(((Entry**)items)[i]);
+}
+
+static void confirm_group_at(void *groups, size_t i) {
+    confirm_group(&((Group*)groups)[i]);
+}
+
+static void* job_worker(void *arg) {
+    Job *job = arg;
+    for(;;) {
+        size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if(i >= job->count) {
+            break;
+        }
+        job->func(job->items, i);
+    }
+    return NULL;
+}
+
+static void job_run(void *items, size_t count, void (*func)(void *items, size_t i), int threads) {
+    Job job = { items, count, 0, func };
+    pthread_t workers[MAX_THREADS];
+    int       started = 0;
+    if((size_t)threads > count) {
+        threads = count > 0 ? count : 1;
+    }
+    for(int i = 1; i < threads; i++) {
+        if(pthread_create(&workers[started], NULL, job_worker, &job) == 0) {
+            started++;
+        }
+    }
+    job_worker(&job);
+    for(int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+static int entry_cmp_size(const void *a, const void *b) {
+    const Entry *x = *(Entry* const*)a;
+    const Entry *y = *(Entry* const*)b;
+    if(x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    // Keeps hard links to the same file next to each other.
+    if(x->dev != y->dev) {
+        return x->dev < y->dev ? -1 : 1;
+    }
+    if(x->ino != y->ino) {
+        return x->ino < y->ino ? -1 : 1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+static int entry_cmp_hash(const void *a, const void *b) {
+    const Entry *x = *(Entry* const*)a;
+    const Entry *y = *(Entry* const*)b;
+    if(x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    if(x->upper != y->upper) {
+        return x->upper < y->upper ? -1 : 1;
+    }
+    if(x->lower != y->lower) {
+        return x->lower < y->lower ? -1 : 1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+// Hash order, then files with the same bytes together.
+static int entry_cmp_rep(const void *a, const void *b) {
+    const Entry *x = *(Entry* const*)a;
+    const Entry *y = *(Entry* const*)b;
+    if(!same_hash(x, y)) {
+        return entry_cmp_hash(a, b);
+    }
+    if(x->rep != y->rep) {
+        return x->rep < y->rep ? -1 : 1;
+    }
+    return strcmp(x->path, y->path);
+}
+
+static int same_bytes(const Entry *x, const Entry *y) {
+    return same_hash(x, y) && x->rep == y->rep;
+}
+
+// Sorts items with cmp and keeps only runs of two or more that same says
+// match. Returns the new count.
+static size_t keep_groups(Entry **items, size_t count, int (*cmp)(const void*, const void*),
+                          int (*same)(const Entry*, const Entry*)) {
+    size_t kept = 0;
+    size_t i    = 0;
+    qsort(items, count, sizeof(Entry*), cmp);
+    while(i < count) {
+        size_t end = i + 1;
+        while(end < count && same(items[i], items[end])) {
+            end++;
+        }
+        if(end - i > 1) {
+            for(size_t j = i; j < end; j++) {
+                items[kept++] = items[j];
+            }
+        }
+        i = end;
+    }
+    return kept;
+}
+
+static int same_size(const Entry *x, const Entry *y) {
+    return x->size == y->size;
+}
+
+static size_t drop_failed(Entry **items, size_t count) {
+    size_t kept = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(items[i]->failed) {
+            fprintf(stderr, "dup-finder: warning: can't read ‘%s’\n", items[i]->path);
+        } else {
+            items[kept++] = items[i];
+        }
+    }
+    return kept;
+}
+
+// Hard links are one file, only the first path of each is kept.
+static size_t drop_links(Entry **items, size_t count) {
+    size_t kept = 0;
+    for(size_t i = 0; i < count; i++) {
+        if(kept > 0 && items[kept - 1]->dev == items[i]->dev && items[kept - 1]->ino == items[i]->ino) {
+            continue;
+        }
+        items[kept++] = items[i];
+    }
+    return kept;
+}
+
+// Stage 3, items has to be in order of size and edges. Returns the new
+// count.
+static size_t confirm_groups(Entry **items, size_t count, int threads) {
+    Group *groups = dup_alloc(count * sizeof(Group));
+    size_t total  = 0;
+    for(size_t i = 0; i < count;) {
+        size_t end = i + 1;
+        while(end < count && same_hash(items[i], items[end])) {
+            end++;
+        }
+        groups[total].items = items + i;
+        groups[total].count = end - i;
+        total++;
+        i = end;
+    }
+    job_run(groups, total, confirm_group_at, threads);
+    free(groups);
+    count = drop_failed(items, count);
+    return keep_groups(items, count, entry_cmp_rep, same_bytes);
+}
+
+static void json_string(const char *str) {
+    putchar('"');
+    for(const unsigned char *cur = (const unsigned char*)str; *cur != '\0'; cur++) {
+        if(*cur == '"' || *cur == '\\') {
+            putchar('\\');
+            putchar(*cur);
+        } else if(*cur < 0x20) {
+            printf("\\u%04x", *cur);
+        } else {
+            putchar(*cur);
+        }
+    }
+    putchar('"');
+}
+
+static void print_groups(Entry **items, size_t count) {
+    int first = 1;
+    printf("[");
+    for(size_t i = 0; i < count;) {
+        size_t end = i + 1;
+        while(end < count && same_bytes(items[i], items[end])) {
+            end++;
+        }
+        printf("%s\n  {\"size\": %llu, \"files\": [", first ? "" : ",", (unsigned long long)items[i]->size);
+        for(size_t j = i; j < end; j++) {
+            printf(j == i ? "\n    " : ",\n    ");
+            json_string(items[j]->path);
+        }
+        printf("\n  ]}");
+        first = 0;
+        i = end;
+    }
+    printf("%s]\n", first ? "" : "\n");
+}
+
+int main(int argc, char **argv) {
+    char *dirs[argc];
+    int   dir_cnt = 0;
+    int   threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int   verbose = 0;
+    for(int i = 1; i < argc; i++) {
+        char *cur = argv[i];
+        if(cur[0] != '-') {
+            dirs[dir_cnt++] = cur;
+            continue;
+        }
+        unsigned len = strlen(cur);
+        if(cur[1] == 'v' && len == 2) {
+            verbose = 1;
+            continue;
+        }
+        if(cur[1] == 't' && len == 2) {
+            if(i+1 >= argc || atoi(argv[i+1]) <= 0) {
+                fprintf(stderr, "dup-finder: error: missing a thread count after ‘-t’\n");
+                continue;
+            }
+            threads = atoi(argv[++i]);
+            continue;
+        }
+        if(cur[1] == 'm' && len == 2) {
+            if(i+1 >= argc) {
+                fprintf(stderr, "dup-finder: error: missing a size after ‘-m’\n");
+                continue;
+            }
+            min_size = strtoull(argv[++i], NULL, 10);
+            continue;
+        }
+        fprintf(stderr, "dup-finder: error: unrecognized command line option ‘%s’\n", cur);
+    }
+    if(dir_cnt == 0) {
+        fprintf(stderr, "dup-finder: fatal error: no directories to search\n");
+        return -1;
+    }
+    if(threads < 1) {
+        threads = 1;
+    }
+    if(threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    uint64_t secret[2];
+    FILE    *urandom = fopen("/dev/urandom", "rb");
+    if(urandom == NULL || fread(secret, sizeof(secret), 1, urandom) != 1) {
+        fprintf(stderr, "dup-finder: fatal error: can't read ‘/dev/urandom’ for the hash secret\n");
+        return -1;
+    }
+    fclose(urandom);
+    kc_hash_seed_init(&seed, secret);
+    for(int i = 0; i < dir_cnt; i++) {
+        if(nftw(dirs[i], walk_visit, 64, FTW_PHYS) != 0) {
+            fprintf(stderr, "dup-finder: error: can't walk ‘%s’: %s\n", dirs[i], strerror(errno));
+        }
+    }
+
+    Entry **items = dup_alloc(found.count * sizeof(Entry*));
+    size_t  count = found.count;
+    for(size_t i = 0; i < count; i++) {
+        items[i] = &found.items[i];
+    }
+    // Stage 1, sizes.
+    qsort(items, count, sizeof(Entry*), entry_cmp_size);
+    count = drop_links(items, count);
+    size_t files = count;
+    count = keep_groups(items, count, entry_cmp_size, same_size);
+    size_t by_size = count;
+    // Stage 2, both ends.
+    job_run(items, count, hash_edges_at, threads);
+    count = drop_failed(items, count);
+    count = keep_groups(items, count, entry_cmp_hash, same_hash);
+    size_t by_edges = count;
+    // Stage 3, the bytes themselves.
+    count = confirm_groups(items, count, threads);
+    if(verbose) {
+        fprintf(stderr, "dup-finder: %zu files, %zu share a size, %zu share their edges, %zu are duplicates\n",
+                files, by_size, by_edges, count);
+    }
+    print_groups(items, count);
+    for(size_t i = 0; i < found.count; i++) {
+        free(found.items[i].path);
+    }
+    free(found.items);
+    free(items);
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks the content defined chunker does what it's for, an edit in the
+// middle of a stream should only change the chunks around it. Random data
+// is chunked, then edited with inserts, deletes and overwrites at random
+// spots and chunked again. The chunks before the edit have to be the same,
+// the boundaries have to line back up soon after it and everything after
+// that has to match the original shifted by the size change. Also checks
+// the chunks cover the stream, stay inside min and max, carry the right
+// hash and don't depend on how the stream is fed in.
+// make kc-cdc-tests && ./kc-cdc-tests [edits per case, 64]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kc-cdc.h"
+#include "kc-hash.h"
+
+#define DATA_SIZE  (8 << 20)
+#define CHUNK_MIN  (2 << 10)
+#define CHUNK_AVG  (8 << 10)
+#define CHUNK_MAX  (64 << 10)
+// Bytes past the end of an edit the boundaries must have lined up by.
+#define RESYNC_LIMIT (4 * CHUNK_MAX)
+
+static int failures = 0;
+
+static uint64_t rng_state = 0x6a09e667f3bcc909;
+
+// splitmix64, used for the data and to place the edits.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static void rng_fill(uint8_t *data, size_t length) {
+    for(size_t i = 0; i < length; i += 8) {
+        uint64_t x = rng_next();
+        memcpy(data + i, &x, length - i < 8 ? length - i : 8);
+    }
+}
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+typedef struct ChunkList {
+    KcCdcChunk *chunks;
+    size_t      count;
+    size_t      cap;
+} ChunkList;
+
+static void collect(void *ctx, const KcCdcChunk *chunk) {
+    ChunkList *list = ctx;
+    if(list->count == list->cap) {
+        list->cap    = list->cap ? list->cap * 2 : 1024;
+        list->chunks = realloc(list->chunks, list->cap * sizeof(KcCdcChunk));
+        if(list->chunks == NULL) {
+            fprintf(stderr, "kc-cdc-tests: failed to allocate chunk list\n");
+            exit(1);
+        }
+    }
+    list->chunks[list->count++] = *chunk;
+}
+
+// Chunks data in one go, or in random sized pieces when pieces is set.
+static void chunk_data(const uint8_t *data, size_t length, int pieces, ChunkList *list) {
+    KcCdc cdc;
+    list->count = 0;
+    if(kc_cdc_init(&cdc, CHUNK_MIN, CHUNK_AVG, CHUNK_MAX) < 0) {
+        fprintf(stderr, "kc-cdc-tests: failed to set up chunker\n");
+        exit(1);
+    }
+    size_t pos = 0;
+    while(pieces && pos < length) {
+        size_t take = rng_next() % (3 * CHUNK_MAX) + 1;
+        take = take < length - pos ? take : length - pos;
+        kc_cdc_update(&cdc, data + pos, take, 0, collect, list);
+        pos += take;
+    }
+    kc_cdc_update(&cdc, data + pos, length - pos, 1, collect, list);
+}
+
+static int same_chunk(const KcCdcChunk *a, const KcCdcChunk *b, int64_t shift) {
+    return a->offset + shift == b->offset && a->length == b->length &&
+           a->upper == b->upper && a->lower == b->lower;
+}
+
+// Chunks are back to back from 0 to length, within the size limits and
+// hashed right.
+static int check_chunks(const uint8_t *data, size_t length, const ChunkList *list) {
+    uint64_t pos = 0;
+    for(size_t i = 0; i < list->count; i++) {
+        const KcCdcChunk *c = &list->chunks[i];
+        uint64_t upper, lower;
+        if(c->offset != pos || c->length == 0 || c->length > CHUNK_MAX) {
+            return 0;
+        }
+        if(c->length < CHUNK_MIN && i + 1 != list->count) {
+            return 0;
+        }
+        kc_hash(data + c->offset, c->length, &upper, &lower);
+        if(upper != c->upper || lower != c->lower) {
+            return 0;
+        }
+        pos += c->length;
+    }
+    return pos == length;
+}
+
+typedef struct EditStats {
+    size_t   edits;
+    int      ok;
+    uint64_t worst_resync; // Most bytes after an edit before the boundaries lined up.
+    size_t   changed;      // Chunks in the edited stream that weren't in the original.
+} EditStats;
+
+// Compares the chunks of the original and an edited copy where the bytes
+// [at, at + removed) were replaced with added new ones.
+static void compare_edit(const ChunkList *orig, const ChunkList *edit, uint64_t at, uint64_t removed, uint64_t added, EditStats *stats) {
+    int64_t shift = (int64_t)added - (int64_t)removed;
+    size_t  i     = 0;
+    // Everything that ended before the edit is untouched.
+    while(i < orig->count && orig->chunks[i].offset + orig->chunks[i].length <= at) {
+        if(i >= edit->count || !same_chunk(&orig->chunks[i], &edit->chunks[i], 0)) {
+            stats->ok = 0;
+            return;
+        }
+        i++;
+    }
+    // Find the first boundary past the edit both streams share.
+    size_t   o   = i;
+    size_t   e   = i;
+    uint64_t end = at + added;
+    while(o < orig->count && e < edit->count) {
+        uint64_t oe = orig->chunks[o].offset + orig->chunks[o].length + shift;
+        uint64_t ee = edit->chunks[e].offset + edit->chunks[e].length;
+        if(oe == ee && ee >= end) {
+            o++;
+            e++;
+            break;
+        }
+        if(oe <= ee) {
+            o++;
+        } else {
+            e++;
+        }
+    }
+    uint64_t synced = e > 0 ? edit->chunks[e - 1].offset + edit->chunks[e - 1].length : 0;
+    if(synced - end > stats->worst_resync) {
+        stats->worst_resync = synced - end;
+    }
+    if(synced - end > RESYNC_LIMIT) {
+        stats->ok = 0;
+    }
+    stats->changed += e - i;
+    // From there on the chunks are the same, just moved.
+    if(orig->count - o != edit->count - e) {
+        stats->ok = 0;
+        return;
+    }
+    for(; o < orig->count; o++, e++) {
+        if(!same_chunk(&orig->chunks[o], &edit->chunks[e], shift)) {
+            stats->ok = 0;
+            return;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        uint64_t    removed;
+        uint64_t    added;
+    } cases[] = {
+        { "insert 1",           0,     1 },
+        { "insert 100",         0,   100 },
+        { "insert 20000",       0, 20000 },
+        { "delete 37",         37,     0 },
+        { "delete 70000",   70000,     0 },
+        { "overwrite 16",      16,    16 },
+        { "replace 5 by 900",   5,   900 },
+    };
+    size_t   edits  = argc > 1 ? strtoul(argv[1], NULL, 10) : 64;
+    uint8_t *data   = malloc(DATA_SIZE);
+    uint8_t *edited = malloc(DATA_SIZE + 65536);
+    ChunkList orig  = { NULL, 0, 0 };
+    ChunkList edit  = { NULL, 0, 0 };
+    ChunkList piece = { NULL, 0, 0 };
+    if(data == NULL || edited == NULL) {
+        fprintf(stderr, "kc-cdc-tests: failed to allocate buffers\n");
+        return 1;
+    }
+    rng_fill(data, DATA_SIZE);
+    chunk_data(data, DATA_SIZE, 0, &orig);
+    printf("KcCdc min %d avg %d max %d over %d MiB, %zu chunks\n", CHUNK_MIN, CHUNK_AVG, CHUNK_MAX, DATA_SIZE >> 20, orig.count);
+    printf("  %-24s %s\n", "chunks cover the data", verdict(check_chunks(data, DATA_SIZE, &orig)));
+    int split_ok = 1;
+    for(int round = 0; round < 8; round++) {
+        chunk_data(data, DATA_SIZE, 1, &piece);
+        split_ok &= piece.count == orig.count;
+        for(size_t i = 0; split_ok && i < orig.count; i++) {
+            split_ok &= same_chunk(&orig.chunks[i], &piece.chunks[i], 0);
+        }
+    }
+    printf("  %-24s %s\n", "fed in pieces", verdict(split_ok));
+    printf("  %-24s %8s %14s %14s\n", "edit", "edits", "chunks/edit", "worst resync");
+    for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        EditStats stats = { 0, 1, 0, 0 };
+        for(size_t n = 0; n < edits; n++) {
+            // Keep the edit a few chunks away from either end.
+            uint64_t at = CHUNK_MAX + rng_next() % (DATA_SIZE - 4 * CHUNK_MAX - cases[c].removed);
+            memcpy(edited, data, at);
+            rng_fill(edited + at, cases[c].added);
+            memcpy(edited + at + cases[c].added, data + at + cases[c].removed, DATA_SIZE - at - cases[c].removed);
+            size_t length = DATA_SIZE - cases[c].removed + cases[c].added;
+            chunk_data(edited, length, n % 2, &edit);
+            stats.ok &= check_chunks(edited, length, &edit);
+            compare_edit(&orig, &edit, at, cases[c].removed, cases[c].added, &stats);
+            stats.edits++;
+        }
+        printf("  %-24s %8zu %14.2f %14llu  %s\n", cases[c].name, stats.edits,
+               stats.edits ? (double)stats.changed / stats.edits : 0.0,
+               (unsigned long long)stats.worst_resync, verdict(stats.ok));
+    }
+    free(orig.chunks);
+    free(edit.chunks);
+    free(piece.chunks);
+    free(edited);
+    free(data);
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <string.h>
+
+#include "kc-cdc.h"
+
+// How many more (fewer) bits have to be zero before (after) the average
+// size. Two is what the FastCDC paper settles on.
+#define NORMAL_LEVEL 2
+
+// The top bits of the fingerprint have seen the most bytes.
+static uint64_t top_bits(int count) {
+    if(count <= 0) {
+        return 0;
+    }
+    if(count >= 64) {
+        return ~(uint64_t)0;
+    }
+    return ~(uint64_t)0 << (64 - count);
+}
+
+static void chunk_reset(KcCdc *cdc) {
+    cdc->size = 0;
+    cdc->fp   = 0;
+    kc_hash_init(&cdc->state);
+}
+
+int kc_cdc_init(KcCdc *cdc, uint64_t min, uint64_t avg, uint64_t max) {
+    if(min == 0 || min >= avg || avg >= max) {
+        return -1;
+    }
+    int bits = 0;
+    while(((uint64_t)1 << (bits + 1)) <= avg) {
+        bits++;
+    }
+    // Round to the nearer power of two.
+    if(avg - ((uint64_t)1 << bits) > ((uint64_t)1 << bits) / 2) {
+        bits++;
+    }
+    cdc->mask_small = top_bits(bits + NORMAL_LEVEL);
+    cdc->mask_large = top_bits(bits - NORMAL_LEVEL);
+    cdc->min        = min;
+    cdc->avg        = avg;
+    cdc->max        = max;
+    for(int i = 0; i < 256; i++) {
+        uint8_t  entry[8] = { 'k', 'c', '-', 'g', 'e', 'a', 'r', (uint8_t)i };
+        uint64_t lower;
+        kc_hash(entry, sizeof(entry), &cdc->gear[i], &lower);
+    }
+    cdc->offset = 0;
+    chunk_reset(cdc);
+    return 0;
+}
+
+// Returns how many bytes of data go to the current chunk and sets *cut when
+// the chunk ends with them.
+static size_t cdc_scan(KcCdc *cdc, const uint8_t *data, size_t length, int *cut) {
+    const uint64_t *gear = cdc->gear;
+    uint64_t        fp   = cdc->fp;
+    uint64_t        size = cdc->size;
+    size_t          i    = 0;
+    *cut = 0;
+    // Nothing before min can be a boundary so it isn't even rolled over.
+    if(size < cdc->min) {
+        uint64_t skip = cdc->min - size;
+        if(skip > length) {
+            skip = length;
+        }
+        i    += skip;
+        size += skip;
+    }
+    // Up to avg, harder to match.
+    size_t end = length;
+    if(size < cdc->avg && cdc->avg - size < end - i) {
+        end = i + (cdc->avg - size);
+    }
+    uint64_t mask = cdc->mask_small;
+    if(size < cdc->avg) {
+        size_t start = i;
+        while(i < end) {
+            fp = (fp << 1) + gear[data[i++]];
+            if(!(fp & mask)) {
+                *cut = 1;
+                break;
+            }
+        }
+        size += i - start;
+    }
+    // Then up to max, easier.
+    if(!*cut && size >= cdc->avg) {
+        mask = cdc->mask_large;
+        end  = length;
+        if(cdc->max - size < end - i) {
+            end = i + (cdc->max - size);
+        }
+        size_t start = i;
+        while(i < end) {
+            fp = (fp << 1) + gear[data[i++]];
+            if(!(fp & mask)) {
+                *cut = 1;
+                break;
+            }
+        }
+        size += i - start;
+        if(size >= cdc->max) {
+            *cut = 1;
+        }
+    }
+    cdc->fp   = fp;
+    cdc->size = size;
+    return i;
+}
+
+static void cdc_emit(KcCdc *cdc, KcCdcEmit emit, void *ctx) {
+    KcCdcChunk chunk;
+    chunk.offset = cdc->offset;
+    chunk.length = cdc->size;
+    kc_hash_final(&cdc->state, &chunk.upper, &chunk.lower);
+    emit(ctx, &chunk);
+    cdc->offset += cdc->size;
+    chunk_reset(cdc);
+}
+
+void kc_cdc_update(KcCdc *cdc, const void *data, size_t length, int last, KcCdcEmit emit, void *ctx) {
+    const uint8_t *bytes = data;
+    while(length > 0) {
+        int    cut;
+        size_t used = cdc_scan(cdc, bytes, length, &cut);
+        kc_hash_update(&cdc->state, bytes, used);
+        bytes  += used;
+        length -= used;
+        if(cut) {
+            cdc_emit(cdc, emit, ctx);
+        }
+    }
+    if(last && cdc->size > 0) {
+        cdc_emit(cdc, emit, ctx);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef KC_CDC_H
+#define KC_CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kc-hash.h"
+
+// One chunk of the stream and its kc_hash.
+typedef struct KcCdcChunk {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t upper;
+    uint64_t lower;
+} KcCdcChunk;
+
+typedef void (*KcCdcEmit)(void *ctx, const KcCdcChunk *chunk);
+
+// Content defined chunker. A Gear rolling hash runs over the data and a
+// chunk ends where its top bits are all zero, so an edit only moves the
+// boundaries near it and the chunks after line up again. Before the average
+// size more bits have to be zero than after it, which keeps sizes bunched
+// around the average (FastCDC's normalized chunking).
+typedef struct KcCdc {
+    uint64_t    gear[256];
+    uint64_t    mask_small; // Used until the chunk reaches avg.
+    uint64_t    mask_large; // Used from avg up to max.
+    uint64_t    min;
+    uint64_t    avg;
+    uint64_t    max;
+    // The chunk being built.
+    uint64_t    offset;
+    uint64_t    size;
+    uint64_t    fp;
+    KcHashState state;
+} KcCdc;
+
+// Sizes must satisfy 0 < min < avg < max, avg is rounded to a power of two
+// when picking the masks. Returns -1 if they don't. The gear table is made
+// from kc_hash so the same sizes always give the same chunks.
+int  kc_cdc_init  (KcCdc *cdc, uint64_t min, uint64_t avg, uint64_t max);
+// Feeds the next piece of the stream, calling emit for every chunk that
+// ends inside it. Chunks don't depend on how the stream is split up. Pass
+// last on the final piece, which can be empty, to get the trailing chunk.
+void kc_cdc_update(KcCdc *cdc, const void *data, size_t length, int last, KcCdcEmit emit, void *ctx);
+
+#endif // KC_CDC_H
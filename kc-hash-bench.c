@@ -0,0 +1,265 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Compares kc_hash, kc_hash_wide and kc_hash_tree throughput, kc_hash
+// against kc_hash_many over a couple million path sized keys, and times
+// kc_map with a million entries, the kc_cdc chunker and the sketches.
+// make kc-hash-bench
+// ./kc-hash-bench [MiB] [rounds]
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "kc-cdc.h"
+#include "kc-hash.h"
+#include "kc-map.h"
+#include "kc-sketch.h"
+
+typedef void (*HashFunc)(const void *data, size_t length, uint64_t *upper, uint64_t *lower);
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *name, HashFunc func, const uint8_t *data, size_t size, int rounds) {
+    uint64_t upper = 0;
+    uint64_t lower = 0;
+    double   best  = 1e30;
+    for(int i = 0; i < rounds; i++) {
+        double start = now_sec();
+        func(data, size, &upper, &lower);
+        double took = now_sec() - start;
+        if(took < best) {
+            best = took;
+        }
+    }
+    printf("%-14s %8.2f GB/s  %016llx%016llx\n", name, size / best / 1e9,
+           (unsigned long long)upper, (unsigned long long)lower);
+}
+
+static void tree_all(const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    kc_hash_tree(data, length, 0, upper, lower);
+}
+
+static void tree_one(const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    kc_hash_tree(data, length, 1, upper, lower);
+}
+
+static void count_chunk(void *ctx, const KcCdcChunk *chunk) {
+    (void)chunk;
+    (*(size_t*)ctx)++;
+}
+
+static void bench_cdc(const uint8_t *data, size_t size, int rounds) {
+    KcCdc  cdc;
+    size_t chunks = 0;
+    double best   = 1e30;
+    for(int i = 0; i < rounds; i++) {
+        kc_cdc_init(&cdc, 2048, 8192, 65536);
+        chunks = 0;
+        double start = now_sec();
+        kc_cdc_update(&cdc, data, size, 1, count_chunk, &chunks);
+        double took = now_sec() - start;
+        if(took < best) {
+            best = took;
+        }
+    }
+    printf("%-14s %8.2f GB/s  %zu chunks, %.0f bytes on average\n", "kc_cdc 8K", size / best / 1e9,
+           chunks, (double)size / chunks);
+}
+
+static void bench_keys(size_t n) {
+    char      *text = malloc(n * 64);
+    const void **keys = malloc(n * sizeof(void*));
+    uint32_t  *lens = malloc(n * sizeof(uint32_t));
+    uint64_t  *out  = malloc(n * 2 * sizeof(uint64_t));
+    uint64_t  *ref  = malloc(n * 2 * sizeof(uint64_t));
+    if(text == NULL || keys == NULL || lens == NULL || out == NULL || ref == NULL) {
+        fprintf(stderr, "kc-hash-bench: failed to allocate keys\n");
+        exit(1);
+    }
+    static const char *dirs[] = { "textures/cars/", "textures/tracks/", "sound/", "models/" };
+    for(size_t i = 0; i < n; i++) {
+        keys[i] = text + i * 64;
+        lens[i] = snprintf(text + i * 64, 64, "%sasset_%zu.dat", dirs[i % 4], i * 2654435761u % n);
+    }
+    // Fault the pages in now rather than while timing.
+    memset(out, 0, n * 2 * sizeof(uint64_t));
+    memset(ref, 0, n * 2 * sizeof(uint64_t));
+    double start = now_sec();
+    for(size_t i = 0; i < n; i++) {
+        kc_hash(keys[i], lens[i], ref + i * 2, ref + i * 2 + 1);
+    }
+    double single = now_sec() - start;
+    start = now_sec();
+    kc_hash_many(keys, lens, n, out);
+    double many = now_sec() - start;
+    size_t bad = 0;
+    for(size_t i = 0; i < n * 2; i++) {
+        bad += out[i] != ref[i];
+    }
+    printf("%zu keys:\n", n);
+    printf("kc_hash        %8.2f ns/key\n", single / n * 1e9);
+    printf("kc_hash_many   %8.2f ns/key  %s\n", many / n * 1e9, bad ? "MISMATCH" : "matches");
+    free(text);
+    free(keys);
+    free(lens);
+    free(out);
+    free(ref);
+}
+
+static void bench_map(size_t n) {
+    uint64_t *keys = malloc(n * sizeof(uint64_t));
+    KcMap     map;
+    if(keys == NULL || kc_map_init(&map, sizeof(uint64_t), sizeof(uint64_t), n) < 0) {
+        fprintf(stderr, "kc-hash-bench: failed to allocate map\n");
+        exit(1);
+    }
+    uint64_t x = 0x2545f4914f6cdd1d;
+    for(size_t i = 0; i < n; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        keys[i] = x;
+    }
+    double start = now_sec();
+    for(size_t i = 0; i < n; i++) {
+        *(uint64_t*)kc_map_insert(&map, &keys[i], NULL) = i;
+    }
+    double insert = now_sec() - start;
+    // The keys are random so walking them in order still lands all over
+    // the table.
+    size_t found = 0;
+    start = now_sec();
+    for(size_t i = 0; i < n; i++) {
+        uint64_t *v = kc_map_find(&map, &keys[i]);
+        found += v != NULL && *v == i;
+    }
+    double hit = now_sec() - start;
+    start = now_sec();
+    for(size_t i = 0; i < n; i++) {
+        uint64_t miss = keys[i] ^ 0x8000000000000000;
+        found += kc_map_find(&map, &miss) != NULL;
+    }
+    double miss = now_sec() - start;
+    printf("kc_map with %zu entries:\n", n);
+    printf("insert         %8.2f ns/op\n", insert / n * 1e9);
+    printf("find hit       %8.2f ns/op  %s\n", hit / n * 1e9, found == n ? "matches" : "MISMATCH");
+    printf("find miss      %8.2f ns/op\n", miss / n * 1e9);
+    kc_map_free(&map);
+    free(keys);
+}
+
+// Adds n keys split over two sketches of each kind, merges them, then
+// checks them against keys that were never added.
+static void bench_sketch(uint64_t n) {
+    static const uint64_t secret[2] = { 0xa4093822299f31d0, 0x082efa98ec4e6c89 };
+    KcBloom    bloom[2];
+    KcCountMin cm[2];
+    KcHll      hll[2];
+    KcHashSeed seed;
+    kc_hash_seed_init(&seed, secret);
+    for(int i = 0; i < 2; i++) {
+        if(kc_bloom_init(&bloom[i], n, 0.01, &seed) < 0 || kc_cm_init(&cm[i], 0.0001, 0.01, &seed) < 0 ||
+           kc_hll_init(&hll[i], 14, &seed) < 0) {
+            fprintf(stderr, "kc-hash-bench: failed to allocate sketches\n");
+            exit(1);
+        }
+    }
+    double start = now_sec();
+    for(uint64_t i = 0; i < n; i++) {
+        kc_bloom_add(&bloom[i & 1], &i, sizeof(i));
+    }
+    double add = now_sec() - start;
+    for(uint64_t i = 0; i < n; i++) {
+        // Key i shows up i % 4 + 1 times.
+        kc_cm_add(&cm[i & 1], &i, sizeof(i), i % 4 + 1);
+        kc_hll_add(&hll[i & 1], &i, sizeof(i));
+    }
+    kc_bloom_merge(&bloom[0], &bloom[1]);
+    kc_cm_merge(&cm[0], &cm[1]);
+    kc_hll_merge(&hll[0], &hll[1]);
+    size_t false_pos = 0;
+    start = now_sec();
+    for(uint64_t i = n; i < n * 2; i++) {
+        false_pos += kc_bloom_test(&bloom[0], &i, sizeof(i));
+    }
+    double test = now_sec() - start;
+    size_t missing = 0;
+    for(uint64_t i = 0; i < n; i++) {
+        missing += !kc_bloom_test(&bloom[0], &i, sizeof(i));
+    }
+    double over = 0;
+    for(uint64_t i = 0; i < n; i++) {
+        over += kc_cm_estimate(&cm[0], &i, sizeof(i)) - (i % 4 + 1);
+    }
+    double count = kc_hll_count(&hll[0]);
+    printf("sketches with %llu keys:\n", (unsigned long long)n);
+    printf("bloom add      %8.2f ns/op\n", add / n * 1e9);
+    printf("bloom test     %8.2f ns/op  %.3f%% false positives at 1%%, %zu missing\n",
+           test / n * 1e9, 100.0 * false_pos / n, missing);
+    printf("count-min      %8.2f average overcount\n", over / n);
+    printf("hyperloglog    %8.0f distinct, %+.2f%%\n", count, 100 * (count - n) / n);
+    for(int i = 0; i < 2; i++) {
+        kc_bloom_free(&bloom[i]);
+        kc_cm_free(&cm[i]);
+        kc_hll_free(&hll[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t mib    = argc > 1 ? strtoul(argv[1], NULL, 10) : 256;
+    int    rounds = argc > 2 ? atoi(argv[2]) : 5;
+    size_t size   = mib * 1024 * 1024;
+    uint8_t *data = malloc(size);
+    if(data == NULL) {
+        fprintf(stderr, "kc-hash-bench: failed to allocate %zu MiB\n", mib);
+        return 1;
+    }
+    // Anything but zero pages.
+    uint64_t x = 0x9e3779b97f4a7c15;
+    for(size_t i = 0; i < size; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        data[i] = x;
+    }
+    printf("Hashing %zu MiB, best of %d\n", mib, rounds);
+    bench("kc_hash", kc_hash, data, size, rounds);
+    bench("kc_hash_wide", kc_hash_wide, data, size, rounds);
+    bench("kc_hash_tree", tree_all, data, size, rounds);
+    bench("kc_hash_tree/1", tree_one, data, size, rounds);
+    bench_cdc(data, size, rounds);
+    free(data);
+    bench_keys(2000000);
+    bench_map(1000000);
+    bench_sketch(1000000);
+    return 0;
+}
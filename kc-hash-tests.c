@@ -0,0 +1,756 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Statistical quality and speed checks for kc_hash. Prints the numbers for
+// each test and exits non zero if any of them fall outside of what a random
+// 128 bit function would give. -seeded runs everything on kc_hash_seeded
+// with a fixed secret instead. -report still prints the failures but exits
+// zero, for looking at the known weak spots of plain kc_hash. Checks with an
+// exact answer, like streaming giving the one shot digest, fail either way.
+// make C_OPT="-O3 -march=x86-64" checks the plain kc_hash_wide against the
+// same known answers as the AVX2 one.
+// make kc-hash-tests && ./kc-hash-tests [-seeded] [-report] [max MiB for throughput, 1024]
+
+#define _POSIX_C_SOURCE 199309L
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "kc-hash.h"
+
+static int failures = 0;
+static int broken   = 0; // Failed checks with an exact answer, -report can't hide these.
+
+static int        use_seed = 0;
+static KcHashSeed seed;
+
+// The hash under test.
+static void hash(const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    if(use_seed) {
+        kc_hash_seeded(&seed, data, length, upper, lower);
+    } else {
+        kc_hash(data, length, upper, lower);
+    }
+}
+
+static uint64_t rng_state = 0x853c49e6748fea9b;
+
+// splitmix64, only used to make test keys.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static void rng_fill(uint8_t *buf, size_t len) {
+    while(len >= 8) {
+        uint64_t x = rng_next();
+        memcpy(buf, &x, 8);
+        buf += 8;
+        len -= 8;
+    }
+    if(len > 0) {
+        uint64_t x = rng_next();
+        memcpy(buf, &x, len);
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+static const char* exact(int ok) {
+    if(!ok) {
+        broken++;
+    }
+    return verdict(ok);
+}
+
+static int popcount64(uint64_t x) {
+    return __builtin_popcountll(x);
+}
+
+static void stream_init(KcHashState *state) {
+    if(use_seed) {
+        kc_hash_init_seeded(state, &seed);
+    } else {
+        kc_hash_init(state);
+    }
+}
+
+// Streams data in pieces of step bytes, or random ones from 0 to 40 bytes
+// when step is 0. A digest is taken after every piece, which must not
+// disturb the state.
+static void stream_hash(const uint8_t *data, size_t length, size_t step, uint64_t *upper, uint64_t *lower) {
+    KcHashState state;
+    stream_init(&state);
+    for(size_t pos = 0; pos < length;) {
+        size_t take = step ? step : rng_next() % 41;
+        take = take < length - pos ? take : length - pos;
+        kc_hash_update(&state, data + pos, take);
+        kc_hash_final(&state, upper, lower);
+        pos += take;
+    }
+    kc_hash_final(&state, upper, lower);
+}
+
+// Streaming has to give the same digest as one call however the input is
+// cut up, including pieces that start mid block and empty updates.
+static void test_streaming(void) {
+    static const size_t lens[]  = { 0, 1, 15, 16, 17, 31, 32, 33, 100, 1000, 4099 };
+    static const size_t steps[] = { 1, 15, 16, 17, 64, 0 };
+    uint8_t data[4099];
+    uint8_t moved[4099 + 1];
+    int     ok = 1;
+    printf("Streaming against one call, pieces of 1, 15, 16, 17, 64 and random bytes\n");
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        uint64_t want[2];
+        rng_fill(data, lens[l]);
+        // The same bytes one in, so no piece is aligned.
+        memcpy(moved + 1, data, lens[l]);
+        hash(data, lens[l], &want[0], &want[1]);
+        for(size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+            uint64_t got[2];
+            stream_hash(data, lens[l], steps[s], &got[0], &got[1]);
+            ok &= got[0] == want[0] && got[1] == want[1];
+            stream_hash(moved + 1, lens[l], steps[s], &got[0], &got[1]);
+            ok &= got[0] == want[0] && got[1] == want[1];
+        }
+    }
+    printf("  %-28s %s\n", use_seed ? "kc_hash_init_seeded" : "kc_hash_init", exact(ok));
+}
+
+// kc_hash_wide digests of bytes (i * 167 + 13) & 0xff, from both the AVX2
+// and the plain build. Lengths cover no stripes, partial and whole stripes
+// and a tail after many.
+static void test_wide_answers(void) {
+    static const struct {
+        size_t   length;
+        uint64_t upper;
+        uint64_t lower;
+    } answers[] = {
+        {    0, 0xd1f87149329f6564, 0x0102c49b7b68a3dc },
+        {    1, 0x9b575462ce4a9683, 0xde1b7f529c14b9b1 },
+        {   63, 0x04514636a1e16bbf, 0x303366a87e2ffd12 },
+        {   64, 0x87fda33b0dbf20f1, 0x5ce733cf6485218a },
+        {   65, 0xc2bd88ce07ab10e3, 0xfbe22c1114fa5af0 },
+        {  128, 0x94bce457b4e0dbec, 0xa2436649c5465042 },
+        {  200, 0x471fb48eaa98870c, 0x5e596c53df149892 },
+        { 4113, 0xfd739d252cef54b1, 0xadfb8853d57b89c5 },
+    };
+    static uint8_t data[4113 + 1];
+#ifdef __AVX2__
+    printf("kc_hash_wide known answers, AVX2 build\n");
+#else
+    printf("kc_hash_wide known answers, plain build\n");
+#endif
+    for(size_t i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+        uint64_t h[2];
+        uint64_t moved[2];
+        for(size_t j = 0; j < answers[i].length; j++) {
+            data[j] = (j * 167 + 13) & 0xff;
+        }
+        kc_hash_wide(data, answers[i].length, &h[0], &h[1]);
+        // Again from one byte in, the stripe loads must not care.
+        memmove(data + 1, data, answers[i].length);
+        kc_hash_wide(data + 1, answers[i].length, &moved[0], &moved[1]);
+        int ok = h[0] == answers[i].upper && h[1] == answers[i].lower && moved[0] == h[0] && moved[1] == h[1];
+        printf("  %5zu bytes  %016llx%016llx  %s\n", answers[i].length,
+               (unsigned long long)h[0], (unsigned long long)h[1], exact(ok));
+    }
+}
+
+// kc_hash_many against kc_hash key by key. Batches mix lengths around the
+// block size with long keys so lanes run out of blocks at different steps,
+// and most batch sizes leave keys over after the groups of four.
+static void test_many(void) {
+    static const uint32_t lens[]  = { 0, 1, 15, 16, 17, 31, 32, 33, 100, 1000, 4101 };
+    static const size_t   sizes[] = { 1, 2, 3, 4, 5, 7, 8, 13, 64, 103 };
+    static uint8_t        data[8192];
+    const void *keys[103];
+    uint32_t    key_lens[103];
+    uint64_t    out[103 * 2];
+    size_t      count = sizeof(lens) / sizeof(lens[0]);
+    int         ok    = 1;
+#ifdef __AVX2__
+    printf("kc_hash_many against kc_hash, AVX2 build\n");
+#else
+    printf("kc_hash_many against kc_hash, plain build\n");
+#endif
+    rng_fill(data, sizeof(data));
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+        for(int round = 0; round < 64; round++) {
+            for(size_t i = 0; i < n; i++) {
+                // Every key the same length on the first round, all in step.
+                key_lens[i] = lens[round == 0 ? s % count : rng_next() % count];
+                keys[i]     = data + rng_next() % (sizeof(data) - key_lens[i] + 1);
+            }
+            kc_hash_many(keys, key_lens, n, out);
+            for(size_t i = 0; i < n; i++) {
+                uint64_t h[2];
+                kc_hash(keys[i], key_lens[i], &h[0], &h[1]);
+                ok &= out[i * 2] == h[0] && out[i * 2 + 1] == h[1];
+            }
+        }
+    }
+    printf("  %-28s %s\n", "batches of 1 to 103 keys", exact(ok));
+}
+
+// The tree digest worked out the long way, one leaf after another.
+static void tree_reference(const uint8_t *data, uint64_t length, uint64_t *upper, uint64_t *lower) {
+    KcHashState state;
+    uint8_t     len_bytes[8];
+    uint64_t    offset = 0;
+    kc_hash_init(&state);
+    do {
+        uint64_t leaf[2];
+        uint64_t size = length - offset < KC_TREE_LEAF ? length - offset : KC_TREE_LEAF;
+        kc_hash(data + offset, size, &leaf[0], &leaf[1]);
+        kc_hash_update(&state, leaf, sizeof(leaf));
+        offset += size;
+    } while(offset < length);
+    for(int i = 0; i < 8; i++) {
+        len_bytes[i] = length >> (i * 8);
+    }
+    kc_hash_update(&state, len_bytes, sizeof(len_bytes));
+    kc_hash_final(&state, upper, lower);
+}
+
+// kc_hash_tree has to give the same digest for any thread count, and so
+// does the file version.
+static void test_tree(void) {
+    static const uint64_t lens[]    = { 0, 1000, KC_TREE_LEAF, 3 * KC_TREE_LEAF + 12345, 9 * KC_TREE_LEAF };
+    static const int      threads[] = { 1, 2, 3, 0 };
+    static const char    *path      = "kc-hash-tests.tmp";
+    uint8_t *data = malloc(9 * KC_TREE_LEAF);
+    if(data == NULL) {
+        fprintf(stderr, "kc-hash-tests: failed to allocate tree input\n");
+        exit(1);
+    }
+    rng_fill(data, 9 * KC_TREE_LEAF);
+    printf("kc_hash_tree against leaf by leaf, 1, 2, 3 and all threads\n");
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        uint64_t want[2];
+        uint64_t got[2];
+        int      ok = 1;
+        tree_reference(data, lens[l], &want[0], &want[1]);
+        for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            kc_hash_tree(data, lens[l], threads[t], &got[0], &got[1]);
+            ok &= got[0] == want[0] && got[1] == want[1];
+        }
+        FILE *f = fopen(path, "wb");
+        if(f == NULL || fwrite(data, 1, lens[l], f) != lens[l] || fclose(f) != 0) {
+            fprintf(stderr, "kc-hash-tests: failed to write ‘%s’\n", path);
+            exit(1);
+        }
+        for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            ok &= kc_hash_tree_file(path, threads[t], &got[0], &got[1]) == 0;
+            ok &= got[0] == want[0] && got[1] == want[1];
+        }
+        printf("  %10llu bytes  %s\n", (unsigned long long)lens[l], exact(ok));
+    }
+    remove(path);
+    free(data);
+}
+
+// Exports a state partway through, imports it into a fresh one and
+// finishes there, which has to match one call. Blobs that are cut short or
+// carry another version have to be turned away.
+static void test_export(void) {
+    static uint8_t data[5000];
+    uint8_t        blob[KC_HASH_STATE_MAX + 1];
+    uint64_t       want[2];
+    int            ok  = 1;
+    int            bad = 1;
+    rng_fill(data, sizeof(data));
+    hash(data, sizeof(data), &want[0], &want[1]);
+    printf("State export and import\n");
+    // Every tail length, plus no data at all.
+    for(size_t cut = 0; cut < 64; cut += cut < 40 ? 1 : 7) {
+        KcHashState state;
+        KcHashState resumed;
+        uint64_t    got[2];
+        stream_init(&state);
+        kc_hash_update(&state, data, cut);
+        size_t size = kc_hash_state_export(&state, blob);
+        ok &= size <= KC_HASH_STATE_MAX;
+        ok &= kc_hash_state_import(&resumed, blob, size) == 0;
+        kc_hash_update(&resumed, data + cut, sizeof(data) - cut);
+        kc_hash_final(&resumed, &got[0], &got[1]);
+        ok &= got[0] == want[0] && got[1] == want[1];
+        // Nothing shorter or longer is taken.
+        for(size_t short_size = 0; short_size < size; short_size++) {
+            bad &= kc_hash_state_import(&resumed, blob, short_size) < 0;
+        }
+        bad &= kc_hash_state_import(&resumed, blob, size + 1) < 0;
+        blob[4]++;
+        bad &= kc_hash_state_import(&resumed, blob, size) < 0;
+        blob[4]--;
+        blob[0] ^= 1;
+        bad &= kc_hash_state_import(&resumed, blob, size) < 0;
+        blob[0] ^= 1;
+        blob[5] |= 2;
+        bad &= kc_hash_state_import(&resumed, blob, size) < 0;
+    }
+    printf("  %-28s %s\n", "resumes to the same digest", exact(ok));
+    printf("  %-28s %s\n", "short or wrong blobs refused", exact(bad));
+}
+
+// Strict avalanche: flipping any one input bit should flip every output bit
+// half of the time. Bias is how far the worst (input, output) pair strays
+// from 0.5.
+#define SAC_SAMPLES 20000
+
+static void test_sac(void) {
+    static const size_t lens[] = { 1, 3, 8, 15, 16, 17, 32, 64 };
+    static uint32_t     flips[64 * 8][128];
+    printf("Avalanche (SAC), %d samples per input bit\n", SAC_SAMPLES);
+    printf("  %5s  %10s  %10s\n", "bytes", "mean flip", "max bias");
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t  len  = lens[l];
+        size_t  bits = len * 8;
+        uint8_t key[64];
+        // A single byte only has 256 keys so try every one of them. Each
+        // flip then gets seen from both ends, leaving half as many
+        // independent pairs to judge the noise by.
+        int     every   = bits < 16;
+        int     samples = every ? 1 << bits : SAC_SAMPLES;
+        // Four sigma of the sampling noise, plus the number of cells looked at.
+        double  limit   = 4.5 * sqrt(0.25 / (every ? samples / 2 : samples)) + 0.002;
+        memset(flips, 0, sizeof(flips));
+        for(int s = 0; s < samples; s++) {
+            uint64_t base[2];
+            if(every) {
+                key[0] = s;
+            } else {
+                rng_fill(key, len);
+            }
+            hash(key, len, &base[0], &base[1]);
+            for(size_t b = 0; b < bits; b++) {
+                uint64_t h[2];
+                key[b / 8] ^= 1 << (b % 8);
+                hash(key, len, &h[0], &h[1]);
+                key[b / 8] ^= 1 << (b % 8);
+                h[0] ^= base[0];
+                h[1] ^= base[1];
+                for(int w = 0; w < 2; w++) {
+                    while(h[w]) {
+                        flips[b][w * 64 + __builtin_ctzll(h[w])]++;
+                        h[w] &= h[w] - 1;
+                    }
+                }
+            }
+        }
+        double total = 0;
+        double worst = 0;
+        for(size_t b = 0; b < bits; b++) {
+            for(int o = 0; o < 128; o++) {
+                double p = (double)flips[b][o] / samples;
+                total += p;
+                if(fabs(p - 0.5) > worst) {
+                    worst = fabs(p - 0.5);
+                }
+            }
+        }
+        printf("  %5zu  %10.5f  %10.5f  %s\n", len, total / (bits * 128), worst, verdict(worst < limit));
+    }
+}
+
+// Bit independence: when one input bit flips, whether output bit j flips
+// should say nothing about output bit k. For every input bit the flips of
+// each output bit are kept as a bitset over the samples, so each pair is
+// just an AND and a popcount. Reports the worst correlation seen.
+#define BIC_SAMPLES 4096
+#define BIC_WORDS   (BIC_SAMPLES / 64)
+
+static void test_bic(void) {
+    static const size_t lens[] = { 8, 16, 24 };
+    static uint64_t     sets[128][BIC_WORDS];
+    printf("Bit independence (BIC), %d samples per input bit\n", BIC_SAMPLES);
+    printf("  %5s  %10s\n", "bytes", "max |corr|");
+    // Around five sigma for the largest of ~8000 pairs per input bit.
+    double limit = 6.0 / sqrt(BIC_SAMPLES);
+    for(size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+        size_t  len   = lens[l];
+        double  worst = 0;
+        uint8_t key[24];
+        for(size_t b = 0; b < len * 8; b++) {
+            memset(sets, 0, sizeof(sets));
+            for(int s = 0; s < BIC_SAMPLES; s++) {
+                uint64_t base[2];
+                uint64_t h[2];
+                rng_fill(key, len);
+                hash(key, len, &base[0], &base[1]);
+                key[b / 8] ^= 1 << (b % 8);
+                hash(key, len, &h[0], &h[1]);
+                h[0] ^= base[0];
+                h[1] ^= base[1];
+                for(int o = 0; o < 128; o++) {
+                    sets[o][s / 64] |= ((h[o / 64] >> (o % 64)) & 1) << (s % 64);
+                }
+            }
+            double p[128];
+            for(int o = 0; o < 128; o++) {
+                int count = 0;
+                for(int w = 0; w < BIC_WORDS; w++) {
+                    count += popcount64(sets[o][w]);
+                }
+                p[o] = (double)count / BIC_SAMPLES;
+            }
+            for(int j = 0; j < 128; j++) {
+                for(int k = j + 1; k < 128; k++) {
+                    int both = 0;
+                    for(int w = 0; w < BIC_WORDS; w++) {
+                        both += popcount64(sets[j][w] & sets[k][w]);
+                    }
+                    double var  = p[j] * (1 - p[j]) * p[k] * (1 - p[k]);
+                    double corr = var > 0 ? ((double)both / BIC_SAMPLES - p[j] * p[k]) / sqrt(var) : 1;
+                    if(fabs(corr) > worst) {
+                        worst = fabs(corr);
+                    }
+                }
+            }
+        }
+        printf("  %5zu  %10.5f  %s\n", len, worst, verdict(worst < limit));
+    }
+}
+
+// Keys for the collision and bucket tests. Each generator writes key i and
+// returns its length.
+typedef size_t (*KeyGen)(size_t i, uint8_t *key);
+
+// Little endian counters, the classic bad case for weak integer hashes.
+static size_t key_counter(size_t i, uint8_t *key) {
+    for(int b = 0; b < 8; b++) {
+        key[b] = (uint64_t)i >> (b * 8);
+    }
+    return 8;
+}
+
+// Names like a pack index would hold.
+static size_t key_path(size_t i, uint8_t *key) {
+    return sprintf((char*)key, "textures/asset_%zu.dds", i);
+}
+
+// 64 zero bytes with one or two bits set.
+static size_t key_sparse(size_t i, uint8_t *key) {
+    memset(key, 0, 64);
+    if(i < 512) {
+        key[i / 8] |= 1 << (i % 8);
+        return 64;
+    }
+    // Pair number i - 512 among all j < k.
+    size_t pair = i - 512;
+    size_t k    = 1;
+    while(pair >= k) {
+        pair -= k;
+        k++;
+    }
+    key[pair / 8] |= 1 << (pair % 8);
+    key[k / 8]    |= 1 << (k % 8);
+    return 64;
+}
+
+// Every 20 character string of 'a' and 'b', one bit of entropy per byte.
+static size_t key_binary_text(size_t i, uint8_t *key) {
+    for(int b = 0; b < 20; b++) {
+        key[b] = (i >> b) & 1 ? 'b' : 'a';
+    }
+    return 20;
+}
+
+// Runs of zeros, only the length differs.
+static size_t key_zeros(size_t i, uint8_t *key) {
+    memset(key, 0, i);
+    return i;
+}
+
+typedef struct KeySet {
+    const char *name;
+    KeyGen      gen;
+    size_t      count;
+    size_t      max_len;
+} KeySet;
+
+static const KeySet key_sets[] = {
+    { "counter",     key_counter,     1 << 22,          8 },
+    { "path",        key_path,        1 << 22,          48 },
+    { "sparse",      key_sparse,      512 + 512 * 511 / 2, 64 },
+    { "binary text", key_binary_text, 1 << 20,          20 },
+    { "zeros",       key_zeros,       4096,             4096 },
+};
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_u128(const void *a, const void *b) {
+    const uint64_t *x = a;
+    const uint64_t *y = b;
+    if(x[0] != y[0]) {
+        return (x[0] > y[0]) - (x[0] < y[0]);
+    }
+    return (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+// Poisson tail, the chance of seeing at least count when expecting mean.
+static double poisson_tail(double mean, size_t count) {
+    double term = exp(-mean);
+    double cdf  = 0;
+    for(size_t k = 0; k < count; k++) {
+        cdf  += term;
+        term *= mean / (k + 1);
+    }
+    return 1 - cdf;
+}
+
+static uint64_t* hash_key_set(const KeySet *set) {
+    uint64_t *out = malloc(set->count * 2 * sizeof(uint64_t));
+    uint8_t  *key = malloc(set->max_len);
+    if(out == NULL || key == NULL) {
+        fprintf(stderr, "kc-hash-tests: failed to allocate keys for %s\n", set->name);
+        exit(1);
+    }
+    for(size_t i = 0; i < set->count; i++) {
+        size_t len = set->gen(i, key);
+        hash(key, len, out + i * 2, out + i * 2 + 1);
+    }
+    free(key);
+    return out;
+}
+
+// Full 128 bit collisions should never happen. The 32 bit slices give
+// something countable, checked against the birthday bound.
+static void test_collisions(void) {
+    printf("Collisions\n");
+    printf("  %-12s %9s  %6s  %17s  %17s\n", "keys", "count", "128bit", "low 32 (expect)", "high 32 (expect)");
+    for(size_t s = 0; s < sizeof(key_sets) / sizeof(key_sets[0]); s++) {
+        const KeySet *set    = &key_sets[s];
+        uint64_t     *hashes = hash_key_set(set);
+        uint64_t     *slice  = malloc(set->count * sizeof(uint64_t));
+        if(slice == NULL) {
+            fprintf(stderr, "kc-hash-tests: failed to allocate slices\n");
+            exit(1);
+        }
+        size_t full = 0;
+        size_t low  = 0;
+        size_t high = 0;
+        double n    = set->count;
+        double expect = n * (n - 1) / 2 / 4294967296.0;
+        for(size_t i = 0; i < set->count; i++) {
+            slice[i] = hashes[i * 2 + 1] & 0xffffffff;
+        }
+        qsort(slice, set->count, sizeof(uint64_t), cmp_u64);
+        for(size_t i = 1; i < set->count; i++) {
+            low += slice[i] == slice[i - 1];
+        }
+        for(size_t i = 0; i < set->count; i++) {
+            slice[i] = hashes[i * 2] >> 32;
+        }
+        qsort(slice, set->count, sizeof(uint64_t), cmp_u64);
+        for(size_t i = 1; i < set->count; i++) {
+            high += slice[i] == slice[i - 1];
+        }
+        qsort(hashes, set->count, 2 * sizeof(uint64_t), cmp_u128);
+        for(size_t i = 1; i < set->count; i++) {
+            full += hashes[i * 2] == hashes[i * 2 - 2] && hashes[i * 2 + 1] == hashes[i * 2 - 1];
+        }
+        // Fail a slice only if that many collisions would be a one in a
+        // million fluke for a random function.
+        int ok = full == 0 && poisson_tail(expect, low) > 1e-6 && poisson_tail(expect, high) > 1e-6;
+        printf("  %-12s %9zu  %6zu  %7zu (%7.1f)  %7zu (%7.1f)  %s\n", set->name, set->count,
+               full, low, expect, high, expect, verdict(ok));
+        free(slice);
+        free(hashes);
+    }
+}
+
+// Chi-square of keys dropped into m buckets, given as standard deviations
+// from the mean of the distribution. Power of two tables take either the low
+// bits or the high bits, others take the remainder.
+static double bucket_score(const uint64_t *hashes, size_t n, uint64_t m, int use_high, uint32_t *counts) {
+    int shift = 0;
+    while(((uint64_t)1 << shift) < m) {
+        shift++;
+    }
+    memset(counts, 0, m * sizeof(uint32_t));
+    for(size_t i = 0; i < n; i++) {
+        uint64_t h = hashes[i * 2 + 1];
+        if(use_high) {
+            counts[hashes[i * 2] >> (64 - shift)]++;
+        } else if((m & (m - 1)) == 0) {
+            counts[h & (m - 1)]++;
+        } else {
+            counts[h % m]++;
+        }
+    }
+    double expect = (double)n / m;
+    double chi    = 0;
+    for(uint64_t b = 0; b < m; b++) {
+        double d = counts[b] - expect;
+        chi += d * d / expect;
+    }
+    return (chi - (m - 1)) / sqrt(2.0 * (m - 1));
+}
+
+static void test_buckets(void) {
+    static const struct {
+        uint64_t m;
+        int      high;
+    } tables[] = {
+        { 1 << 10, 0 }, { 1 << 10, 1 }, { 1 << 16, 0 }, { 1 << 16, 1 },
+        { 1000, 0 }, { 65521, 0 }, { 100003, 0 }
+    };
+    uint32_t *counts = malloc(100003 * sizeof(uint32_t));
+    if(counts == NULL) {
+        fprintf(stderr, "kc-hash-tests: failed to allocate buckets\n");
+        exit(1);
+    }
+    printf("Bucket distribution, chi-square in standard deviations\n");
+    printf("  %-12s", "keys");
+    for(size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        char name[16];
+        sprintf(name, "%llu%s", (unsigned long long)tables[t].m, tables[t].high ? "h" : "");
+        printf(" %8s", name);
+    }
+    printf("\n");
+    for(size_t s = 0; s < sizeof(key_sets) / sizeof(key_sets[0]); s++) {
+        const KeySet *set    = &key_sets[s];
+        uint64_t     *hashes = hash_key_set(set);
+        int           ok     = 1;
+        printf("  %-12s", set->name);
+        for(size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+            // Too few keys per bucket and chi-square stops meaning much.
+            if(set->count < tables[t].m * 4) {
+                printf(" %8s", "-");
+                continue;
+            }
+            double score = bucket_score(hashes, set->count, tables[t].m, tables[t].high, counts);
+            ok &= fabs(score) < 5;
+            printf(" %8.2f", score);
+        }
+        printf("  %s\n", verdict(ok));
+        free(hashes);
+    }
+    printf("  (h = top bits of upper, otherwise lower & (m - 1) or lower %% m)\n");
+    free(counts);
+}
+
+// Throughput from a single byte up to max_bytes, growing by 4x. Small sizes
+// are repeated until enough time has passed to measure.
+static void test_speed(size_t max_bytes) {
+    uint8_t *data = malloc(max_bytes);
+    if(data == NULL) {
+        fprintf(stderr, "kc-hash-tests: failed to allocate %zu bytes, skipping throughput\n", max_bytes);
+        failures++;
+        return;
+    }
+    rng_fill(data, max_bytes);
+    printf("Throughput\n");
+    printf("  %12s  %12s  %10s  %12s  %10s\n", "bytes", use_seed ? "seeded ns" : "kc_hash ns", "GB/s", "wide ns", "GB/s");
+    for(size_t size = 1; size <= max_bytes; size *= 4) {
+        double   took[2];
+        uint64_t sink = 0;
+        for(int w = 0; w < 2; w++) {
+            size_t reps  = 1;
+            double start;
+            for(;;) {
+                start = now_sec();
+                for(size_t r = 0; r < reps; r++) {
+                    uint64_t upper;
+                    uint64_t lower;
+                    // Feed the last digest back in so calls can't be skipped.
+                    data[0] ^= sink;
+                    if(w == 0) {
+                        hash(data, size, &upper, &lower);
+                    } else {
+                        kc_hash_wide(data, size, &upper, &lower);
+                    }
+                    sink = upper ^ lower;
+                }
+                double elapsed = now_sec() - start;
+                if(elapsed > 0.1 || reps >= ((size_t)1 << 40) / size) {
+                    took[w] = elapsed / reps;
+                    break;
+                }
+                reps *= 4;
+            }
+        }
+        printf("  %12zu  %12.1f  %10.3f  %12.1f  %10.3f\n", size,
+               took[0] * 1e9, size / took[0] / 1e9, took[1] * 1e9, size / took[1] / 1e9);
+        if(size > max_bytes / 4) {
+            break;
+        }
+    }
+    free(data);
+}
+
+int main(int argc, char **argv) {
+    int report = 0;
+    for(; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+        if(strcmp(argv[1], "-seeded") == 0) {
+            static const uint64_t secret[2] = { 0x243f6a8885a308d3, 0x13198a2e03707344 };
+            kc_hash_seed_init(&seed, secret);
+            use_seed = 1;
+        } else if(strcmp(argv[1], "-report") == 0) {
+            report = 1;
+        } else {
+            fprintf(stderr, "kc-hash-tests: unrecognized option ‘%s’\n", argv[1]);
+            return 1;
+        }
+    }
+    size_t max_mib = argc > 1 ? strtoul(argv[1], NULL, 10) : 1024;
+    test_streaming();
+    test_wide_answers();
+    test_many();
+    test_tree();
+    test_export();
+    test_sac();
+    test_bic();
+    test_collisions();
+    test_buckets();
+    test_speed(max_mib * 1024 * 1024);
+    if(failures > 0) {
+        printf("%d check(s) failed%s\n", failures, report && broken == 0 ? ", only reporting" : "");
+        return report && broken == 0 ? 0 : 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Tree mode for kc_hash. Needs pthreads and mmap, so it lives apart from
+// kc-hash.c which stays plain C.
+// gcc -O3 -c kc-hash-tree.c && link with kc-hash.o -lpthread
+
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kc-hash.h"
+
+#define KC_TREE_MAX_THREADS 64
+
+typedef struct TreeJob {
+    const uint8_t *data;
+    uint64_t       length;
+    uint64_t       leaves;
+    uint64_t       next;    // Next leaf to claim, shared by all workers.
+    uint64_t      *digests; // Two words per leaf.
+} TreeJob;
+
+static void* tree_worker(void *arg) {
+    TreeJob *job = arg;
+    for(;;) {
+        uint64_t leaf = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if(leaf >= job->leaves) {
+            break;
+        }
+        uint64_t offset = leaf * KC_TREE_LEAF;
+        uint64_t size   = job->length - offset;
+        if(size > KC_TREE_LEAF) {
+            size = KC_TREE_LEAF;
+        }
+        kc_hash(job->data + offset, size, job->digests + leaf * 2, job->digests + leaf * 2 + 1);
+    }
+    return NULL;
+}
+
+// Every leaf digest goes in, in leaf order, then the total length.
+static void tree_final(KcHashState *state, uint64_t length, uint64_t *upper, uint64_t *lower) {
+    uint8_t len_bytes[8];
+    for(int i = 0; i < 8; i++) {
+        len_bytes[i] = length >> (i * 8);
+    }
+    kc_hash_update(state, len_bytes, sizeof(len_bytes));
+    kc_hash_final(state, upper, lower);
+}
+
+void kc_hash_tree(const void *data, uint64_t length, int threads, uint64_t *upper, uint64_t *lower) {
+    TreeJob job;
+    job.data    = data;
+    job.length  = length;
+    job.leaves  = (length + KC_TREE_LEAF - 1) / KC_TREE_LEAF;
+    job.next    = 0;
+    // An empty input still gets one leaf so it has a digest to combine.
+    if(job.leaves == 0) {
+        job.leaves = 1;
+    }
+    uint64_t  single[2];
+    job.digests = job.leaves == 1 ? single : malloc(job.leaves * 2 * sizeof(uint64_t));
+    if(job.digests == NULL) {
+        // Can't keep every leaf around, fold them in as they finish instead.
+        // Same result, just on one thread.
+        KcHashState state;
+        kc_hash_init(&state);
+        for(uint64_t leaf = 0; leaf < job.leaves; leaf++) {
+            uint64_t offset = leaf * KC_TREE_LEAF;
+            uint64_t size   = length - offset < KC_TREE_LEAF ? length - offset : KC_TREE_LEAF;
+            kc_hash((const uint8_t*)data + offset, size, single, single + 1);
+            kc_hash_update(&state, single, sizeof(single));
+        }
+        tree_final(&state, length, upper, lower);
+        return;
+    }
+
+    if(threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(threads > KC_TREE_MAX_THREADS) {
+        threads = KC_TREE_MAX_THREADS;
+    }
+    if((uint64_t)threads > job.leaves) {
+        threads = job.leaves;
+    }
+    // This thread works too, so only start threads - 1. If some fail to
+    // start the rest just pick up more leaves.
+    pthread_t workers[KC_TREE_MAX_THREADS];
+    int       started = 0;
+    for(int i = 1; i < threads; i++) {
+        if(pthread_create(&workers[started], NULL, tree_worker, &job) == 0) {
+            started++;
+        }
+    }
+    tree_worker(&job);
+    for(int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // The digests sit in leaf order no matter which thread did the work,
+    // so the root only depends on the data.
+    KcHashState state;
+    kc_hash_init(&state);
+    kc_hash_update(&state, job.digests, job.leaves * 2 * sizeof(uint64_t));
+    tree_final(&state, length, upper, lower);
+    if(job.digests != single) {
+        free(job.digests);
+    }
+}
+
+int kc_hash_tree_file(const char *path, int threads, uint64_t *upper, uint64_t *lower) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    uint64_t length = st.st_size;
+    // mmap refuses zero length mappings.
+    if(length == 0) {
+        close(fd);
+        kc_hash_tree(NULL, 0, threads, upper, lower);
+        return 0;
+    }
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED) {
+        return -1;
+    }
+    // Every thread walks forward through its leaf, so let the kernel read
+    // ahead.
+    madvise(map, length, MADV_SEQUENTIAL);
+    kc_hash_tree(map, length, threads, upper, lower);
+    munmap(map, length);
+    return 0;
+}
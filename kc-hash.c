@@ -24,29 +24,36 @@ SOFTWARE.
 
 #include <string.h>
 #include <stdint.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "kc-hash.h"
 
 #define RR64(x, r) ((x >> r) | (x << (64 - r)))
 #define RL64(x, r) ((x << r) | (x >> (64 - r)))
 #define MIX(x, y, k) (x = RL64(x, 11), x += y, x ^= k, y = RR64(y, 5), y ^= x)
 
-// NOTE - This is not a cryptographic hash function.
-// This simple hash function can hash files pretty quickly. Each operation is
-// working on 8 bytes at a time. 
-void kc_hash(const void *data, unsigned length,  uint64_t *upper, uint64_t *lower) {
-    // Old constants. Just random numbers that seemed to work well.
-    //uint64_t msb   = 0x7227fa27d388d60a;
-    //uint64_t lsb   = 0x613f5204a37cb723;
-
-    // Liked the idea from BLAKE2 Initialization vectors.
-    uint64_t msb   = 0x6a09e667f3bcc908;  // frac(sqrt(2))
-    uint64_t lsb   = 0xbb67ae8584caa73b;  // frac(sqrt(3))
-    uint64_t chunk = 0;
+// One block. Seeded hashes take a second round per block, with only one a
+// difference put in one block can be cancelled by the next one no matter
+// what the seed is.
+#define KC_BLOCK(msb, lsb, chunk, seeded) do { \
+    MIX(msb, lsb, chunk);                      \
+    if(seeded) {                               \
+        MIX(msb, lsb, ~chunk);                 \
+    }                                          \
+} while(0)
 
+// Shared by kc_hash and kc_hash_seeded. Past the extra block round the seeded
+// one also mixes in the length, otherwise trailing zeros would not change
+// the hash.
+static inline void kc_hash_from(uint64_t msb, uint64_t lsb, uint64_t chunk, int seeded, const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    uint64_t        total  = length;
     const uint64_t *data_w = (const uint64_t*)data;
     while(length >= 16) {
 		msb ^= data_w[0];
         lsb ^= data_w[1];
-        MIX(msb, lsb, chunk);
+        KC_BLOCK(msb, lsb, chunk, seeded);
         chunk = RL64(chunk, 3);
         data_w += 2;
 		length -= 16;
@@ -57,6 +64,10 @@ void kc_hash(const void *data, unsigned length,  uint64_t *upper, uint64_t *lowe
     memcpy(remnant, data_w, length);
     msb ^= remnant[0];
     lsb ^= remnant[1];
+    if(seeded) {
+        KC_BLOCK(msb, lsb, chunk, seeded);
+        msb ^= total;
+    }
     // One last final mix mainly to ensure a decent propagation
     // of the remnant and recent chunks.
     for(int i = 0; i < 8; i++) {
@@ -64,4 +75,391 @@ void kc_hash(const void *data, unsigned length,  uint64_t *upper, uint64_t *lowe
     }
     *upper = msb;
     *lower = lsb;
-}
\ No newline at end of file
+}
+
+// NOTE - This is not a cryptographic hash function.
+// This simple hash function can hash files pretty quickly. Each operation is
+// working on 8 bytes at a time. 
+void kc_hash(const void *data, size_t length,  uint64_t *upper, uint64_t *lower) {
+    // Old constants. Just random numbers that seemed to work well.
+    //uint64_t msb   = 0x7227fa27d388d60a;
+    //uint64_t lsb   = 0x613f5204a37cb723;
+
+    // Liked the idea from BLAKE2 Initialization vectors.
+    uint64_t msb   = 0x6a09e667f3bcc908;  // frac(sqrt(2))
+    uint64_t lsb   = 0xbb67ae8584caa73b;  // frac(sqrt(3))
+    kc_hash_from(msb, lsb, 0, 0, data, length, upper, lower);
+}
+
+void kc_hash_seed_init(KcHashSeed *seed, const uint64_t secret[2]) {
+    seed->msb   = 0x6a09e667f3bcc908;
+    seed->lsb   = 0xbb67ae8584caa73b;
+    seed->chunk = 0;
+    if(secret == NULL) {
+        return;
+    }
+    // Run the secret through the same rounds as a finished hash so every
+    // bit of it reaches all three words. The chunk counter is keyed too,
+    // otherwise the round constants would be known.
+    seed->msb ^= secret[0];
+    seed->lsb ^= secret[1];
+    for(int i = 0; i < 8; i++) {
+        MIX(seed->msb, seed->lsb, (uint64_t)i);
+    }
+    seed->chunk = seed->msb ^ RR64(seed->lsb, 17);
+    for(int i = 0; i < 8; i++) {
+        MIX(seed->msb, seed->lsb, seed->chunk + i);
+    }
+}
+
+void kc_hash_seeded(const KcHashSeed *seed, const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    kc_hash_from(seed->msb, seed->lsb, seed->chunk, 1, data, length, upper, lower);
+}
+
+#define KC_WIDE_LANES  4
+#define KC_WIDE_STRIPE (KC_WIDE_LANES * 16)
+
+// Each lane starts from its own pair of the BLAKE2 IVs, lane 0 from the
+// same pair as kc_hash.
+static const uint64_t kc_wide_iv[KC_WIDE_LANES * 2] = {
+    0x6a09e667f3bcc908, 0xbb67ae8584caa73b,
+    0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+    0x510e527fade682d1, 0x9b05688c2b3e6c1f,
+    0x1f83d9abfb41bd6b, 0x5be0cd19137e2179
+};
+
+#ifdef __AVX2__
+#ifdef __AVX512VL__
+#define RL64x4(x, r) _mm256_rol_epi64(x, r)
+#define RR64x4(x, r) _mm256_ror_epi64(x, r)
+#else
+#define RL64x4(x, r) _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64 - r))
+#define RR64x4(x, r) _mm256_or_si256(_mm256_srli_epi64(x, r), _mm256_slli_epi64(x, 64 - r))
+#endif
+#define MIX_x4(x, y, k) (                           \
+    x = RL64x4(x, 11), x = _mm256_add_epi64(x, y),  \
+    x = _mm256_xor_si256(x, k), y = RR64x4(y, 5),   \
+    y = _mm256_xor_si256(y, x)                      \
+)
+
+// Unpacking a stripe leaves the lanes in the order 0, 2, 1, 3.
+static uint64_t kc_wide_stripes(const uint8_t *data, size_t stripes, uint64_t *msb, uint64_t *lsb, uint64_t chunk) {
+    __m256i m = _mm256_setr_epi64x(msb[0], msb[2], msb[1], msb[3]);
+    __m256i l = _mm256_setr_epi64x(lsb[0], lsb[2], lsb[1], lsb[3]);
+    for(size_t i = 0; i < stripes; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)data);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(data + 32));
+        m = _mm256_xor_si256(m, _mm256_unpacklo_epi64(a, b));
+        l = _mm256_xor_si256(l, _mm256_unpackhi_epi64(a, b));
+        __m256i k = _mm256_set1_epi64x(chunk);
+        MIX_x4(m, l, k);
+        chunk = RL64(chunk, 3);
+        chunk++;
+        data += KC_WIDE_STRIPE;
+    }
+    uint64_t tmp[4];
+    _mm256_storeu_si256((__m256i*)tmp, m);
+    msb[0] = tmp[0]; msb[1] = tmp[2]; msb[2] = tmp[1]; msb[3] = tmp[3];
+    _mm256_storeu_si256((__m256i*)tmp, l);
+    lsb[0] = tmp[0]; lsb[1] = tmp[2]; lsb[2] = tmp[1]; lsb[3] = tmp[3];
+    return chunk;
+}
+#else
+static uint64_t kc_wide_stripes(const uint8_t *data, size_t stripes, uint64_t *msb, uint64_t *lsb, uint64_t chunk) {
+    for(size_t i = 0; i < stripes; i++) {
+        uint64_t words[KC_WIDE_LANES * 2];
+        memcpy(words, data, KC_WIDE_STRIPE);
+        // Lanes don't depend on each other so this can all overlap.
+        for(int j = 0; j < KC_WIDE_LANES; j++) {
+            msb[j] ^= words[j * 2];
+            lsb[j] ^= words[j * 2 + 1];
+            MIX(msb[j], lsb[j], chunk);
+        }
+        chunk = RL64(chunk, 3);
+        chunk++;
+        data += KC_WIDE_STRIPE;
+    }
+    return chunk;
+}
+#endif
+
+void kc_hash_wide(const void *data, size_t length, uint64_t *upper, uint64_t *lower) {
+    const uint8_t *bytes = data;
+    uint64_t msb[KC_WIDE_LANES];
+    uint64_t lsb[KC_WIDE_LANES];
+    for(int i = 0; i < KC_WIDE_LANES; i++) {
+        msb[i] = kc_wide_iv[i * 2];
+        lsb[i] = kc_wide_iv[i * 2 + 1];
+    }
+    size_t   stripes = length / KC_WIDE_STRIPE;
+    uint64_t chunk   = kc_wide_stripes(bytes, stripes, msb, lsb, 0);
+    bytes  += stripes * KC_WIDE_STRIPE;
+    length -= stripes * KC_WIDE_STRIPE;
+    // Fold the other lanes into lane 0 then carry on like kc_hash.
+    KcHashState state;
+    state.msb    = msb[0];
+    state.lsb    = lsb[0];
+    for(int i = 1; i < KC_WIDE_LANES; i++) {
+        state.msb ^= msb[i];
+        state.lsb ^= lsb[i];
+        MIX(state.msb, state.lsb, chunk);
+        chunk = RL64(chunk, 3);
+        chunk++;
+    }
+    state.chunk  = chunk;
+    state.length = 0;
+    state.seeded = 0;
+    kc_hash_update(&state, bytes, length);
+    kc_hash_final(&state, upper, lower);
+}
+
+// Words a key feeds in at step, a full block while it has them then the zero
+// padded remnant. Returns whether the step is a full block.
+static inline int kc_many_words(const uint8_t *key, uint32_t len, uint32_t step, uint64_t *words) {
+    uint32_t blocks = len / 16;
+    words[0] = 0;
+    words[1] = 0;
+    if(step < blocks) {
+        memcpy(words, key + step * 16, 16);
+        return 1;
+    }
+    if(step == blocks) {
+        memcpy(words, key + step * 16, len % 16);
+    }
+    return 0;
+}
+
+#ifdef __AVX2__
+static void kc_hash_four(const uint8_t **keys, const uint32_t *lens, uint64_t *out) {
+    uint32_t steps = 0;
+    uint32_t common = UINT32_MAX;
+    for(int j = 0; j < 4; j++) {
+        uint32_t blocks = lens[j] / 16;
+        steps  = blocks > steps  ? blocks : steps;
+        common = blocks < common ? blocks : common;
+    }
+    __m256i m = _mm256_set1_epi64x(0x6a09e667f3bcc908);
+    __m256i l = _mm256_set1_epi64x(0xbb67ae8584caa73b);
+    __m256i c = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi64x(1);
+    uint32_t step = 0;
+    // Every key still has a full block, load them straight in.
+    for(; step < common; step++) {
+        __m128i k0 = _mm_loadu_si128((const __m128i*)(keys[0] + step * 16));
+        __m128i k1 = _mm_loadu_si128((const __m128i*)(keys[1] + step * 16));
+        __m128i k2 = _mm_loadu_si128((const __m128i*)(keys[2] + step * 16));
+        __m128i k3 = _mm_loadu_si128((const __m128i*)(keys[3] + step * 16));
+        __m256i a  = _mm256_set_m128i(k2, k0);
+        __m256i b  = _mm256_set_m128i(k3, k1);
+        m = _mm256_xor_si256(m, _mm256_unpacklo_epi64(a, b));
+        l = _mm256_xor_si256(l, _mm256_unpackhi_epi64(a, b));
+        MIX_x4(m, l, c);
+        c = _mm256_add_epi64(RL64x4(c, 3), one);
+    }
+    // Lanes that ran out of blocks keep their state while the rest catch up.
+    for(; step <= steps; step++) {
+        uint64_t words[4][2];
+        uint64_t block[4];
+        for(int j = 0; j < 4; j++) {
+            block[j] = -(uint64_t)kc_many_words(keys[j], lens[j], step, words[j]);
+        }
+        __m256i mask = _mm256_loadu_si256((const __m256i*)block);
+        m = _mm256_xor_si256(m, _mm256_setr_epi64x(words[0][0], words[1][0], words[2][0], words[3][0]));
+        l = _mm256_xor_si256(l, _mm256_setr_epi64x(words[0][1], words[1][1], words[2][1], words[3][1]));
+        __m256i m2 = m;
+        __m256i l2 = l;
+        MIX_x4(m2, l2, c);
+        __m256i c2 = _mm256_add_epi64(RL64x4(c, 3), one);
+        m = _mm256_blendv_epi8(m, m2, mask);
+        l = _mm256_blendv_epi8(l, l2, mask);
+        c = _mm256_blendv_epi8(c, c2, mask);
+    }
+    for(int i = 0; i < 8; i++) {
+        __m256i k = _mm256_add_epi64(c, _mm256_set1_epi64x(i));
+        MIX_x4(m, l, k);
+    }
+    __m256i lo = _mm256_unpacklo_epi64(m, l);
+    __m256i hi = _mm256_unpackhi_epi64(m, l);
+    _mm256_storeu_si256((__m256i*)out,       _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+#else
+static void kc_hash_four(const uint8_t **keys, const uint32_t *lens, uint64_t *out) {
+    uint32_t steps = 0;
+    uint64_t msb[4], lsb[4], chunk[4];
+    for(int j = 0; j < 4; j++) {
+        msb[j]   = 0x6a09e667f3bcc908;
+        lsb[j]   = 0xbb67ae8584caa73b;
+        chunk[j] = 0;
+        if(lens[j] / 16 > steps) {
+            steps = lens[j] / 16;
+        }
+    }
+    for(uint32_t step = 0; step <= steps; step++) {
+        for(int j = 0; j < 4; j++) {
+            uint64_t words[2];
+            int block = kc_many_words(keys[j], lens[j], step, words);
+            msb[j] ^= words[0];
+            lsb[j] ^= words[1];
+            if(block) {
+                MIX(msb[j], lsb[j], chunk[j]);
+                chunk[j] = RL64(chunk[j], 3);
+                chunk[j]++;
+            }
+        }
+    }
+    for(int i = 0; i < 8; i++) {
+        for(int j = 0; j < 4; j++) {
+            MIX(msb[j], lsb[j], chunk[j]+i);
+        }
+    }
+    for(int j = 0; j < 4; j++) {
+        out[j * 2]     = msb[j];
+        out[j * 2 + 1] = lsb[j];
+    }
+}
+#endif
+
+void kc_hash_many(const void **keys, const uint32_t *lens, size_t n, uint64_t *out) {
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        kc_hash_four((const uint8_t**)(keys + i), lens + i, out + i * 2);
+    }
+    for(; i < n; i++) {
+        kc_hash(keys[i], lens[i], out + i * 2, out + i * 2 + 1);
+    }
+}
+
+void kc_hash_init(KcHashState *state) {
+    state->msb    = 0x6a09e667f3bcc908;
+    state->lsb    = 0xbb67ae8584caa73b;
+    state->chunk  = 0;
+    state->length = 0;
+    state->seeded = 0;
+    memset(state->tail, 0, sizeof(state->tail));
+}
+
+void kc_hash_init_seeded(KcHashState *state, const KcHashSeed *seed) {
+    kc_hash_init(state);
+    state->msb    = seed->msb;
+    state->lsb    = seed->lsb;
+    state->chunk  = seed->chunk;
+    state->seeded = 1;
+}
+
+// Same loop as kc_hash, but data may not be aligned.
+static void kc_hash_blocks(KcHashState *state, const uint8_t *data, size_t blocks) {
+    uint64_t msb    = state->msb;
+    uint64_t lsb    = state->lsb;
+    uint64_t chunk  = state->chunk;
+    int      seeded = state->seeded;
+    while(blocks--) {
+        uint64_t words[2];
+        memcpy(words, data, 16);
+        msb ^= words[0];
+        lsb ^= words[1];
+        KC_BLOCK(msb, lsb, chunk, seeded);
+        chunk = RL64(chunk, 3);
+        chunk++;
+        data += 16;
+    }
+    state->msb   = msb;
+    state->lsb   = lsb;
+    state->chunk = chunk;
+}
+
+void kc_hash_update(KcHashState *state, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    unsigned       used  = state->length % 16;
+    state->length += length;
+    // Top up a partial block from last time first.
+    if(used > 0) {
+        size_t take = 16 - used < length ? 16 - used : length;
+        memcpy(state->tail + used, bytes, take);
+        bytes  += take;
+        length -= take;
+        if(used + take < 16) {
+            return;
+        }
+        kc_hash_blocks(state, state->tail, 1);
+    }
+    kc_hash_blocks(state, bytes, length / 16);
+    memcpy(state->tail, bytes + (length & ~(size_t)15), length % 16);
+}
+
+void kc_hash_final(const KcHashState *state, uint64_t *upper, uint64_t *lower) {
+    uint64_t msb   = state->msb;
+    uint64_t lsb   = state->lsb;
+    uint64_t chunk = state->chunk;
+    uint64_t remnant[2] = {0, 0};
+    memcpy(remnant, state->tail, state->length % 16);
+    msb ^= remnant[0];
+    lsb ^= remnant[1];
+    if(state->seeded) {
+        KC_BLOCK(msb, lsb, chunk, 1);
+        msb ^= state->length;
+    }
+    for(int i = 0; i < 8; i++) {
+        MIX(msb, lsb, chunk+i);
+    }
+    *upper = msb;
+    *lower = lsb;
+}
+
+// Export layout, little endian:
+//   0  "kchs"
+//   4  version
+//   5  flags, bit 0 set for a seeded state
+//   6  msb, lsb, chunk, length, 8 bytes each
+//  38  the pending tail, length % 16 bytes
+#define KC_STATE_VERSION 1
+#define KC_STATE_HEADER  38
+
+static void put_u64(uint8_t *dest, uint64_t val) {
+    for(int i = 0; i < 8; i++) {
+        dest[i] = val >> (i * 8);
+    }
+}
+
+static uint64_t get_u64(const uint8_t *src) {
+    uint64_t val = 0;
+    for(int i = 0; i < 8; i++) {
+        val |= (uint64_t)src[i] << (i * 8);
+    }
+    return val;
+}
+
+size_t kc_hash_state_export(const KcHashState *state, uint8_t *out) {
+    size_t tail = state->length % 16;
+    memcpy(out, "kchs", 4);
+    out[4] = KC_STATE_VERSION;
+    out[5] = state->seeded ? 1 : 0;
+    put_u64(out + 6,  state->msb);
+    put_u64(out + 14, state->lsb);
+    put_u64(out + 22, state->chunk);
+    put_u64(out + 30, state->length);
+    memcpy(out + KC_STATE_HEADER, state->tail, tail);
+    return KC_STATE_HEADER + tail;
+}
+
+int kc_hash_state_import(KcHashState *state, const uint8_t *blob, size_t size) {
+    if(size < KC_STATE_HEADER || memcmp(blob, "kchs", 4) != 0) {
+        return -1;
+    }
+    if(blob[4] != KC_STATE_VERSION || (blob[5] & ~1) != 0) {
+        return -1;
+    }
+    uint64_t length = get_u64(blob + 30);
+    size_t   tail   = length % 16;
+    if(size != KC_STATE_HEADER + tail) {
+        return -1;
+    }
+    kc_hash_init(state);
+    state->seeded = blob[5] & 1;
+    state->msb    = get_u64(blob + 6);
+    state->lsb    = get_u64(blob + 14);
+    state->chunk  = get_u64(blob + 22);
+    state->length = length;
+    memcpy(state->tail, blob + KC_STATE_HEADER, tail);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef KC_HASH_H
+#define KC_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Running state for hashing data that shows up in pieces. The pending tail
+// is length % 16 bytes long.
+typedef struct KcHashState {
+    uint64_t msb;
+    uint64_t lsb;
+    uint64_t chunk;
+    uint64_t length;
+    uint8_t  tail[16];
+    int      seeded; // Follows kc_hash_seeded instead of kc_hash.
+} KcHashState;
+
+// Starting state for kc_hash_seeded, worked out once from a secret so the
+// hashes themselves cost the same as kc_hash.
+typedef struct KcHashSeed {
+    uint64_t msb;
+    uint64_t lsb;
+    uint64_t chunk;
+} KcHashSeed;
+
+void kc_hash(const void *data, size_t length, uint64_t *upper, uint64_t *lower);
+
+// For tables fed keys from outside, where someone who knows kc_hash could
+// otherwise pick keys that all land together. The secret should be 128
+// random bits picked once per process and never shown to anyone. Seeded
+// hashes take two rounds per block and mix in the length, so they differ
+// from kc_hash even with a NULL secret, which just starts from kc_hash's
+// own state.
+void kc_hash_seed_init(KcHashSeed *seed, const uint64_t secret[2]);
+void kc_hash_seeded   (const KcHashSeed *seed, const void *data, size_t length, uint64_t *upper, uint64_t *lower);
+
+// A different hash from kc_hash made for throughput on large inputs. Four
+// independent lanes each take 16 bytes of every 64 byte stripe and are folded
+// together at the end. Uses AVX2 when built for it, the output is the same
+// either way.
+void kc_hash_wide(const void *data, size_t length, uint64_t *upper, uint64_t *lower);
+
+// Same digests as calling kc_hash on each key, upper then lower going into
+// out[i * 2] and out[i * 2 + 1]. Keys are run four at a time through MIX so
+// short keys don't sit waiting on one dependency chain. Works best when keys
+// next to each other have similar lengths.
+void kc_hash_many(const void **keys, const uint32_t *lens, size_t n, uint64_t *out);
+
+// Tree mode for very large inputs, built from kc-hash-tree.c. The data is
+// cut into KC_TREE_LEAF sized leaves that are hashed with kc_hash across a
+// pool of threads, then the leaf digests in order and the total length are
+// hashed into the root. The digest differs from kc_hash but is the same for
+// any thread count. threads <= 0 uses every online CPU. The file version
+// maps the file and returns -1 with errno set if it can't.
+#define KC_TREE_LEAF (1 << 20)
+void kc_hash_tree     (const void *data, uint64_t length, int threads, uint64_t *upper, uint64_t *lower);
+int  kc_hash_tree_file(const char *path, int threads, uint64_t *upper, uint64_t *lower);
+
+// Hashing everything with updates gives the same result as one kc_hash call
+// no matter how the data is split up. Final leaves the state untouched so
+// more data can still be added after.
+void kc_hash_init  (KcHashState *state);
+void kc_hash_update(KcHashState *state, const void *data, size_t length);
+void kc_hash_final (const KcHashState *state, uint64_t *upper, uint64_t *lower);
+// Streams to the same result as kc_hash_seeded with this seed.
+void kc_hash_init_seeded(KcHashState *state, const KcHashSeed *seed);
+
+// Saves a state so another process can carry on hashing from where this
+// one stopped, like after appending to a log. The blob is versioned, little
+// endian and at most KC_HASH_STATE_MAX bytes, export returns its size. Import
+// returns -1 if the blob is not one it understands. A seeded state carries
+// everything needed to keep hashing with that seed, so keep it as private
+// as the secret.
+#define KC_HASH_STATE_MAX 53
+size_t kc_hash_state_export(const KcHashState *state, uint8_t *out);
+int    kc_hash_state_import(KcHashState *state, const uint8_t *blob, size_t size);
+
+#endif
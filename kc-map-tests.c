@@ -0,0 +1,261 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Randomized checks of KcMap against a plain array indexed by key number.
+// Keys come from a small set so the same ones keep getting inserted and
+// erased, and the live count swings up and down so the table grows, fills
+// with tombstones and has to reuse them. Exits non zero if the two ever
+// disagree.
+// make kc-map-tests && ./kc-map-tests [operations per run, 2000000]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kc-hash.h"
+#include "kc-map.h"
+
+// Number of distinct keys, the reference map is one slot per key.
+#define UNIVERSE 4096
+// Live entries a table of groups holds before insert doubles it.
+#define KC_MAP_GROUP_LOAD 7
+// Operations between every full comparison of the two maps.
+#define VERIFY_EVERY 4096
+
+static int failures = 0;
+
+static uint64_t rng_state = 0x2545f4914f6cdd1d;
+
+// splitmix64, only used to pick operations and values.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+typedef struct Reference {
+    uint8_t  present[UNIVERSE];
+    uint64_t value[UNIVERSE];
+    size_t   count;
+} Reference;
+
+typedef struct Config {
+    const char *name;
+    size_t      key_size;
+    size_t      value_size;
+    int         seeded;
+} Config;
+
+// Key number n spread over key_size bytes, the number itself is in the
+// first bytes so every key is distinct whatever the size.
+static void make_key(uint8_t *key, size_t key_size, uint32_t n) {
+    uint64_t x = n * 0x9e3779b97f4a7c15 + 1;
+    for(size_t i = 0; i < key_size; i++) {
+        x ^= x >> 29;
+        x *= 0xbf58476d1ce4e5b9;
+        key[i] = x >> 56;
+    }
+    memcpy(key, &n, key_size < 4 ? key_size : 4);
+}
+
+static uint64_t read_value(const void *value, size_t value_size) {
+    uint64_t x = 0;
+    memcpy(&x, value, value_size);
+    return x;
+}
+
+static int fail(const char *name, size_t op, const char *what, uint32_t n) {
+    printf("  %-12s FAIL at operation %zu: %s (key %u)\n", name, op, what, n);
+    failures++;
+    return 0;
+}
+
+// Everything in the map matches the reference and its counters match what
+// the control bytes say.
+static int verify(const KcMap *map, const Reference *ref, const Config *cfg, size_t op) {
+    uint8_t  seen[UNIVERSE];
+    size_t   full       = 0;
+    size_t   tombstones = 0;
+    memset(seen, 0, sizeof(seen));
+    for(size_t i = 0; i < map->groups * KC_MAP_GROUP; i++) {
+        full       += (map->ctrl[i] & 0x80) == 0;
+        tombstones += map->ctrl[i] != 0x80 && (map->ctrl[i] & 0x80);
+    }
+    if(map->count != ref->count || full != ref->count) {
+        return fail(cfg->name, op, "entry count is off", 0);
+    }
+    if(map->tombstones != tombstones) {
+        return fail(cfg->name, op, "tombstone count is off", 0);
+    }
+    if(map->count + map->tombstones > map->groups * (KC_MAP_GROUP - 2)) {
+        return fail(cfg->name, op, "table is over its load limit", 0);
+    }
+    KcMapIter   it;
+    const void *key;
+    void       *value;
+    kc_map_iter_init(&it, map);
+    while(kc_map_iter_next(&it, &key, &value)) {
+        uint32_t n = 0;
+        memcpy(&n, key, cfg->key_size < 4 ? cfg->key_size : 4);
+        if(n >= UNIVERSE || !ref->present[n] || seen[n]) {
+            return fail(cfg->name, op, "iteration gave a key that should not be there", n);
+        }
+        seen[n] = 1;
+        if(read_value(value, cfg->value_size) != ref->value[n]) {
+            return fail(cfg->name, op, "iteration gave the wrong value", n);
+        }
+    }
+    uint8_t keybuf[64];
+    for(uint32_t n = 0; n < UNIVERSE; n++) {
+        make_key(keybuf, cfg->key_size, n);
+        void *found = kc_map_find(map, keybuf);
+        if((found != NULL) != ref->present[n]) {
+            return fail(cfg->name, op, found ? "found an erased key" : "lost a key", n);
+        }
+        if(found != NULL && read_value(found, cfg->value_size) != ref->value[n]) {
+            return fail(cfg->name, op, "found the wrong value", n);
+        }
+    }
+    return 1;
+}
+
+static void run(const Config *cfg, size_t ops) {
+    static const uint64_t secret[2] = { 0x452821e638d01377, 0xbe5466cf34e90c6c };
+    Reference  *ref = calloc(1, sizeof(Reference));
+    KcMap       map;
+    KcHashSeed  seed;
+    uint8_t     key[64];
+    int         ok = 1;
+    kc_hash_seed_init(&seed, secret);
+    if(ref == NULL || (cfg->seeded ? kc_map_init_seeded(&map, cfg->key_size, cfg->value_size, 0, &seed)
+                                   : kc_map_init(&map, cfg->key_size, cfg->value_size, 0)) < 0) {
+        fprintf(stderr, "kc-map-tests: failed to allocate map\n");
+        exit(1);
+    }
+    uint64_t value_mask = cfg->value_size < 8 ? ((uint64_t)1 << (cfg->value_size * 8)) - 1 : ~(uint64_t)0;
+    size_t   max_live   = 0;
+    size_t   reused     = 0;
+    size_t   grows      = 0;
+    size_t   rehashes   = 0;
+    size_t   peak_tombs = 0;
+    for(size_t op = 0; op < ops && ok; op++) {
+        // The live count is steered toward a target that swings between
+        // just under where a 256 group table grows and nearly empty, most
+        // of the time is spent churning near the target which is what
+        // piles up tombstones.
+        uint64_t r      = rng_next();
+        size_t   target = (op / (UNIVERSE * 64)) % 2 ? 128 : 256 * KC_MAP_GROUP_LOAD - 16;
+        int      insert = (r & 1023) < (ref->count < target ? 716u : 308u);
+        uint32_t n      = (r >> 16) % UNIVERSE;
+        make_key(key, cfg->key_size, n);
+        if(insert) {
+            int      inserted   = -1;
+            size_t   tombstones = map.tombstones;
+            size_t   groups     = map.groups;
+            uint8_t *ctrl       = map.ctrl;
+            void    *value      = kc_map_insert(&map, key, &inserted);
+            if(value == NULL) {
+                fprintf(stderr, "kc-map-tests: failed to grow map\n");
+                exit(1);
+            }
+            if(inserted != !ref->present[n]) {
+                ok = fail(cfg->name, op, "insert got the inserted flag wrong", n);
+                break;
+            }
+            if(inserted && read_value(value, cfg->value_size) != 0) {
+                ok = fail(cfg->name, op, "a new value was not zeroed", n);
+                break;
+            }
+            if(!inserted && read_value(value, cfg->value_size) != ref->value[n]) {
+                ok = fail(cfg->name, op, "insert returned the wrong value", n);
+                break;
+            }
+            grows    += map.groups != groups;
+            rehashes += map.groups == groups && map.ctrl != ctrl;
+            reused   += inserted && map.ctrl == ctrl && map.tombstones + 1 == tombstones;
+            uint64_t v = (rng_next() & value_mask) | 1;
+            memcpy(value, &v, cfg->value_size);
+            ref->present[n] = 1;
+            ref->value[n]   = v;
+            ref->count     += inserted;
+        } else {
+            int erased = kc_map_erase(&map, key);
+            if(erased != ref->present[n]) {
+                ok = fail(cfg->name, op, erased ? "erased a key that was not there" : "erase missed a key", n);
+                break;
+            }
+            ref->present[n] = 0;
+            ref->count     -= erased;
+        }
+        if(ref->count > max_live) {
+            max_live = ref->count;
+        }
+        if(map.tombstones > peak_tombs) {
+            peak_tombs = map.tombstones;
+        }
+        // Only ever grows for live entries, never because of tombstones.
+        if(map.groups > 1 && map.groups * KC_MAP_GROUP_LOAD >= 2 * (max_live + 1)) {
+            ok = fail(cfg->name, op, "table grew past what the live entries need", n);
+            break;
+        }
+        if(op % VERIFY_EVERY == VERIFY_EVERY - 1) {
+            ok = verify(&map, ref, cfg, op);
+        }
+    }
+    if(ok) {
+        ok = verify(&map, ref, cfg, ops);
+    }
+    // Without these the run did not get to the parts it is meant to test.
+    if(ok && reused == 0) {
+        ok = fail(cfg->name, ops, "never reused a tombstone", 0);
+    }
+    if(ok) {
+        printf("  %-12s %9zu %9zu %9zu %9zu %9zu %9zu  ok\n", cfg->name, max_live, map.groups, grows, peak_tombs, reused, rehashes);
+    }
+    kc_map_free(&map);
+    free(ref);
+}
+
+int main(int argc, char **argv) {
+    static const Config configs[] = {
+        { "u64 -> u64",  8,  8, 0 },
+        { "3 -> u16",    3,  2, 0 },
+        { "20 -> u32",  20,  4, 1 },
+        { "48 -> u64",  48,  8, 1 },
+    };
+    size_t ops = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+    printf("KcMap against a reference, %zu operations over %d keys\n", ops, UNIVERSE);
+    printf("  %-12s %9s %9s %9s %9s %9s %9s\n", "key -> value", "max live", "groups", "grows", "max tombs", "reused", "rehashes");
+    for(size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        run(&configs[c], ops);
+    }
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kc-hash.h"
+#include "kc-map.h"
+
+// Control bytes. A full slot holds its 7 bit tag so the top bit tells full
+// slots apart from the other two states.
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xFE
+
+// Groups are filled to at most 14 of 16 slots, counting tombstones.
+#define GROUP_LIMIT  14
+
+typedef struct Probe {
+    size_t  group;
+    size_t  step;
+    uint8_t tag;
+} Probe;
+
+#ifdef __SSE2__
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+}
+
+// Empty and deleted both have the top bit set, full slots don't.
+static inline uint32_t group_free(const uint8_t *ctrl) {
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(group);
+}
+#else
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+    uint32_t mask = 0;
+    for(int i = 0; i < KC_MAP_GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] == tag) << i;
+    }
+    return mask;
+}
+
+static inline uint32_t group_free(const uint8_t *ctrl) {
+    uint32_t mask = 0;
+    for(int i = 0; i < KC_MAP_GROUP; i++) {
+        mask |= (uint32_t)(ctrl[i] >> 7) << i;
+    }
+    return mask;
+}
+#endif
+
+static inline uint8_t* slot_key(const KcMap *map, size_t slot) {
+    return map->slots + slot * map->slot_size;
+}
+
+static inline Probe probe_start(const KcMap *map, const void *key) {
+    uint64_t upper;
+    uint64_t lower;
+    Probe    probe;
+    if(map->seeded) {
+        kc_hash_seeded(&map->seed, key, map->key_size, &upper, &lower);
+    } else {
+        kc_hash(key, map->key_size, &upper, &lower);
+    }
+    probe.group = map->shift < 64 ? upper >> map->shift : 0;
+    probe.step  = 0;
+    probe.tag   = lower & 0x7F;
+    return probe;
+}
+
+// Triangular steps, with a power of two group count this visits every group.
+static inline void probe_next(const KcMap *map, Probe *probe) {
+    probe->step++;
+    probe->group = (probe->group + probe->step) & (map->groups - 1);
+}
+
+// First free slot along a probe sequence, the key must not be in the map.
+static size_t find_free(const KcMap *map, Probe probe) {
+    for(;;) {
+        uint32_t mask = group_free(map->ctrl + probe.group * KC_MAP_GROUP);
+        if(mask) {
+            return probe.group * KC_MAP_GROUP + __builtin_ctz(mask);
+        }
+        probe_next(map, &probe);
+    }
+}
+
+static void* find_key(const KcMap *map, const void *key, Probe probe) {
+    for(;;) {
+        const uint8_t *ctrl = map->ctrl + probe.group * KC_MAP_GROUP;
+        uint32_t       mask = group_match(ctrl, probe.tag);
+        while(mask) {
+            size_t   slot = probe.group * KC_MAP_GROUP + __builtin_ctz(mask);
+            uint8_t *item = slot_key(map, slot);
+            if(memcmp(item, key, map->key_size) == 0) {
+                return item + map->value_off;
+            }
+            mask &= mask - 1;
+        }
+        // A group with an empty slot was never full, so the key can't have
+        // been pushed past it.
+        if(group_match(ctrl, CTRL_EMPTY)) {
+            return NULL;
+        }
+        probe_next(map, &probe);
+    }
+}
+
+static int map_alloc(KcMap *map, size_t groups) {
+    size_t   slots = groups * KC_MAP_GROUP;
+    uint8_t *ctrl  = malloc(slots + slots * map->slot_size);
+    if(ctrl == NULL) {
+        return -1;
+    }
+    memset(ctrl, CTRL_EMPTY, slots);
+    map->ctrl       = ctrl;
+    map->slots      = ctrl + slots;
+    map->groups     = groups;
+    map->count      = 0;
+    map->tombstones = 0;
+    map->shift      = 64;
+    while(groups > 1) {
+        groups >>= 1;
+        map->shift--;
+    }
+    return 0;
+}
+
+static size_t groups_for(size_t count) {
+    size_t groups = 1;
+    while(groups * GROUP_LIMIT < count) {
+        groups <<= 1;
+    }
+    return groups;
+}
+
+static int map_rehash(KcMap *map, size_t groups) {
+    KcMap old = *map;
+    if(map_alloc(map, groups) < 0) {
+        *map = old;
+        return -1;
+    }
+    for(size_t i = 0; i < old.groups * KC_MAP_GROUP; i++) {
+        if(old.ctrl[i] & 0x80) {
+            continue;
+        }
+        Probe  probe = probe_start(map, slot_key(&old, i));
+        size_t slot  = find_free(map, probe);
+        map->ctrl[slot] = probe.tag;
+        memcpy(slot_key(map, slot), slot_key(&old, i), map->slot_size);
+    }
+    map->count = old.count;
+    free(old.ctrl);
+    return 0;
+}
+
+int kc_map_init(KcMap *map, size_t key_size, size_t value_size, size_t capacity) {
+    map->seeded     = 0;
+    map->key_size   = key_size;
+    map->value_size = value_size;
+    map->value_off  = (key_size + 7) & ~(size_t)7;
+    map->slot_size  = (map->value_off + value_size + 7) & ~(size_t)7;
+    return map_alloc(map, groups_for(capacity));
+}
+
+int kc_map_init_seeded(KcMap *map, size_t key_size, size_t value_size, size_t capacity, const KcHashSeed *seed) {
+    if(kc_map_init(map, key_size, value_size, capacity) < 0) {
+        return -1;
+    }
+    map->seed   = *seed;
+    map->seeded = 1;
+    return 0;
+}
+
+void kc_map_free(KcMap *map) {
+    free(map->ctrl);
+    map->ctrl  = NULL;
+    map->slots = NULL;
+    map->count = 0;
+}
+
+int kc_map_reserve(KcMap *map, size_t count) {
+    size_t groups = groups_for(count);
+    if(groups <= map->groups) {
+        return 0;
+    }
+    return map_rehash(map, groups);
+}
+
+void* kc_map_find(const KcMap *map, const void *key) {
+    return find_key(map, key, probe_start(map, key));
+}
+
+void* kc_map_insert(KcMap *map, const void *key, int *inserted) {
+    Probe probe = probe_start(map, key);
+    void *value = find_key(map, key, probe);
+    if(inserted != NULL) {
+        *inserted = value == NULL;
+    }
+    if(value != NULL) {
+        return value;
+    }
+    if(map->count + map->tombstones + 1 > map->groups * GROUP_LIMIT) {
+        // Only grow when live entries fill over half the table, otherwise
+        // rehashing at the same size to clear tombstones is enough.
+        size_t groups = map->groups;
+        if(map->count + 1 > groups * GROUP_LIMIT / 2) {
+            groups <<= 1;
+        }
+        if(map_rehash(map, groups) < 0) {
+            return NULL;
+        }
+        probe = probe_start(map, key);
+    }
+    size_t slot = find_free(map, probe);
+    if(map->ctrl[slot] == CTRL_DELETED) {
+        map->tombstones--;
+    }
+    map->ctrl[slot] = probe.tag;
+    map->count++;
+    uint8_t *item = slot_key(map, slot);
+    memcpy(item, key, map->key_size);
+    memset(item + map->value_off, 0, map->value_size);
+    return item + map->value_off;
+}
+
+int kc_map_erase(KcMap *map, const void *key) {
+    uint8_t *value = kc_map_find(map, key);
+    if(value == NULL) {
+        return 0;
+    }
+    size_t   slot  = (value - map->value_off - map->slots) / map->slot_size;
+    uint8_t *group = map->ctrl + slot / KC_MAP_GROUP * KC_MAP_GROUP;
+    // If the group still has an empty slot no probe ever went past it, so
+    // this slot can go straight back to empty.
+    if(group_match(group, CTRL_EMPTY)) {
+        map->ctrl[slot] = CTRL_EMPTY;
+    } else {
+        map->ctrl[slot] = CTRL_DELETED;
+        map->tombstones++;
+    }
+    map->count--;
+    return 1;
+}
+
+void kc_map_iter_init(KcMapIter *it, const KcMap *map) {
+    it->map = map;
+    it->pos = 0;
+}
+
+int kc_map_iter_next(KcMapIter *it, const void **key, void **value) {
+    const KcMap *map   = it->map;
+    size_t       slots = map->groups * KC_MAP_GROUP;
+    while(it->pos < slots) {
+        size_t slot = it->pos++;
+        if(map->ctrl[slot] & 0x80) {
+            continue;
+        }
+        uint8_t *item = slot_key(map, slot);
+        if(key != NULL) {
+            *key = item;
+        }
+        if(value != NULL) {
+            *value = item + map->value_off;
+        }
+        return 1;
+    }
+    return 0;
+}
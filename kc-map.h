@@ -0,0 +1,84 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef KC_MAP_H
+#define KC_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kc-hash.h"
+
+// Slots are kept in groups of this many, each with a control byte. A lookup
+// checks a whole group of control bytes at once.
+#define KC_MAP_GROUP 16
+
+// Open addressing map from fixed size keys to fixed size values, compared
+// with memcmp. The top bits of kc_hash's upper word pick where probing
+// starts and the low 7 bits of the lower word are kept as a tag in the
+// control byte, so most slots are ruled out without touching the key.
+typedef struct KcMap {
+    uint8_t   *ctrl;       // One byte per slot, groups * KC_MAP_GROUP of them.
+    uint8_t   *slots;      // Key then value for each slot.
+    size_t     key_size;
+    size_t     value_size;
+    size_t     value_off;  // Where the value starts in a slot.
+    size_t     slot_size;
+    size_t     groups;     // Always a power of two.
+    int        shift;      // 64 - log2(groups).
+    size_t     count;
+    size_t     tombstones; // Erased slots still holding up probes.
+    KcHashSeed seed;
+    int        seeded;
+} KcMap;
+
+typedef struct KcMapIter {
+    const KcMap *map;
+    size_t       pos;
+} KcMapIter;
+
+// Anything returning an int gives 0 on success and -1 when out of memory.
+// Keys and values are 8 byte aligned in the map. Value pointers stay good
+// until the next insert or reserve.
+int   kc_map_init   (KcMap *map, size_t key_size, size_t value_size, size_t capacity);
+// Use this one when keys come from outside, see kc_hash_seed_init.
+int   kc_map_init_seeded(KcMap *map, size_t key_size, size_t value_size, size_t capacity, const KcHashSeed *seed);
+void  kc_map_free   (KcMap *map);
+// Makes room for count entries so inserting up to that many won't rehash.
+int   kc_map_reserve(KcMap *map, size_t count);
+// Returns the value for key or NULL when it is not in the map.
+void* kc_map_find   (const KcMap *map, const void *key);
+// Returns the value for key, adding the key first if it is new. A new value
+// is zeroed and *inserted set to 1. Returns NULL if the map had to grow and
+// couldn't.
+void* kc_map_insert (KcMap *map, const void *key, int *inserted);
+// Returns 1 when key was removed, 0 if it was not there.
+int   kc_map_erase  (KcMap *map, const void *key);
+
+// Visits every entry in no particular order. Erasing the current entry while
+// iterating is fine, inserting is not.
+void  kc_map_iter_init(KcMapIter *it, const KcMap *map);
+int   kc_map_iter_next(KcMapIter *it, const void **key, void **value);
+
+#endif // KC_MAP_H
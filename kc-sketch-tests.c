@@ -0,0 +1,265 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks the sketches keep their promises. Bloom filters never miss a key
+// that was added and stay under the false positive rate they were made
+// for, count-min never comes in under the true count and is within epsilon
+// of the total as often as delta says, and HyperLogLog stays within a few
+// of its standard errors. Merging halves has to give exactly the sketch of
+// the whole, and sketches that don't match have to refuse to merge.
+// make kc-sketch-tests && ./kc-sketch-tests
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kc-hash.h"
+#include "kc-sketch.h"
+
+static int failures = 0;
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+static void make_seed(KcHashSeed *seed, uint64_t n) {
+    uint64_t secret[2] = { 0x243f6a8885a308d3 + n, 0x13198a2e03707344 };
+    kc_hash_seed_init(seed, secret);
+}
+
+static void out_of_memory(void) {
+    fprintf(stderr, "kc-sketch-tests: failed to allocate sketches\n");
+    exit(1);
+}
+
+#define BLOOM_KEYS  200000
+#define BLOOM_TESTS 2000000
+
+static void test_bloom(void) {
+    static const double rates[] = { 0.1, 0.01, 0.001 };
+    KcHashSeed seed;
+    make_seed(&seed, 0);
+    printf("Bloom, %d keys, %d never added\n", BLOOM_KEYS, BLOOM_TESTS);
+    printf("  %8s  %10s  %8s\n", "rate", "measured", "missing");
+    for(size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        KcBloom whole, half[2];
+        if(kc_bloom_init(&whole, BLOOM_KEYS, rates[r], &seed) < 0 ||
+           kc_bloom_init(&half[0], BLOOM_KEYS, rates[r], &seed) < 0 ||
+           kc_bloom_init(&half[1], BLOOM_KEYS, rates[r], &seed) < 0) {
+            out_of_memory();
+        }
+        for(uint64_t i = 0; i < BLOOM_KEYS; i++) {
+            kc_bloom_add(&whole, &i, sizeof(i));
+            kc_bloom_add(&half[i & 1], &i, sizeof(i));
+        }
+        size_t missing = 0;
+        for(uint64_t i = 0; i < BLOOM_KEYS; i++) {
+            missing += !kc_bloom_test(&whole, &i, sizeof(i));
+        }
+        size_t false_pos = 0;
+        for(uint64_t i = BLOOM_KEYS; i < BLOOM_KEYS + BLOOM_TESTS; i++) {
+            false_pos += kc_bloom_test(&whole, &i, sizeof(i));
+        }
+        // Allow four sigma of sampling noise over the configured rate.
+        double measured = (double)false_pos / BLOOM_TESTS;
+        double limit    = rates[r] + 4 * sqrt(rates[r] * (1 - rates[r]) / BLOOM_TESTS);
+        printf("  %8g  %10.5f  %8zu  %s\n", rates[r], measured, missing, verdict(missing == 0 && measured <= limit));
+        int merged = kc_bloom_merge(&half[0], &half[1]) == 0 &&
+                     memcmp(half[0].bits, whole.bits, whole.blocks * 64) == 0;
+        printf("  %8s  %-20s  %s\n", "", "halves merge", verdict(merged));
+        kc_bloom_free(&whole);
+        kc_bloom_free(&half[0]);
+        kc_bloom_free(&half[1]);
+    }
+}
+
+#define CM_KEYS 100000
+
+// Key i is added 1 + 1000 / (i + 1) times, a few heavy keys and a long tail.
+static uint32_t cm_count(uint64_t i) {
+    return 1 + 1000 / (i + 1);
+}
+
+static void test_count_min(void) {
+    static const struct {
+        double epsilon;
+        double delta;
+    } shapes[] = { { 0.001, 0.01 }, { 0.0001, 0.05 } };
+    KcHashSeed seed;
+    make_seed(&seed, 1);
+    printf("Count-min, %d keys\n", CM_KEYS);
+    printf("  %8s  %6s  %8s  %12s\n", "epsilon", "delta", "under", "over bound");
+    for(size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        KcCountMin whole, half[2];
+        if(kc_cm_init(&whole, shapes[s].epsilon, shapes[s].delta, &seed) < 0 ||
+           kc_cm_init(&half[0], shapes[s].epsilon, shapes[s].delta, &seed) < 0 ||
+           kc_cm_init(&half[1], shapes[s].epsilon, shapes[s].delta, &seed) < 0) {
+            out_of_memory();
+        }
+        uint64_t total = 0;
+        for(uint64_t i = 0; i < CM_KEYS; i++) {
+            // Split a key's count over both halves so merging has to add.
+            kc_cm_add(&whole, &i, sizeof(i), cm_count(i));
+            kc_cm_add(&half[0], &i, sizeof(i), cm_count(i) / 2);
+            kc_cm_add(&half[1], &i, sizeof(i), cm_count(i) - cm_count(i) / 2);
+            total += cm_count(i);
+        }
+        size_t under = 0;
+        size_t over  = 0;
+        for(uint64_t i = 0; i < CM_KEYS; i++) {
+            uint32_t estimate = kc_cm_estimate(&whole, &i, sizeof(i));
+            under += estimate < cm_count(i);
+            over  += estimate - cm_count(i) > shapes[s].epsilon * total;
+        }
+        // Misses past epsilon should be rarer than delta, with room for noise.
+        double limit = shapes[s].delta * CM_KEYS + 4 * sqrt(shapes[s].delta * CM_KEYS);
+        printf("  %8g  %6g  %8zu  %12zu  %s\n", shapes[s].epsilon, shapes[s].delta, under, over,
+               verdict(under == 0 && over <= limit));
+        int merged = kc_cm_merge(&half[0], &half[1]) == 0 &&
+                     memcmp(half[0].counts, whole.counts, whole.width * whole.depth * sizeof(uint32_t)) == 0;
+        printf("  %8s  %-22s  %s\n", "", "halves merge", verdict(merged));
+        kc_cm_free(&whole);
+        kc_cm_free(&half[0]);
+        kc_cm_free(&half[1]);
+    }
+    // Counters stop at the top, both adding and merging.
+    KcCountMin a, b;
+    uint64_t   key = 7;
+    if(kc_cm_init(&a, 0.01, 0.01, &seed) < 0 || kc_cm_init(&b, 0.01, 0.01, &seed) < 0) {
+        out_of_memory();
+    }
+    kc_cm_add(&a, &key, sizeof(key), UINT32_MAX - 1);
+    kc_cm_add(&a, &key, sizeof(key), 5);
+    int saturates = kc_cm_estimate(&a, &key, sizeof(key)) == UINT32_MAX;
+    kc_cm_add(&b, &key, sizeof(key), UINT32_MAX - 1);
+    kc_cm_merge(&a, &b);
+    saturates &= kc_cm_estimate(&a, &key, sizeof(key)) == UINT32_MAX;
+    printf("  %8s  %-22s  %s\n", "", "counters saturate", verdict(saturates));
+    kc_cm_free(&a);
+    kc_cm_free(&b);
+}
+
+// Each count is tried under a few seeds, so a bound that only just holds
+// once can't hide. Counts start at 1000, below that a single pair of keys
+// sharing a register is already past the bound for the big sketches.
+#define HLL_SEEDS 8
+
+static void test_hll(void) {
+    static const int      precisions[] = { 6, 10, 14 };
+    static const uint64_t counts[]     = { 1000, 100000, 1000000 };
+    printf("HyperLogLog, worst error over %d seeds\n", HLL_SEEDS);
+    printf("  %9s  %8s  %9s  %9s\n", "precision", "count", "worst", "limit");
+    for(size_t p = 0; p < sizeof(precisions) / sizeof(precisions[0]); p++) {
+        // Four standard errors.
+        double limit  = 4 * 1.04 / sqrt((double)(1 << precisions[p]));
+        int    merged = 1;
+        for(size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+            double worst = 0;
+            for(int s = 0; s < HLL_SEEDS; s++) {
+                KcHashSeed seed;
+                KcHll      whole, half[2];
+                make_seed(&seed, 100 + s);
+                if(kc_hll_init(&whole, precisions[p], &seed) < 0 || kc_hll_init(&half[0], precisions[p], &seed) < 0 ||
+                   kc_hll_init(&half[1], precisions[p], &seed) < 0) {
+                    out_of_memory();
+                }
+                for(uint64_t i = 0; i < counts[c]; i++) {
+                    kc_hll_add(&whole, &i, sizeof(i));
+                    kc_hll_add(&half[i & 1], &i, sizeof(i));
+                }
+                double error = fabs(kc_hll_count(&whole) - counts[c]) / counts[c];
+                worst  = error > worst ? error : worst;
+                merged &= kc_hll_merge(&half[0], &half[1]) == 0 &&
+                          memcmp(half[0].regs, whole.regs, (size_t)1 << precisions[p]) == 0;
+                kc_hll_free(&whole);
+                kc_hll_free(&half[0]);
+                kc_hll_free(&half[1]);
+            }
+            printf("  %9d  %8llu  %9.5f  %9.5f  %s\n", precisions[p], (unsigned long long)counts[c],
+                   worst, limit, verdict(worst <= limit));
+        }
+        printf("  %9d  %-19s  %s\n", precisions[p], "halves merge", verdict(merged));
+    }
+}
+
+// Sketches of another shape or seed have to refuse to merge, and bad
+// parameters have to be turned away.
+static void test_mismatch(void) {
+    KcHashSeed seed, other;
+    KcBloom    bloom[3];
+    KcCountMin cm[4];
+    KcHll      hll[3];
+    make_seed(&seed, 2);
+    make_seed(&other, 3);
+    if(kc_bloom_init(&bloom[0], 1000, 0.01, &seed) < 0 || kc_bloom_init(&bloom[1], 100000, 0.01, &seed) < 0 ||
+       kc_bloom_init(&bloom[2], 1000, 0.01, &other) < 0 ||
+       kc_cm_init(&cm[0], 0.01, 0.01, &seed) < 0 || kc_cm_init(&cm[1], 0.001, 0.01, &seed) < 0 ||
+       kc_cm_init(&cm[2], 0.01, 0.0001, &seed) < 0 || kc_cm_init(&cm[3], 0.01, 0.01, &other) < 0 ||
+       kc_hll_init(&hll[0], 10, &seed) < 0 || kc_hll_init(&hll[1], 12, &seed) < 0 ||
+       kc_hll_init(&hll[2], 10, &other) < 0) {
+        out_of_memory();
+    }
+    printf("Mismatched sketches\n");
+    int bloom_ok = kc_bloom_merge(&bloom[0], &bloom[1]) < 0 && kc_bloom_merge(&bloom[1], &bloom[0]) < 0 &&
+                   kc_bloom_merge(&bloom[0], &bloom[2]) < 0;
+    int cm_ok    = kc_cm_merge(&cm[0], &cm[1]) < 0 && kc_cm_merge(&cm[0], &cm[2]) < 0 &&
+                   kc_cm_merge(&cm[0], &cm[3]) < 0;
+    int hll_ok   = kc_hll_merge(&hll[0], &hll[1]) < 0 && kc_hll_merge(&hll[0], &hll[2]) < 0;
+    printf("  %-26s %s\n", "bloom refuses to merge", verdict(bloom_ok));
+    printf("  %-26s %s\n", "count-min refuses to merge", verdict(cm_ok));
+    printf("  %-26s %s\n", "hll refuses to merge", verdict(hll_ok));
+    for(int i = 0; i < 3; i++) {
+        kc_bloom_free(&bloom[i]);
+        kc_hll_free(&hll[i]);
+    }
+    for(int i = 0; i < 4; i++) {
+        kc_cm_free(&cm[i]);
+    }
+    KcBloom    b;
+    KcCountMin c;
+    KcHll      h;
+    int params_ok = kc_bloom_init(&b, 0, 0.01, &seed) < 0 && kc_bloom_init(&b, 10, 0, &seed) < 0 &&
+                    kc_bloom_init(&b, 10, 1, &seed) < 0 && kc_cm_init(&c, 0, 0.01, &seed) < 0 &&
+                    kc_cm_init(&c, 0.01, 1, &seed) < 0 && kc_hll_init(&h, 3, &seed) < 0 &&
+                    kc_hll_init(&h, 19, &seed) < 0;
+    printf("  %-26s %s\n", "bad parameters refused", verdict(params_ok));
+}
+
+int main(void) {
+    test_bloom();
+    test_count_min();
+    test_hll();
+    test_mismatch();
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,266 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "kc-hash.h"
+#include "kc-sketch.h"
+
+#define BLOOM_BLOCK_BITS 512
+#define BLOOM_MAX_K      16
+
+// Splits the lower word into the two hashes for double hashing. The second
+// is odd so with power of two sizes it steps through every position.
+#define H1(lower) ((uint32_t)(lower))
+#define H2(lower) ((uint32_t)((lower) >> 32) | 1)
+
+static int same_seed(const KcHashSeed *a, const KcHashSeed *b) {
+    return a->msb == b->msb && a->lsb == b->lsb && a->chunk == b->chunk;
+}
+
+// Next bit in a Bloom block, the top 9 bits of an LCG started from the lower
+// word. Stepping by a fixed stride instead leaves keys with the same stride
+// sharing bits, which was worth a tenth more false positives. The increment
+// comes from the half of upper the block index doesn't use.
+static inline uint32_t bloom_bit(uint64_t *x, uint64_t inc) {
+    uint32_t bit = *x >> 55;
+    *x = *x * 0x5851f42d4c957f2d + inc;
+    return bit;
+}
+
+// Maps a 32 bit hash onto [0, n) without a divide.
+static inline size_t reduce32(uint32_t hash, size_t n) {
+    return ((uint64_t)hash * n) >> 32;
+}
+
+// False positive rate of a blocked filter with load keys per block on
+// average. Blocks get a Poisson number of keys and the busy ones go over,
+// so this comes out above the plain filter's rate for the same bits.
+static double bloom_fp_rate(double load, int k) {
+    double spread = 10 * sqrt(load) + 10;
+    double fp     = 0;
+    for(double i = load > spread ? floor(load - spread) : 0; i < load + spread; i++) {
+        double keys = exp(i * log(load) - load - lgamma(i + 1));
+        fp += keys * pow(1 - pow(1 - 1.0 / BLOOM_BLOCK_BITS, k * i), k);
+    }
+    return fp;
+}
+
+int kc_bloom_init(KcBloom *bloom, size_t expected, double fp_rate, const KcHashSeed *seed) {
+    if(expected == 0 || fp_rate <= 0 || fp_rate >= 1) {
+        return -1;
+    }
+    double ln2  = log(2.0);
+    double bits = -(double)expected * log(fp_rate) / (ln2 * ln2);
+    int    k    = (int)(bits / expected * ln2 + 0.5);
+    bloom->k      = k < 1 ? 1 : k > BLOOM_MAX_K ? BLOOM_MAX_K : k;
+    // Grow it until the blocks make up for the uneven load.
+    while(bloom_fp_rate(expected * BLOOM_BLOCK_BITS / bits, bloom->k) > fp_rate) {
+        bits *= 1.02;
+    }
+    bloom->blocks = (size_t)ceil(bits / BLOOM_BLOCK_BITS);
+    // The block index only uses 32 bits of the hash.
+    if(bloom->blocks > UINT32_MAX) {
+        return -1;
+    }
+    size_t size = bloom->blocks * (BLOOM_BLOCK_BITS / 8);
+    bloom->raw  = calloc(size + 64, 1);
+    if(bloom->raw == NULL) {
+        return -1;
+    }
+    bloom->bits = (uint64_t*)(((uintptr_t)bloom->raw + 63) & ~(uintptr_t)63);
+    bloom->seed = *seed;
+    return 0;
+}
+
+void kc_bloom_free(KcBloom *bloom) {
+    free(bloom->raw);
+    bloom->raw  = NULL;
+    bloom->bits = NULL;
+}
+
+void kc_bloom_add(KcBloom *bloom, const void *key, size_t len) {
+    uint64_t upper;
+    uint64_t lower;
+    kc_hash_seeded(&bloom->seed, key, len, &upper, &lower);
+    uint64_t *block = bloom->bits + reduce32(upper >> 32, bloom->blocks) * (BLOOM_BLOCK_BITS / 64);
+    uint64_t  x     = lower;
+    uint64_t  inc   = upper << 32 | 1;
+    for(int i = 0; i < bloom->k; i++) {
+        uint32_t bit = bloom_bit(&x, inc);
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+int kc_bloom_test(const KcBloom *bloom, const void *key, size_t len) {
+    uint64_t upper;
+    uint64_t lower;
+    kc_hash_seeded(&bloom->seed, key, len, &upper, &lower);
+    const uint64_t *block = bloom->bits + reduce32(upper >> 32, bloom->blocks) * (BLOOM_BLOCK_BITS / 64);
+    uint64_t        x     = lower;
+    uint64_t        inc   = upper << 32 | 1;
+    for(int i = 0; i < bloom->k; i++) {
+        uint32_t bit = bloom_bit(&x, inc);
+        if(!(block[bit / 64] & ((uint64_t)1 << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int kc_bloom_merge(KcBloom *dest, const KcBloom *src) {
+    if(dest->blocks != src->blocks || dest->k != src->k || !same_seed(&dest->seed, &src->seed)) {
+        return -1;
+    }
+    size_t words = dest->blocks * (BLOOM_BLOCK_BITS / 64);
+    for(size_t i = 0; i < words; i++) {
+        dest->bits[i] |= src->bits[i];
+    }
+    return 0;
+}
+
+int kc_cm_init(KcCountMin *cm, double epsilon, double delta, const KcHashSeed *seed) {
+    if(epsilon <= 0 || epsilon >= 1 || delta <= 0 || delta >= 1) {
+        return -1;
+    }
+    double width = exp(1.0) / epsilon;
+    cm->width = 1;
+    while(cm->width < width) {
+        cm->width <<= 1;
+    }
+    cm->depth  = (int)ceil(log(1 / delta));
+    cm->seed   = *seed;
+    cm->counts = calloc(cm->width * cm->depth, sizeof(uint32_t));
+    return cm->counts == NULL ? -1 : 0;
+}
+
+void kc_cm_free(KcCountMin *cm) {
+    free(cm->counts);
+    cm->counts = NULL;
+}
+
+void kc_cm_add(KcCountMin *cm, const void *key, size_t len, uint32_t count) {
+    uint64_t upper;
+    uint64_t lower;
+    kc_hash_seeded(&cm->seed, key, len, &upper, &lower);
+    uint32_t h1 = H1(lower);
+    uint32_t h2 = H2(lower);
+    for(int i = 0; i < cm->depth; i++) {
+        uint32_t *cell = cm->counts + i * cm->width + ((h1 + i * h2) & (cm->width - 1));
+        *cell = *cell > UINT32_MAX - count ? UINT32_MAX : *cell + count;
+    }
+}
+
+uint32_t kc_cm_estimate(const KcCountMin *cm, const void *key, size_t len) {
+    uint64_t upper;
+    uint64_t lower;
+    kc_hash_seeded(&cm->seed, key, len, &upper, &lower);
+    uint32_t h1   = H1(lower);
+    uint32_t h2   = H2(lower);
+    uint32_t best = UINT32_MAX;
+    for(int i = 0; i < cm->depth; i++) {
+        uint32_t cell = cm->counts[i * cm->width + ((h1 + i * h2) & (cm->width - 1))];
+        if(cell < best) {
+            best = cell;
+        }
+    }
+    return best;
+}
+
+int kc_cm_merge(KcCountMin *dest, const KcCountMin *src) {
+    if(dest->width != src->width || dest->depth != src->depth || !same_seed(&dest->seed, &src->seed)) {
+        return -1;
+    }
+    size_t cells = dest->width * dest->depth;
+    for(size_t i = 0; i < cells; i++) {
+        uint32_t sum = dest->counts[i] + src->counts[i];
+        dest->counts[i] = sum < dest->counts[i] ? UINT32_MAX : sum;
+    }
+    return 0;
+}
+
+int kc_hll_init(KcHll *hll, int precision, const KcHashSeed *seed) {
+    if(precision < 4 || precision > 18) {
+        return -1;
+    }
+    hll->precision = precision;
+    hll->seed      = *seed;
+    hll->regs      = calloc((size_t)1 << precision, 1);
+    return hll->regs == NULL ? -1 : 0;
+}
+
+void kc_hll_free(KcHll *hll) {
+    free(hll->regs);
+    hll->regs = NULL;
+}
+
+void kc_hll_add(KcHll *hll, const void *key, size_t len) {
+    uint64_t upper;
+    uint64_t lower;
+    kc_hash_seeded(&hll->seed, key, len, &upper, &lower);
+    // Register from the top of upper, rank from lower so the two don't
+    // share any bits.
+    size_t  reg  = upper >> (64 - hll->precision);
+    uint8_t rank = lower ? __builtin_clzll(lower) + 1 : 65;
+    if(rank > hll->regs[reg]) {
+        hll->regs[reg] = rank;
+    }
+}
+
+double kc_hll_count(const KcHll *hll) {
+    size_t m     = (size_t)1 << hll->precision;
+    double sum   = 0;
+    size_t zeros = 0;
+    for(size_t i = 0; i < m; i++) {
+        sum   += ldexp(1.0, -hll->regs[i]);
+        zeros += hll->regs[i] == 0;
+    }
+    double alpha;
+    switch(m) {
+        case 16: alpha = 0.673; break;
+        case 32: alpha = 0.697; break;
+        case 64: alpha = 0.709; break;
+        default: alpha = 0.7213 / (1 + 1.079 / m); break;
+    }
+    double estimate = alpha * m * m / sum;
+    // Small counts leave empty registers, linear counting does better there.
+    if(estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double)m / zeros);
+    }
+    return estimate;
+}
+
+int kc_hll_merge(KcHll *dest, const KcHll *src) {
+    if(dest->precision != src->precision || !same_seed(&dest->seed, &src->seed)) {
+        return -1;
+    }
+    size_t m = (size_t)1 << dest->precision;
+    for(size_t i = 0; i < m; i++) {
+        if(src->regs[i] > dest->regs[i]) {
+            dest->regs[i] = src->regs[i];
+        }
+    }
+    return 0;
+}
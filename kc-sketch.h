@@ -0,0 +1,91 @@
+/*
+MIT License
+
+Copyright (c) 2019 Keith J. Cancel
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef KC_SKETCH_H
+#define KC_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kc-hash.h"
+
+// Small fixed size summaries of big sets, every key is hashed once with
+// kc_hash_seeded and all the positions it needs come from those 128 bits.
+// Keys usually come from outside, so a seed from kc_hash_seed_init keeps
+// anyone from picking ones that pile up on the same bits. Each thread can
+// fill its own sketch and merge them after, merging only works between
+// sketches made with the same parameters and seed and returns -1 otherwise.
+// Anything else returning an int gives 0 on success and -1 when out of
+// memory or given bad parameters.
+
+// Bloom filter where all of a key's bits land in one 64 byte block, so a
+// lookup touches one cache line. It takes more memory than a plain Bloom
+// filter to hold the same false positive rate, about 4% more at 1% and 15%
+// more at 0.01%.
+typedef struct KcBloom {
+    uint64_t  *bits;
+    void      *raw;    // What was allocated, bits is aligned inside it.
+    size_t     blocks;
+    int        k;      // Bits set per key.
+    KcHashSeed seed;
+} KcBloom;
+
+int  kc_bloom_init (KcBloom *bloom, size_t expected, double fp_rate, const KcHashSeed *seed);
+void kc_bloom_free (KcBloom *bloom);
+void kc_bloom_add  (KcBloom *bloom, const void *key, size_t len);
+// 0 means definitely never added, 1 means probably added.
+int  kc_bloom_test (const KcBloom *bloom, const void *key, size_t len);
+int  kc_bloom_merge(KcBloom *dest, const KcBloom *src);
+
+// Count-min sketch. Estimates never come in under the true count and are
+// over it by at most epsilon times the total added, with probability
+// 1 - delta. Counters stop at UINT32_MAX.
+typedef struct KcCountMin {
+    uint32_t  *counts; // depth rows of width counters.
+    size_t     width;  // Always a power of two.
+    int        depth;
+    KcHashSeed seed;
+} KcCountMin;
+
+int      kc_cm_init    (KcCountMin *cm, double epsilon, double delta, const KcHashSeed *seed);
+void     kc_cm_free    (KcCountMin *cm);
+void     kc_cm_add     (KcCountMin *cm, const void *key, size_t len, uint32_t count);
+uint32_t kc_cm_estimate(const KcCountMin *cm, const void *key, size_t len);
+int      kc_cm_merge   (KcCountMin *dest, const KcCountMin *src);
+
+// HyperLogLog distinct counter with 2^precision one byte registers, the
+// typical error is 1.04 / sqrt(2^precision). precision goes from 4 to 18.
+typedef struct KcHll {
+    uint8_t   *regs;
+    int        precision;
+    KcHashSeed seed;
+} KcHll;
+
+int    kc_hll_init (KcHll *hll, int precision, const KcHashSeed *seed);
+void   kc_hll_free (KcHll *hll);
+void   kc_hll_add  (KcHll *hll, const void *key, size_t len);
+double kc_hll_count(const KcHll *hll);
+int    kc_hll_merge(KcHll *dest, const KcHll *src);
+
+#endif // KC_SKETCH_H
@@ -0,0 +1,427 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Runs the packer against real files through the POSIX stand in for the
+// Win32 calls in posix/. packer.c is built in with its main renamed so the
+// tests can call pack, unpack and the watch steps directly. A directory of
+// random files is packed and unpacked again, then watch mode is fed batches
+// of changes the way its listener would and every pack it writes has to
+// unpack to the directory as it is at that point. Swaps that fail have to
+// be retried from the temporary file without losing changes. Rekeying is
+// checked against the XOR worked out byte by byte, including keys too long
+// to combine, and is killed part way through at every write it makes. Run
+// again it has to finish the job from its journal. Everything happens under
+// packer-tests.tmp in the current directory. The errors it prints come from
+// the failures it sets up.
+// make packer-tests && ./packer-tests
+
+#define _DEFAULT_SOURCE
+#define main packer_main
+#include "packer.c"
+#undef main
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define TEST_DIR "packer-tests.tmp"
+
+static int failures = 0;
+
+static uint64_t rng_state = 0xa54ff53a5f1d36f1;
+
+// splitmix64, used for the file contents.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+static void remove_tree(const char *path) {
+    DIR *dir = opendir(path);
+    if(dir == NULL) {
+        unlink(path);
+        return;
+    }
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL) {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        char sub[strlen(path) + strlen(ent->d_name) + 2];
+        sprintf(sub, "%s/%s", path, ent->d_name);
+        remove_tree(sub);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+// Writes size random bytes, or text when text is given, creating any
+// directories on the way.
+static void write_file(const char *path, size_t size, const char *text) {
+    char dir[strlen(path) + 1];
+    strcpy(dir, path);
+    dir_get_parent(dir);
+    dir_create_recursive(dir);
+    FILE *fp = fopen_check(path, "wb");
+    if(text != NULL) {
+        fputs(text, fp);
+    }
+    for(size_t i = 0; text == NULL && i < size; i++) {
+        fputc(rng_next() & 0xFF, fp);
+    }
+    fclose(fp);
+}
+
+static uint8_t* read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if(fp == NULL) {
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    rewind(fp);
+    uint8_t *data = malloc_checked(*size + 1);
+    if(fread(data, 1, *size, fp) != *size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+    return data;
+}
+
+// Both directories hold the same paths with the same contents.
+static int same_tree(const char *a, const char *b) {
+    FileList  list_a, list_b;
+    FileList *lists_a[1] = { &list_a };
+    FileList *lists_b[1] = { &list_b };
+    PathIndex idx_a, idx_b;
+    file_list_init(&list_a);
+    file_list_init(&list_b);
+    get_file_list(&list_a, a, "");
+    get_file_list(&list_b, b, "");
+    path_index_build(&idx_a, lists_a, 1);
+    path_index_build(&idx_b, lists_b, 1);
+    file_list_free(&list_a);
+    file_list_free(&list_b);
+    int ok = idx_a.count == idx_b.count && idx_a.max_len == idx_b.max_len;
+    if(ok) {
+        char     path_a[idx_a.max_len + 1];
+        char     path_b[idx_b.max_len + 1];
+        PathIter it_a, it_b;
+        path_iter_init(&it_a, &idx_a, 0, path_a);
+        path_iter_init(&it_b, &idx_b, 0, path_b);
+        while(ok && path_iter_next(&it_a) != NULL && path_iter_next(&it_b) != NULL) {
+            char   full_a[strlen(a) + strlen(path_a) + 2];
+            char   full_b[strlen(b) + strlen(path_b) + 2];
+            size_t size_a = 0;
+            size_t size_b = 0;
+            sprintf(full_a, "%s/%s", a, path_a);
+            sprintf(full_b, "%s/%s", b, path_b);
+            uint8_t *data_a = read_file(full_a, &size_a);
+            uint8_t *data_b = read_file(full_b, &size_b);
+            ok = strcmp(path_a, path_b) == 0 && data_a != NULL && data_b != NULL &&
+                 size_a == size_b && memcmp(data_a, data_b, size_a) == 0;
+            free(data_a);
+            free(data_b);
+        }
+    }
+    path_index_free(&idx_a);
+    path_index_free(&idx_b);
+    return ok;
+}
+
+// Unpacks a copy of pack and compares it with dir.
+static int pack_holds(const char *pack, const char *dir, Key *key) {
+    char copy[] = TEST_DIR "/check.pack";
+    char out[]  = TEST_DIR "/check";
+    remove_tree(out);
+    if(!CopyFileA(pack, copy, FALSE)) {
+        return 0;
+    }
+    int ok = unpack(copy, key, 0, 0) == 0 && same_tree(dir, out);
+    remove_tree(out);
+    DeleteFileA(copy);
+    return ok;
+}
+
+static void make_tree(const char *base) {
+    static const char *dirs[] = { "a", "a/b", "a/b/c", "d", "zz" };
+    char path[256];
+    for(int i = 0; i < 40; i++) {
+        size_t size = i % 7 == 0 ? 0 : rng_next() % (i % 5 == 0 ? 300000 : 3000);
+        sprintf(path, "%s/%s/f%d.bin", base, dirs[i % 5], i);
+        write_file(path, size, NULL);
+    }
+    // Same contents twice so unpack links one to the other.
+    sprintf(path, "%s/a/same1.txt", base);
+    write_file(path, 0, "the same text in two files\n");
+    sprintf(path, "%s/d/same2.txt", base);
+    write_file(path, 0, "the same text in two files\n");
+    sprintf(path, "%s/__ignore_header__", base);
+    write_file(path, 1000, NULL);
+}
+
+static WatchChange* change_push(WatchChange *head, const char *path, DWORD action) {
+    WatchChange *change = malloc_checked(sizeof(WatchChange) + strlen(path) + 1);
+    strcpy(change->path, path);
+    change->action = action;
+    change->next   = head;
+    return change;
+}
+
+static int file_missing(const char *path) {
+    return GetFileAttributesA(path) == INVALID_FILE_ATTRIBUTES;
+}
+
+static void test_round_trip(Key *key) {
+    char tree[]      = TEST_DIR "/tree";
+    char pack_name[] = TEST_DIR "/tree.pack";
+    char moved[]     = TEST_DIR "/out/tree.pack";
+    char out[]       = TEST_DIR "/out/tree";
+    char out_dir[]   = TEST_DIR "/out";
+    make_tree(tree);
+    int ok = pack(tree, key, 0) == 0;
+    dir_create_recursive(out_dir);
+    ok = ok && MoveFileExA(pack_name, moved, 0) && unpack(moved, key, 0, 0) == 0;
+    printf("  %-36s %s\n", "pack then unpack", verdict(ok && same_tree(tree, out)));
+    remove_tree(out_dir);
+}
+
+// Drives watch the way its main loop does, minus the listener thread.
+static void test_watch(Key *key) {
+    char       base[]   = TEST_DIR "/watched";
+    char       name[]   = TEST_DIR "/watched.pack";
+    char       tmp1[]   = TEST_DIR "/watched.pack.tmp";
+    char       tmp2[]   = TEST_DIR "/watched.pack.tmp2";
+    Pattern    key_pat;
+    FileList   list;
+    WatchPack  pk = { NULL, 0 };
+    pattern_init(&key_pat, key, NULL);
+    file_list_init(&list);
+    make_tree(base);
+    watch_add(&list, base, "");
+    int ok = watch_write(base, name, &list, key, &key_pat, &pk) == 0;
+    printf("  %-36s %s\n", "watch first write", verdict(ok && pack_holds(name, base, key)));
+
+    // Directories show up as modified whenever anything in them is, on their
+    // own they don't touch anything.
+    WatchChange *changes = change_push(NULL, "a", FILE_ACTION_MODIFIED);
+    changes = change_push(changes, "a/b", FILE_ACTION_MODIFIED);
+    printf("  %-36s %s\n", "watch skips modified directories", verdict(watch_apply(&list, base, changes) == 0));
+
+    // A batch the way the listener would queue it: a new directory with
+    // files in it, an edit, a delete and a rename.
+    write_file(TEST_DIR "/watched/new/deep/g.bin", 5000, NULL);
+    write_file(TEST_DIR "/watched/new/h.txt", 0, "new file\n");
+    write_file(TEST_DIR "/watched/a/f0.bin", 777, NULL);
+    DeleteFileA(TEST_DIR "/watched/d/f3.bin");
+    MoveFileExA(TEST_DIR "/watched/zz/f4.bin", TEST_DIR "/watched/zz/renamed.bin", 0);
+    changes = change_push(NULL, "zz/renamed.bin", FILE_ACTION_RENAMED_NEW_NAME);
+    changes = change_push(changes, "zz/f4.bin", FILE_ACTION_RENAMED_OLD_NAME);
+    changes = change_push(changes, "d/f3.bin", FILE_ACTION_REMOVED);
+    changes = change_push(changes, "a", FILE_ACTION_MODIFIED);
+    changes = change_push(changes, "a/f0.bin", FILE_ACTION_MODIFIED);
+    changes = change_push(changes, "new/h.txt", FILE_ACTION_ADDED);
+    changes = change_push(changes, "new/deep/g.bin", FILE_ACTION_ADDED);
+    changes = change_push(changes, "new/deep", FILE_ACTION_ADDED);
+    changes = change_push(changes, "new", FILE_ACTION_ADDED);
+    // Drops the edited, deleted and renamed entries then reads back the
+    // edit, the new name and the two files under new.
+    int touched = watch_apply(&list, base, changes);
+    ok = watch_write(base, name, &list, key, &key_pat, &pk) == 0;
+    printf("  %-36s %s\n", "watch applies a batch", verdict(touched == 7 && ok && pack_holds(name, base, key)));
+
+    // The pack is busy, the new one stays in the temporary file and the
+    // next batch is copied forward from it.
+    win32_fail_moves = 2;
+    write_file(TEST_DIR "/watched/d/later1.txt", 0, "first retry\n");
+    watch_apply(&list, base, change_push(NULL, "d/later1.txt", FILE_ACTION_ADDED));
+    ok = watch_write(base, name, &list, key, &key_pat, &pk) == 1 && pk.tmp == 1 && !file_missing(tmp1);
+    write_file(TEST_DIR "/watched/d/later2.txt", 0, "second retry\n");
+    watch_apply(&list, base, change_push(NULL, "d/later2.txt", FILE_ACTION_ADDED));
+    ok &= watch_write(base, name, &list, key, &key_pat, &pk) == 1 && pk.tmp == 2;
+    ok &= file_missing(tmp1) && pack_holds(tmp2, base, key);
+    printf("  %-36s %s\n", "watch keeps changes when swaps fail", verdict(ok));
+    fclose(pk.fp);
+    ok = watch_swap(name, &pk, pk.tmp) == 0 && pk.tmp == 0 && file_missing(tmp1) && file_missing(tmp2);
+    printf("  %-36s %s\n", "watch retry swaps the pack in", verdict(ok && pack_holds(name, base, key)));
+
+    // An entry that would push the pack past 4 GiB leaves it alone.
+    FileNode *huge = file_node_create("huge.bin");
+    strcpy(huge->path, "huge.bin");
+    huge->size   = UINT32_MAX;
+    huge->offset = WATCH_FRESH;
+    file_list_add(&list, huge);
+    ok = watch_write(base, name, &list, key, &key_pat, &pk) == -1 && pk.tmp == 0 && file_missing(tmp1);
+    printf("  %-36s %s\n", "watch refuses a pack over 4 GiB", verdict(ok && pack_holds(name, base, key)));
+    fclose(pk.fp);
+    file_list_free(&list);
+    pattern_free(&key_pat);
+}
+
+static uint8_t* xor_keys(const uint8_t *data, size_t size, const Key *a, const Key *b) {
+    uint8_t *out = malloc_checked(size + 1);
+    for(size_t i = 0; i < size; i++) {
+        out[i] = data[i] ^ a->str[i % a->length] ^ b->str[i % b->length];
+    }
+    return out;
+}
+
+static int file_is(const char *path, const uint8_t *data, size_t size) {
+    size_t   got_sz = 0;
+    uint8_t *got    = read_file(path, &got_sz);
+    int      ok     = got != NULL && got_sz == size && memcmp(got, data, size) == 0;
+    free(got);
+    return ok;
+}
+
+// Runs rekey in a child that dies in the middle of its crash'th write,
+// returns whether it got that far instead of finishing.
+static int rekey_crash(char *pack_name, Key *key, Key *new_key, int crash) {
+    fflush(stdout);
+    pid_t child = fork();
+    if(child == 0) {
+        // Its errors are expected.
+        freopen("/dev/null", "w", stderr);
+        win32_crash_writes = crash;
+        _exit(rekey(pack_name, key, new_key, 0) == 0 ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 3;
+}
+
+static void test_rekey(Key *key) {
+    char     tree[]         = TEST_DIR "/rk";
+    char     pack_name[]    = TEST_DIR "/rk.pack";
+    char     journal_name[] = TEST_DIR "/rk.pack.rekey";
+    char     big[]          = TEST_DIR "/rk/big.bin";
+    char     new_str[]      = "a longer other key";
+    Key      new_key        = { new_str, strlen(new_str), 0 };
+    size_t   size           = 0;
+    size_t   journal_sz     = 0;
+    size_t   partial_sz     = 0;
+    make_tree(tree);
+    // Enough for a few journal blocks.
+    write_file(big, 3 * REKEY_BLOCK_SZ + 12345, NULL);
+    // pack expects the key fresh from the command line.
+    key_seek(key, 0);
+    pack(tree, key, 0);
+    uint8_t *orig = read_file(pack_name, &size);
+    uint8_t *want = xor_keys(orig, size, key, &new_key);
+    int ok = rekey(pack_name, key, &new_key, 0) == 0 && file_is(pack_name, want, size) && file_missing(journal_name);
+    printf("  %-36s %s\n", "rekey in place", verdict(ok && pack_holds(pack_name, tree, &new_key)));
+    ok = rekey(pack_name, &new_key, key, 0) == 0 && file_is(pack_name, orig, size);
+    printf("  %-36s %s\n", "rekey back", verdict(ok));
+    ok = rekey(pack_name, &new_key, key, 0) == -1 && file_is(pack_name, orig, size) && file_missing(journal_name);
+    printf("  %-36s %s\n", "rekey with the wrong key", verdict(ok));
+
+    // Their lcm is past PATTERN_MAX_PERIOD, so two passes.
+    char *long_a = malloc_checked(8192);
+    char *long_b = malloc_checked(8210);
+    for(int i = 0; i < 8191; i++) {
+        long_a[i] = 'a' + i % 23;
+    }
+    for(int i = 0; i < 8209; i++) {
+        long_b[i] = 'A' + i % 19;
+    }
+    Key   key_a  = { long_a, 8191, 0 };
+    Key   key_b  = { long_b, 8209, 0 };
+    Pattern pat;
+    uint8_t *long_want = xor_keys(orig, size, key, &key_a);
+    ok = pattern_init(&pat, &key_a, &key_b) != 0;
+    ok &= rekey(pack_name, key, &key_a, 0) == 0 && file_is(pack_name, long_want, size);
+    free(long_want);
+    long_want = xor_keys(orig, size, key, &key_b);
+    ok &= rekey(pack_name, &key_a, &key_b, 0) == 0 && file_is(pack_name, long_want, size);
+    ok &= rekey(pack_name, &key_b, key, 0) == 0 && file_is(pack_name, orig, size);
+    printf("  %-36s %s\n", "rekey long keys in two passes", verdict(ok));
+    free(long_want);
+
+    // Killed at every write it makes, then killed again early on in the
+    // run that picks it up. Either way running it once more has to finish.
+    int crashes = 0;
+    ok = 1;
+    for(int crash = 1; ok; crash++) {
+        if(!rekey_crash(pack_name, key, &new_key, crash)) {
+            // Got through every write, nothing left to crash in.
+            ok = file_is(pack_name, want, size) && file_missing(journal_name);
+            break;
+        }
+        crashes++;
+        int finished = 0;
+        for(int again = 1; again <= 3 && !finished; again++) {
+            finished = !rekey_crash(pack_name, key, &new_key, again);
+        }
+        if(!finished) {
+            ok = rekey(pack_name, key, &new_key, 0) == 0;
+        }
+        ok &= file_is(pack_name, want, size) && file_missing(journal_name);
+        ok &= rekey(pack_name, &new_key, key, 0) == 0 && file_is(pack_name, orig, size);
+    }
+    printf("  %-36s %s\n", "rekey resumes after a crash", verdict(ok && crashes > 8));
+    // A journal left by other keys is not touched, nor is the pack.
+    rekey(pack_name, &new_key, key, 0);
+    ok = rekey_crash(pack_name, key, &new_key, 6);
+    uint8_t *journal = read_file(journal_name, &journal_sz);
+    uint8_t *partial = read_file(pack_name, &partial_sz);
+    ok &= journal != NULL && partial != NULL && rekey(pack_name, key, &key_a, 0) == -1;
+    ok &= file_is(journal_name, journal, journal_sz) && file_is(pack_name, partial, partial_sz);
+    ok &= rekey(pack_name, key, &new_key, 0) == 0 && file_is(pack_name, want, size);
+    printf("  %-36s %s\n", "rekey keeps a journal for other keys", verdict(ok));
+    free(journal);
+    free(partial);
+    free(long_a);
+    free(long_b);
+    free(want);
+    free(orig);
+}
+
+int main(void) {
+    char key_str[]  = "a key";
+    char test_dir[] = TEST_DIR;
+    Key  key        = { key_str, 5, 0 };
+    remove_tree(test_dir);
+    if(dir_create_recursive(test_dir) || file_missing(test_dir)) {
+        fprintf(stderr, "packer-tests: failed to create ‘%s’\n", TEST_DIR);
+        return 1;
+    }
+    printf("Packer through the POSIX Win32 stand in\n");
+    test_round_trip(&key);
+    test_watch(&key);
+    test_rekey(&key);
+    remove_tree(TEST_DIR);
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -23,8 +23,16 @@ SOFTWARE.
 #include <stdint.h>
 #include <string.h>
 #include <windows.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "file-list.h"
+#include "path-index.h"
+#include "stats.h"
 
 typedef struct Key {
    char     *str;
@@ -33,13 +41,29 @@ typedef struct Key {
 } Key;
 
 int pack(char *path, Key *key, int v);
-int unpack(char *src, Key *key, int v);
+int unpack(char *src, Key *key, int copies, int v);
+int rekey(char *src, Key *key, Key *new_key, int v);
+int merge(char *dest, char **srcs, int n, Key *key, int v);
+int split(char *src, Key *key, int v);
+int search(char *src, char **needles, int n, Key *key, int v);
+int watch(char *path, Key *key, int v);
 
 int main(int argc, char **argv) {
     char null_key[2] = { 0x00, '\0' };
     char *src_file = NULL;
+    char *stats_file = NULL;
+    char *merge_srcs[argc];
+    int   merge_cnt = 0;
+    char *needles[argc];
+    int   needle_cnt = 0;
     Key key = { null_key, 1, 0};
+    Key new_key = { NULL, 0, 0 };
     int p_flag  = 0;
+    int m_flag  = 0;
+    int s_flag  = 0;
+    int w_flag  = 0;
+    int c_flag  = 0;
+    int s_stats = 0;
     int verbose = 0;
     for(int i = 1; i < argc; i++) {
         char *cur = argv[i];
@@ -47,7 +71,8 @@ int main(int argc, char **argv) {
             if(src_file == NULL) {
                 src_file = cur;
             } else {
-                fprintf(stderr, "packer: error: source file name already specified.\n");
+                // When merging the first file is the destination
+                merge_srcs[merge_cnt++] = cur;
             }
             continue;
         }
@@ -78,12 +103,128 @@ int main(int argc, char **argv) {
             verbose = 1;
             continue;
         }
+        if(cur[1] == 'c' && len == 2) {
+            c_flag = 1;
+            continue;
+        }
+        if((cur[1] == 's' && len == 2) || strcmp(cur, "--stats") == 0) {
+            s_stats = 1;
+            continue;
+        }
+        if(strcmp(cur, "-stats") == 0) {
+            if(i+1 >= argc) {
+                fprintf(stderr, "packer: error: missing a file after ‘-stats’\n");
+                continue;
+            }
+            s_stats    = 1;
+            stats_file = argv[++i];
+            continue;
+        }
+        if(strcmp(cur, "-merge") == 0) {
+            m_flag = 1;
+            continue;
+        }
+        if(strcmp(cur, "-split") == 0) {
+            s_flag = 1;
+            continue;
+        }
+        if(strcmp(cur, "-watch") == 0) {
+            w_flag = 1;
+            continue;
+        }
+        if(strcmp(cur, "-search") == 0) {
+            if(i+1 >= argc || argv[i+1][0] == '\0') {
+                fprintf(stderr, "packer: error: missing a string after ‘-search’\n");
+                i++;
+                continue;
+            }
+            needles[needle_cnt++] = argv[++i];
+            continue;
+        }
+        if(strcmp(cur, "-rekey") == 0) {
+            if(i+1 >= argc) {
+                fprintf(stderr, "packer: error: missing a key after ‘-rekey’\n");
+                continue;
+            }
+            i++;
+            if(new_key.str != NULL) {
+                fprintf(stderr, "packer: error: a new key has already been specified.\n");
+            } else {
+                new_key.length = strlen(argv[i]);
+                new_key.str = argv[i];
+            }
+            continue;
+        }
         fprintf(stderr, "packer: error: unrecognized command line option ‘%s’\n", cur);
     }
+    // An empty key XORs with nothing, same as the default null key.
+    if(key.length == 0) {
+        key.str    = null_key;
+        key.length = 1;
+    }
     if(src_file == NULL) {
         fprintf(stderr, "packer: fatal error: no input file/directory\n");
         return -1;
     }
+    if(p_flag + m_flag + s_flag + w_flag + (new_key.str != NULL) + (needle_cnt > 0) > 1) {
+        fprintf(stderr, "packer: fatal error: only one of ‘-p’, ‘-merge’, ‘-split’, ‘-watch’, ‘-search’ or ‘-rekey’ can be used.\n");
+        return -1;
+    }
+    if(verbose) {
+        // Line buffering a console costs a write per file printed.
+        setvbuf(stdout, NULL, _IOFBF, 4096 * 16);
+    }
+    if(s_stats) {
+        const char *mode = p_flag ? "pack" : m_flag ? "merge" : s_flag ? "split" : w_flag ? "watch" :
+                           needle_cnt > 0 ? "search" : new_key.str != NULL ? "rekey" : "unpack";
+        stats_enable(mode, stats_file);
+    }
+    if(m_flag) {
+        if(merge_cnt == 0) {
+            fprintf(stderr, "packer: fatal error: no pack files to merge into ‘%s’\n", src_file);
+            return -1;
+        }
+        if(verbose) {
+            printf("Merging %d pack files into ‘%s’\n", merge_cnt, src_file);
+            printf("Using the key: ‘%s’\n", key.str);
+        }
+        return merge(src_file, merge_srcs, merge_cnt, &key, verbose);
+    }
+    if(merge_cnt > 0) {
+        fprintf(stderr, "packer: error: source file name already specified.\n");
+    }
+    if(needle_cnt > 0) {
+        if(verbose) {
+            printf("Searching file: ‘%s’ for %d string(s)\n", src_file, needle_cnt);
+            printf("Using the key: ‘%s’\n", key.str);
+        }
+        return search(src_file, needles, needle_cnt, &key, verbose);
+    }
+    if(w_flag) {
+        if(verbose) {
+            printf("Watching directory: ‘%s’\n", src_file);
+            printf("Using the key: ‘%s’\n", key.str);
+        }
+        return watch(src_file, &key, verbose);
+    }
+    if(s_flag) {
+        if(verbose) {
+            printf("Splitting file: ‘%s’\n", src_file);
+            printf("Using the key: ‘%s’\n", key.str);
+        }
+        return split(src_file, &key, verbose);
+    }
+    if(new_key.str != NULL) {
+        if(new_key.length == 0) {
+            new_key.str    = null_key;
+            new_key.length = 1;
+        }
+        if(verbose) {
+            printf("Rekeying file: ‘%s’\n", src_file);
+            printf("From the key: ‘%s’ to the key: ‘%s’\n", key.str, new_key.str);
+        }
+        return rekey(src_file, &key, &new_key, verbose);
+    }
     if(verbose) {
         printf("%s: ‘%s’\n", p_flag ? "Packing directory" : "Unpacking file", src_file);
         printf("Using the key: ‘%s’\n", key.str);
@@ -91,13 +232,14 @@ int main(int argc, char **argv) {
     if(p_flag) {
         return pack(src_file, &key, verbose);
     } else {
-        return unpack(src_file, &key, verbose);
+        return unpack(src_file, &key, c_flag, verbose);
     }
     return 0;
 }
 
 FILE* fopen_check(const char *filename, const char * mode) {
     FILE *fp = fopen(filename, mode);
+    stats.fopens++;
     if(fp == NULL || ferror(fp)) {
         fprintf(stderr, "packer: fatal error: failed to open ‘%s’\n", filename);
         exit(-1);
@@ -116,6 +258,11 @@ void* malloc_checked(size_t size) {
     return tmp;
 }
 
+// Moves the key to where it would be at offset in a pack.
+void key_seek(Key *key, uint64_t offset) {
+    key->pos = offset % key->length;
+}
+
 char get_next_key_char(Key *key) {
     if(key->pos >= key->length) {
         key->pos = 0;
@@ -128,6 +275,7 @@ char get_next_key_char(Key *key) {
 // To think this file format XORs all the data just because.
 int fread_encoded(void * ptr, size_t size, size_t count, FILE * stream, Key *key) {
     int n = fread(ptr, size, count, stream);
+    stats.freads++;
     uint8_t *buf = ptr;
     for(size_t i = 0; i < n * size; i++) {
         buf[i] ^= get_next_key_char(key);
@@ -142,6 +290,7 @@ int fwrite_encoded(const void * ptr, size_t size, size_t count, FILE * stream, K
         buf[i] = data[i] ^ get_next_key_char(key);
     }
     int n = fwrite(buf, size, count, stream);
+    stats.fwrites++;
     free(buf);
     return n;
 }
@@ -153,6 +302,7 @@ int fcopy_n_encoded(FILE *dest, FILE *src, Key* key, size_t n) {
     uint8_t buffer[buff_sz];
     do {
         int read = fread(&buffer, 1, remains < buff_sz ? remains : buff_sz, src);
+        stats.freads++;
         if(read == 0) {
             break;
         }
@@ -160,6 +310,7 @@ int fcopy_n_encoded(FILE *dest, FILE *src, Key* key, size_t n) {
             buffer[i] ^= get_next_key_char(key);
         }
         int wrote = fwrite(&buffer, 1, read, dest);
+        stats.fwrites++;
         if(wrote == 0) {
             break;
         }
@@ -175,6 +326,7 @@ int fcopy_encoded(FILE *dest, FILE *src, Key* key) {
     uint8_t buffer[buff_sz];
     while(1) {
         int read = fread(&buffer, 1, buff_sz, src);
+        stats.freads++;
         if(read == 0) {
             break;
         }
@@ -182,6 +334,7 @@ int fcopy_encoded(FILE *dest, FILE *src, Key* key) {
             buffer[i] ^= get_next_key_char(key);
         }
         int wrote = fwrite(&buffer, 1, read, dest);
+        stats.fwrites++;
         if(wrote == 0) {
             break;
         }
@@ -190,33 +343,233 @@ int fcopy_encoded(FILE *dest, FILE *src, Key* key) {
     return total;
 }
 
+// XOR src into dest, a vector at a time where we can.
+void xor_bytes(uint8_t *dest, const uint8_t *src, size_t n) {
+    size_t i = 0;
+#ifdef __AVX2__
+    for(; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dest + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_xor_si256(a, b));
+    }
+#endif
+#ifdef __SSE2__
+    for(; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dest + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_si128((__m128i*)(dest + i), _mm_xor_si128(a, b));
+    }
+#endif
+    for(; i < n; i++) {
+        dest[i] ^= src[i];
+    }
+}
+
+#define PATTERN_BLOCK_SZ (4096 * 16)
+// Largest period we are willing to expand a pair of keys to.
+#define PATTERN_MAX_PERIOD (1024 * 1024 * 64)
+
+// Since every byte of a pack is XORed with key[offset % length] a key, or
+// the XOR of two keys, is just a repeating pattern. The pattern is laid out
+// so a whole block can be XORed in one go starting from any phase.
+typedef struct Pattern {
+    uint8_t  *bytes;
+    unsigned period;
+} Pattern;
+
+unsigned gcd(unsigned a, unsigned b) {
+    while(b != 0) {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Builds the pattern a[i % a->length] ^ b[i % b->length], b may be NULL.
+int pattern_init(Pattern *pat, const Key *a, const Key *b) {
+    size_t period = a->length;
+    if(b != NULL) {
+        period = (period / gcd(a->length, b->length)) * b->length;
+    }
+    if(period > PATTERN_MAX_PERIOD) {
+        return 1;
+    }
+    size_t sz  = period + PATTERN_BLOCK_SZ;
+    pat->bytes  = malloc_checked(sz);
+    pat->period = period;
+    for(size_t i = 0; i < sz; i++) {
+        pat->bytes[i] = a->str[i % a->length];
+        if(b != NULL) {
+            pat->bytes[i] ^= b->str[i % b->length];
+        }
+    }
+    return 0;
+}
+
+void pattern_free(Pattern *pat) {
+    free(pat->bytes);
+    pat->bytes  = NULL;
+    pat->period = 0;
+}
+
+// XORs the pattern into buf, pos being the offset of buf[0] in the pack.
+void pattern_apply(const Pattern *pat, uint8_t *buf, size_t n, uint64_t pos) {
+    while(n > 0) {
+        size_t len = n < PATTERN_BLOCK_SZ ? n : PATTERN_BLOCK_SZ;
+        xor_bytes(buf, pat->bytes + (pos % pat->period), len);
+        buf += len;
+        pos += len;
+        n   -= len;
+    }
+}
+
+// Little endian, returns how many of the 4 bytes were written.
 int fwrite_uint32_encoded(FILE *dest, uint32_t val, Key* key) {
-    int total = 0;
+    uint8_t bytes[4];
     for(int i = 0; i < 4; i++) {
-        uint8_t byte = 0xFF & ( val >> ( i * 8 ) );
-        byte ^= get_next_key_char(key);
-        if(fwrite(&byte, 1, 1, dest) == 0) {
-            break;
-        }
-        total++;
+        bytes[i] = (0xFF & ( val >> ( i * 8 ) )) ^ get_next_key_char(key);
     }
-    return total;
+    stats.fwrites++;
+    return fwrite(bytes, 1, 4, dest);
 }
 
 int fread_uint32_encoded(FILE *src, uint32_t *val, Key* key) {
+    uint8_t  bytes[4];
     uint32_t tmp = 0;
-    uint8_t byte = 0;
-    int    total = 0;
+    stats.freads++;
+    int total = fread(bytes, 1, 4, src);
+    for(int i = 0; i < total; i++) {
+        tmp |= (uint32_t)(uint8_t)(bytes[i] ^ get_next_key_char(key)) << (i * 8);
+    }
+    *val = tmp;
+    return total;
+}
+
+typedef struct PackHeader {
+    uint32_t files;
+    uint32_t ignore_len;
+} PackHeader;
+
+// Checks the magic bytes and reads the header, leaves fp at the ignore header.
+int pack_read_header(FILE *fp, Key *key, PackHeader *hdr) {
+    char buf[4];
+    key_seek(key, 0);
+    if(fread_encoded(buf, 1, 4, fp, key) != 4) {
+        fprintf(stderr, "packer: fatal error: This is not a pack file.\n");
+        return -1;
+    }
+    char magic_bytes[4] = {'p', 'a', 'c', 'k'};
     for(int i = 0; i < 4; i++) {
-        if(fread(&byte, 1, 1, src) == 0) {
+        if(buf[i] != magic_bytes[i]) {
+            fprintf(stderr, "packer: fatal error: Either the key is wrong or this is not a pack file.\n");
+            return -1;
+        }
+    }
+    if(fread_uint32_encoded(fp, &hdr->files, key) != 4 || fread_uint32_encoded(fp, &hdr->ignore_len, key) != 4) {
+        fprintf(stderr, "packer: fatal error: Too small to be a pack file.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the fixed part of the next index entry, the path follows it.
+int pack_read_entry(FILE *fp, Key *key, uint32_t *path_len, uint32_t *size, uint32_t *offset) {
+    if(
+        fread_uint32_encoded(fp, path_len, key) != 4 ||
+        fread_uint32_encoded(fp, size, key) != 4 ||
+        fread_uint32_encoded(fp, offset, key) != 4
+    ) {
+        fprintf(stderr, "packer: fatal error: This Pack file is corrupted.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Reads the file index, fp has to be right after the ignore header.
+int pack_read_index(FILE *fp, Key *key, PackHeader *hdr, FileList *list) {
+    uint64_t start = stats_now();
+    key_seek(key, 12 + (uint64_t)hdr->ignore_len);
+    for(size_t i = 0; i < hdr->files; i++) {
+        uint32_t path_len, size, offset;
+        if(pack_read_entry(fp, key, &path_len, &size, &offset)) {
+            return -1;
+        }
+        FileNode *tmp = file_node_create_size_n(path_len);
+        tmp->size   = size;
+        tmp->offset = offset;
+        if(fread_encoded(tmp->path, 1, path_len, fp, key) != (int)path_len) {
+            fprintf(stderr, "packer: fatal error: The Pack file is corrupted.\n");
+            free(tmp);
+            return -1;
+        }
+        file_list_add(list, tmp);
+    }
+    stats_add_time(STAT_INDEX_DECODE, start);
+    return 0;
+}
+
+// Same as pack_read_index but decodes straight into a sorted path index.
+int pack_read_path_index(FILE *fp, Key *key, PackHeader *hdr, PathIndex *idx) {
+    uint64_t start = stats_now();
+    int      ret   = 0;
+    PathIndexBuilder b;
+    path_index_builder_init(&b);
+    key_seek(key, 12 + (uint64_t)hdr->ignore_len);
+    for(size_t i = 0; i < hdr->files && ret == 0; i++) {
+        uint32_t path_len, size, offset;
+        if(pack_read_entry(fp, key, &path_len, &size, &offset)) {
+            ret = -1;
+            break;
+        }
+        char *path = path_index_builder_add(&b, path_len, offset, size);
+        if(fread_encoded(path, 1, path_len, fp, key) != (int)path_len) {
+            fprintf(stderr, "packer: fatal error: The Pack file is corrupted.\n");
+            ret = -1;
+        }
+    }
+    path_index_builder_finish(&b, idx);
+    stats_add_time(STAT_INDEX_DECODE, start);
+    return ret;
+}
+
+int fwrite_index_entry(FILE *dest, const char *path, uint32_t size, uint32_t offset, Key *key) {
+    uint32_t path_len = strlen(path);
+    int total = fwrite_uint32_encoded(dest, path_len, key);
+    total += fwrite_uint32_encoded(dest, size, key);
+    total += fwrite_uint32_encoded(dest, offset, key);
+    total += fwrite_encoded(path, 1, path_len, dest, key);
+    return total;
+}
+
+// Copys n bytes at src_off in src to dest_off in dest. The XOR key is only
+// re-phased when the two offsets land on a different spot in the key,
+// otherwise the encoded bytes are moved as is.
+int fcopy_n_rephase(FILE *dest, uint64_t dest_off, FILE *src, uint64_t src_off, const Pattern *key_pat, size_t n) {
+    static uint8_t buffer[PATTERN_BLOCK_SZ];
+    int rephase  = (src_off % key_pat->period) != (dest_off % key_pat->period);
+    size_t total = 0;
+    if(fseek(src, src_off, SEEK_SET) != 0) {
+        return 0;
+    }
+    while(total < n) {
+        size_t want = n - total < PATTERN_BLOCK_SZ ? n - total : PATTERN_BLOCK_SZ;
+        size_t read = fread(buffer, 1, want, src);
+        stats.freads++;
+        if(read == 0) {
+            break;
+        }
+        if(rephase) {
+            pattern_apply(key_pat, buffer, read, src_off + total);
+            pattern_apply(key_pat, buffer, read, dest_off + total);
+        }
+        size_t wrote = fwrite(buffer, 1, read, dest);
+        stats.fwrites++;
+        total += wrote;
+        if(wrote != read) {
             break;
         }
-        char k = get_next_key_char(key);
-        byte ^= k;
-        tmp |= byte << (i * 8);
-        total++;
     }
-    *val = tmp;
     return total;
 }
 
@@ -268,7 +621,52 @@ int dir_create_recursive(char *path) {
 
 #define MANIP_BUFF_SZ 2048
 
-int unpack(char *src, Key *key, int verbose) {
+// Marks an entry with no earlier entry sharing its payload.
+#define DEDUP_NONE UINT32_MAX
+
+typedef struct DedupItem {
+    const PathEntry *entry;
+    uint32_t         pos;
+} DedupItem;
+
+int dedup_item_cmp(const void *a, const void *b) {
+    const PathEntry *x = ((const DedupItem*)a)->entry;
+    const PathEntry *y = ((const DedupItem*)b)->entry;
+    if(x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    if(x->size != y->size) {
+        return x->size < y->size ? -1 : 1;
+    }
+    return ((const DedupItem*)a)->pos < ((const DedupItem*)b)->pos ? -1 : 1;
+}
+
+// Entries pointing at the same payload only need it written out once. For
+// each entry find the position of the first entry sharing its offset and
+// size, or DEDUP_NONE when it is the first.
+uint32_t* dedup_find_sources(const PathIndex *idx) {
+    uint32_t  *sources = malloc_checked(sizeof(uint32_t) * (idx->count + 1));
+    DedupItem *items   = malloc_checked(sizeof(DedupItem) * (idx->count + 1));
+    uint32_t   n       = idx->count;
+    for(uint32_t i = 0; i < n; i++) {
+        items[i].entry = &idx->entries[i];
+        items[i].pos   = i;
+    }
+    qsort(items, n, sizeof(DedupItem), dedup_item_cmp);
+    for(uint32_t i = 0; i < n; i++) {
+        const DedupItem *first = &items[i];
+        sources[first->pos] = DEDUP_NONE;
+        // Sorted by position within a run, so the first of a run is written first.
+        while(i + 1 < n && first->entry->size > 0 && items[i + 1].entry->offset == first->entry->offset && items[i + 1].entry->size == first->entry->size) {
+            i++;
+            sources[items[i].pos] = first->pos;
+        }
+    }
+    free(items);
+    return sources;
+}
+
+int unpack(char *src, Key *key, int copies, int verbose) {
     int base_sz      = strlen(src) + 1;
     char *manip_buff = malloc_checked(MANIP_BUFF_SZ);
     char base[base_sz];
@@ -277,33 +675,21 @@ int unpack(char *src, Key *key, int verbose) {
     if(verbose) {
         printf("Creating directory ‘%s’\n", base);
     }
+    uint64_t start = stats_now();
     if(dir_create_recursive(base)) {
         fprintf(stderr, "packer: fatal error: Failed to create directory.\n");
         return -1;
     };
+    stats_add_time(STAT_MKDIR, start);
     FILE *fp = fopen_check(src, "rb");
-    // check file magic bytes.
-    char buf[4];
-    if(fread_encoded(buf, 1, 4, fp, key) != 4) {
-        fprintf(stderr, "packer: fatal error: This is not a pack file.\n");
-        return -1;
-    }
-    char magic_bytes[4] = {'p', 'a', 'c', 'k'};
-    for(int i = 0; i < 4; i++) {
-        if(buf[i] != magic_bytes[i]) {
-            fprintf(stderr, "packer: fatal error: Either the key is wrong or this is not a pack file.\n");
-            return -1;
-        }
-    }
     // Read header
-    uint32_t files      = 0;
-    uint32_t ignore_len = 0;
-    if(fread_uint32_encoded(fp, &files, key) != 4 || fread_uint32_encoded(fp, &ignore_len, key) != 4) {
-        fprintf(stderr, "packer: fatal error: Too small to be a pack file.\n");
+    PackHeader hdr;
+    if(pack_read_header(fp, key, &hdr)) {
         return -1;
     }
+    uint32_t ignore_len = hdr.ignore_len;
     if(verbose) {
-        printf("Contains %u files.\n", files);
+        printf("Contains %u files.\n", hdr.files);
         printf("Ignore Header Size: %u bytes\n", ignore_len);
     }
     if(ignore_len > 0) {
@@ -315,49 +701,82 @@ int unpack(char *src, Key *key, int verbose) {
         fcopy_n_encoded(ignore, fp, key, ignore_len);
         fclose(ignore);
     }
-    FileList list;
-    file_list_init(&list);
-    for(size_t i = 0; i < files; i++) {
-        uint32_t path_len, size, offset;
-        if(
-            fread_uint32_encoded(fp, &path_len, key) != 4 ||
-            fread_uint32_encoded(fp, &size, key) != 4 ||
-            fread_uint32_encoded(fp, &offset, key) != 4
-        ) {
-            fprintf(stderr, "packer: fatal error: This Pack file is corrupted.\n");
-            return -1;
-        }
-        FileNode *tmp = file_node_create_size_n(path_len);
-        tmp->size   = size;
-        tmp->offset = offset;
-        if(fread_encoded(tmp->path, 1, path_len, fp, key) != (int)path_len) {
-            fprintf(stderr, "packer: fatal error: The Pack file is corrupted.\n");
-            return -1;
-        }
-        file_list_add(&list, tmp);
+    PathIndex idx;
+    if(pack_read_path_index(fp, key, &hdr, &idx)) {
+        return -1;
     }
-    FileNode *cur = list.head;
-    while(cur != NULL) {
-        snprintf(manip_buff, MANIP_BUFF_SZ, "%s/%s", base, cur->path);
+    uint32_t *sources  = dedup_find_sources(&idx);
+    char     *src_buff = malloc_checked(MANIP_BUFF_SZ);
+    char     *dir_buff = malloc_checked(MANIP_BUFF_SZ);
+    char      path[idx.max_len + 1];
+    char      src_path[idx.max_len + 1];
+    uint64_t  dedup_sz = 0;
+    PathIter  it;
+    const PathEntry *cur;
+    path_iter_init(&it, &idx, 0, path);
+    while((cur = path_iter_next(&it)) != NULL) {
+        uint32_t pos = it.pos - 1;
+        snprintf(manip_buff, MANIP_BUFF_SZ, "%s/%s", base, path);
         dir_get_parent(manip_buff);
-        if(verbose) {
-            printf("Creating directory ‘%s’\n", manip_buff);
+        // Files come out sorted so a directory's files are all together and
+        // it only has to be created once.
+        if(strcmp(manip_buff, dir_buff) != 0) {
+            if(verbose) {
+                printf("Creating directory ‘%s’\n", manip_buff);
+            }
+            start = stats_now();
+            dir_create_recursive(manip_buff);
+            stats_add_time(STAT_MKDIR, start);
+            strcpy(dir_buff, manip_buff);
+        }
+        snprintf(manip_buff, MANIP_BUFF_SZ, "%s/%s", base, path);
+        start = stats_now();
+        if(sources[pos] != DEDUP_NONE) {
+            // Hard link to the copy already written, unless asked for plain
+            // copies or the file system can't do it.
+            PathIter src_it;
+            path_iter_init(&src_it, &idx, sources[pos], src_path);
+            path_iter_next(&src_it);
+            snprintf(src_buff, MANIP_BUFF_SZ, "%s/%s", base, src_path);
+            if(!copies && CreateHardLinkA(manip_buff, src_buff, NULL)) {
+                if(verbose) {
+                    printf("Linking file ‘%s’ to ‘%s’\n", manip_buff, src_buff);
+                }
+                dedup_sz += cur->size;
+                stats_add_time(STAT_PAYLOAD, start);
+                stats_file_done(manip_buff, start, 0);
+                continue;
+            }
+            if(CopyFileA(src_buff, manip_buff, FALSE)) {
+                if(verbose) {
+                    printf("Copying file ‘%s’ to ‘%s’\n", src_buff, manip_buff);
+                }
+                stats_add_time(STAT_PAYLOAD, start);
+                stats_file_done(manip_buff, start, cur->size);
+                continue;
+            }
         }
-        dir_create_recursive(manip_buff);
-        snprintf(manip_buff, MANIP_BUFF_SZ, "%s/%s", base, cur->path);
         if(verbose) {
             printf("Creating file ‘%s’\n", manip_buff);
         }
         fseek(fp, cur->offset, SEEK_SET);
+        key_seek(key, cur->offset);
         FILE *file = fopen_check(manip_buff, "wb");
         if(fcopy_n_encoded(file, fp, key, cur->size) != (int)cur->size) {
             fprintf(stderr, "packer: fatal error: Failed to write all of ‘%s’.\n", manip_buff);
             return -1;
         }
         fclose(file);
-        cur = cur->next;
+        stats_add_time(STAT_PAYLOAD, start);
+        stats_file_done(manip_buff, start, cur->size);
     }
-    file_list_free(&list);
+    if(verbose && dedup_sz > 0) {
+        printf("Hard links saved writing %llu bytes.\n", (unsigned long long)dedup_sz);
+    }
+    free(sources);
+    free(src_buff);
+    free(dir_buff);
+    path_index_free(&idx);
     free(manip_buff);
     return 0;
 }
@@ -376,60 +795,359 @@ int file_exists(char *path) {
     return (dwAttrib != INVALID_FILE_ATTRIBUTES) ? 1 : 0;
 }
 
-int get_file_list(FileList *list, const char *base, const char *sub) {
-    size_t base_len    = strlen(base);
-    size_t sub_len     = strlen(sub);
-    // Handle empty strings
-    char   base_sep[2] = { '\0', '\0' };
-    char   sub_sep[2]  = { '\0', '\0' };
-    // Place seperator after path if longer than zero.
-    base_sep[0] = base_len > 0 ? '/' : '\0';
-    sub_sep[0]  = sub_len  > 0 ? '/' : '\0';
-    size_t byte_len = base_len + sub_len + 4; // max possible size
-    char   full_path[byte_len];
-    snprintf(full_path, byte_len, "%s%s%s%s*", base, base_sep, sub, sub_sep);
-    // Start search of path
-    WIN32_FIND_DATAA fdFile;
-    HANDLE find = FindFirstFileA(full_path, &fdFile);
-    if(find == INVALID_HANDLE_VALUE) {
-        return 0;
+// Rekeying works on the pack in place a block at a time. Before a block is
+// changed its bytes go to a journal next to the pack, so when a rekey gets
+// cut short running it again with the same keys puts that block back and
+// carries on from there.
+#define REKEY_BLOCK_SZ (1024 * 1024)
+#define REKEY_VERSION  1
+// Journal header: "rkey", version, both key lengths, the pack size and a
+// checksum of those and the keys, then the old and new key.
+#define REKEY_HEADER_SZ 28
+// Two record slots follow the keys, each block's record goes in the slot
+// after the last one so a record cut off while being written always leaves
+// the one before it whole. A record is a sequence number, the block's offset,
+// its length, a checksum of those and the bytes, then the bytes.
+#define REKEY_RECORD_SZ 28
+
+void put_uint32(uint8_t *dest, uint32_t val) {
+    for(int i = 0; i < 4; i++) {
+        dest[i] = val >> (i * 8);
     }
-    do {
-        // Skip these more of like logical files.
-        if(strcmp(fdFile.cFileName, ".") == 0 || strcmp(fdFile.cFileName, "..") == 0) {
-            continue;
-        }
-        size_t name_sz = sub_len + strlen(fdFile.cFileName) + 2;
-        char name[name_sz];
-        snprintf(name, name_sz, "%s%s%s", sub, sub_sep, fdFile.cFileName);
-        // Enter Sub-directories
-        if(fdFile.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-            get_file_list(list, base, name);
-            continue;
-        }
-        // Add file to list
-        FileNode *tmp = file_node_create_size_n(strlen(name));
-        tmp->size = fdFile.nFileSizeLow;
-        strcpy(tmp->path, name);
-        file_list_add(list, tmp);
-    } while(FindNextFileA(find, &fdFile));
-    FindClose(find);
-    return 1;
 }
 
-int pack(char *path, Key *key, int verbose) {
-    if(!path_is_dir(path)) {
-        fprintf(stderr, "packer: fatal error: Not a directory: ‘%s’\n", path);
+void put_uint64(uint8_t *dest, uint64_t val) {
+    for(int i = 0; i < 8; i++) {
+        dest[i] = val >> (i * 8);
+    }
+}
+
+uint32_t get_uint32(const uint8_t *src) {
+    uint32_t val = 0;
+    for(int i = 0; i < 4; i++) {
+        val |= (uint32_t)src[i] << (i * 8);
+    }
+    return val;
+}
+
+uint64_t get_uint64(const uint8_t *src) {
+    uint64_t val = 0;
+    for(int i = 0; i < 8; i++) {
+        val |= (uint64_t)src[i] << (i * 8);
+    }
+    return val;
+}
+
+// FNV-1a, only there to spot a journal write that was cut off.
+#define FNV_BASIS 0xcbf29ce484222325
+
+uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t n) {
+    for(size_t i = 0; i < n; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+int file_read_at(HANDLE file, uint64_t offset, void *buf, size_t n) {
+    LARGE_INTEGER pos = { .QuadPart = offset };
+    DWORD         got = 0;
+    stats.freads++;
+    if(!SetFilePointerEx(file, pos, NULL, FILE_BEGIN) || !ReadFile(file, buf, n, &got, NULL)) {
         return -1;
     }
-    FileList list;
-    file_list_init(&list);
-    get_file_list(&list, path, "");
-    FileNode *ignore = file_list_remove(&list, "__ignore_header__");
-    if(verbose) {
-        printf("Files to pack: %d\n", list.count);
+    return got == n ? 0 : -1;
+}
+
+int file_write_at(HANDLE file, uint64_t offset, const void *buf, size_t n) {
+    LARGE_INTEGER pos   = { .QuadPart = offset };
+    DWORD         wrote = 0;
+    stats.fwrites++;
+    if(!SetFilePointerEx(file, pos, NULL, FILE_BEGIN) || !WriteFile(file, buf, n, &wrote, NULL)) {
+        return -1;
     }
-    size_t path_len = strlen(path);
+    return wrote == n ? 0 : -1;
+}
+
+size_t rekey_header(uint8_t *dest, const Key *key, const Key *new_key, uint64_t pack_sz) {
+    memcpy(dest, "rkey", 4);
+    put_uint32(dest + 4, REKEY_VERSION);
+    put_uint32(dest + 8, key->length);
+    put_uint32(dest + 12, new_key->length);
+    put_uint64(dest + 16, pack_sz);
+    memcpy(dest + REKEY_HEADER_SZ, key->str, key->length);
+    memcpy(dest + REKEY_HEADER_SZ + key->length, new_key->str, new_key->length);
+    uint64_t sum = fnv1a(FNV_BASIS, dest, 24);
+    sum = fnv1a(sum, dest + REKEY_HEADER_SZ, key->length + new_key->length);
+    put_uint32(dest + 24, sum);
+    return REKEY_HEADER_SZ + key->length + new_key->length;
+}
+
+// Whether the journal starts with a whole header, whatever keys it is for.
+int rekey_header_valid(HANDLE journal) {
+    uint8_t fixed[REKEY_HEADER_SZ];
+    if(file_read_at(journal, 0, fixed, REKEY_HEADER_SZ) != 0 || memcmp(fixed, "rkey", 4) != 0) {
+        return 0;
+    }
+    uint64_t keys_sz = (uint64_t)get_uint32(fixed + 8) + get_uint32(fixed + 12);
+    if(get_uint32(fixed + 4) != REKEY_VERSION || keys_sz > 1024 * 1024 * 64) {
+        return 0;
+    }
+    uint8_t *keys  = malloc_checked(keys_sz + 1);
+    int      valid = file_read_at(journal, REKEY_HEADER_SZ, keys, keys_sz) == 0 &&
+                     get_uint32(fixed + 24) == (uint32_t)fnv1a(fnv1a(FNV_BASIS, fixed, 24), keys, keys_sz);
+    free(keys);
+    return valid;
+}
+
+// Picks up a rekey that was cut short. Returns -1 when the journal is from
+// other keys or another pack, 1 when it never got past its header so the
+// pack is untouched, otherwise puts back the block the rekey may have been
+// in the middle of and returns 0 with where to carry on from.
+int rekey_resume(HANDLE pk, HANDLE journal, const uint8_t *header, size_t header_sz, uint64_t pack_sz, uint8_t *record, uint64_t *pos, uint64_t *seq) {
+    if(file_read_at(journal, 0, record, header_sz) != 0 || memcmp(record, header, header_sz) != 0) {
+        return rekey_header_valid(journal) ? -1 : 1;
+    }
+    int      found = -1;
+    uint64_t last  = 0;
+    for(int slot = 0; slot < 2; slot++) {
+        uint64_t at = header_sz + slot * (uint64_t)(REKEY_RECORD_SZ + REKEY_BLOCK_SZ);
+        if(file_read_at(journal, at, record, REKEY_RECORD_SZ) != 0) {
+            continue;
+        }
+        uint64_t rec_seq = get_uint64(record);
+        uint64_t offset  = get_uint64(record + 8);
+        uint32_t len     = get_uint32(record + 16);
+        if(rec_seq % 2 != (uint64_t)slot || len > REKEY_BLOCK_SZ || offset > pack_sz || len > pack_sz - offset) {
+            continue;
+        }
+        if(file_read_at(journal, at + REKEY_RECORD_SZ, record + REKEY_RECORD_SZ, len) != 0) {
+            continue;
+        }
+        if(get_uint64(record + 20) != fnv1a(fnv1a(FNV_BASIS, record, 20), record + REKEY_RECORD_SZ, len)) {
+            continue;
+        }
+        if(found < 0 || rec_seq > last) {
+            found = slot;
+            last  = rec_seq;
+        }
+    }
+    *pos = 0;
+    *seq = 0;
+    if(found < 0) {
+        // Cut off writing the first record, nothing in the pack changed.
+        return 0;
+    }
+    uint64_t at = header_sz + found * (uint64_t)(REKEY_RECORD_SZ + REKEY_BLOCK_SZ);
+    if(file_read_at(journal, at, record, REKEY_RECORD_SZ) != 0) {
+        return -1;
+    }
+    uint32_t len = get_uint32(record + 16);
+    if(file_read_at(journal, at + REKEY_RECORD_SZ, record + REKEY_RECORD_SZ, len) != 0) {
+        return -1;
+    }
+    *pos = get_uint64(record + 8);
+    *seq = last + 1;
+    // Everything before this block has the new key and everything after it
+    // the old one, the block itself could be either or a mix.
+    if(file_write_at(pk, *pos, record + REKEY_RECORD_SZ, len) != 0 || !FlushFileBuffers(pk)) {
+        return -1;
+    }
+    return 0;
+}
+
+// Swaps the key of a pack. Since everything is just XORed with the key the
+// old and new key combined are a single pattern, so there is no need to
+// unpack anything and the pack is changed where it is.
+int rekey(char *src, Key *key, Key *new_key, int verbose) {
+    HANDLE        pk = CreateFileA(src, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if(pk == INVALID_HANDLE_VALUE || !GetFileSizeEx(pk, &size)) {
+        fprintf(stderr, "packer: fatal error: failed to open ‘%s’\n", src);
+        if(pk != INVALID_HANDLE_VALUE) {
+            CloseHandle(pk);
+        }
+        return -1;
+    }
+    size_t   src_len   = strlen(src);
+    char     journal_name[src_len + 7];
+    uint64_t pack_sz   = size.QuadPart;
+    size_t   header_sz = REKEY_HEADER_SZ + key->length + new_key->length;
+    uint8_t *header    = malloc_checked(header_sz);
+    uint8_t *record    = malloc_checked(REKEY_RECORD_SZ + (header_sz > REKEY_BLOCK_SZ ? header_sz : REKEY_BLOCK_SZ));
+    HANDLE   journal   = INVALID_HANDLE_VALUE;
+    uint64_t pos       = 0;
+    uint64_t seq       = 0;
+    int      resumed   = 0;
+    int      created   = 0;
+    int      ret       = 0;
+    snprintf(journal_name, src_len + 7, "%s.rekey", src);
+    rekey_header(header, key, new_key, pack_sz);
+    if(file_exists(journal_name)) {
+        journal = CreateFileA(journal_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        ret = journal == INVALID_HANDLE_VALUE ? -1 : rekey_resume(pk, journal, header, header_sz, pack_sz, record, &pos, &seq);
+        if(ret < 0) {
+            fprintf(stderr, "packer: fatal error: ‘%s’ is from rekeying with other keys or another pack, finish that first.\n", journal_name);
+        }
+        resumed = ret == 0;
+    }
+    if(!resumed && ret >= 0) {
+        char buf[4];
+        ret = file_read_at(pk, 0, buf, 4);
+        key_seek(key, 0);
+        for(int i = 0; i < 4; i++) {
+            buf[i] ^= get_next_key_char(key);
+        }
+        if(ret != 0 || memcmp(buf, "pack", 4) != 0) {
+            fprintf(stderr, "packer: fatal error: Either the key is wrong or this is not a pack file.\n");
+            ret = -1;
+        }
+        if(ret == 0 && journal == INVALID_HANDLE_VALUE) {
+            journal = CreateFileA(journal_name, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        }
+        // The header has to be on disk before the pack changes at all.
+        if(ret == 0 && (journal == INVALID_HANDLE_VALUE || file_write_at(journal, 0, header, header_sz) != 0 || !FlushFileBuffers(journal))) {
+            fprintf(stderr, "packer: fatal error: failed to write ‘%s’\n", journal_name);
+            ret = -1;
+        }
+        created = ret == 0;
+    }
+    Pattern combined = { NULL, 0 };
+    Pattern second   = { NULL, 0 };
+    int     two_pass = 0;
+    if(ret == 0 && pattern_init(&combined, key, new_key)) {
+        // Keys are too long to expand to their lcm just do two passes.
+        pattern_init(&combined, key, NULL);
+        pattern_init(&second, new_key, NULL);
+        two_pass = 1;
+    }
+    if(ret == 0 && verbose) {
+        printf("Pattern period: %u bytes%s\n", combined.period, two_pass ? " (two passes)" : "");
+        if(resumed) {
+            printf("Carrying on from offset %llu.\n", (unsigned long long)pos);
+        }
+    }
+    uint64_t start = stats_now();
+    uint64_t from  = pos;
+    uint8_t *block = record + REKEY_RECORD_SZ;
+    while(ret == 0 && pos < pack_sz) {
+        size_t   len = pack_sz - pos < REKEY_BLOCK_SZ ? pack_sz - pos : REKEY_BLOCK_SZ;
+        uint64_t at  = header_sz + (seq % 2) * (uint64_t)(REKEY_RECORD_SZ + REKEY_BLOCK_SZ);
+        if(file_read_at(pk, pos, block, len) != 0) {
+            fprintf(stderr, "packer: fatal error: Failed reading ‘%s’ at offset %llu.\n", src, (unsigned long long)pos);
+            ret = -1;
+            break;
+        }
+        put_uint64(record, seq);
+        put_uint64(record + 8, pos);
+        put_uint32(record + 16, len);
+        put_uint64(record + 20, fnv1a(fnv1a(FNV_BASIS, record, 20), block, len));
+        if(file_write_at(journal, at, record, REKEY_RECORD_SZ + len) != 0 || !FlushFileBuffers(journal)) {
+            fprintf(stderr, "packer: fatal error: failed to write ‘%s’\n", journal_name);
+            ret = -1;
+            break;
+        }
+        pattern_apply(&combined, block, len, pos);
+        if(two_pass) {
+            pattern_apply(&second, block, len, pos);
+        }
+        // Has to reach the disk before the slot this block's record is in
+        // gets used again.
+        if(file_write_at(pk, pos, block, len) != 0 || !FlushFileBuffers(pk)) {
+            fprintf(stderr, "packer: fatal error: Failed writing ‘%s’ at offset %llu.\n", src, (unsigned long long)pos);
+            ret = -1;
+            break;
+        }
+        pos += len;
+        seq++;
+    }
+    stats_add_time(STAT_PAYLOAD, start);
+    stats_file_done(src, start, pos - from);
+    CloseHandle(pk);
+    if(journal != INVALID_HANDLE_VALUE) {
+        CloseHandle(journal);
+    }
+    if(ret == 0) {
+        DeleteFileA(journal_name);
+        if(verbose) {
+            printf("Rekeyed %llu bytes.\n", (unsigned long long)(pos - from));
+        }
+    } else if(resumed || seq > 0) {
+        fprintf(stderr, "packer: error: ‘%s’ is partly rekeyed, run the same rekey again to finish it.\n", src);
+    } else if(created) {
+        // Never got as far as changing the pack.
+        DeleteFileA(journal_name);
+    }
+    free(header);
+    free(record);
+    pattern_free(&combined);
+    if(two_pass) {
+        pattern_free(&second);
+    }
+    return ret;
+}
+
+int get_file_list(FileList *list, const char *base, const char *sub) {
+    size_t base_len    = strlen(base);
+    size_t sub_len     = strlen(sub);
+    // Handle empty strings
+    char   base_sep[2] = { '\0', '\0' };
+    char   sub_sep[2]  = { '\0', '\0' };
+    // Place seperator after path if longer than zero.
+    base_sep[0] = base_len > 0 ? '/' : '\0';
+    sub_sep[0]  = sub_len  > 0 ? '/' : '\0';
+    size_t byte_len = base_len + sub_len + 4; // max possible size
+    char   full_path[byte_len];
+    snprintf(full_path, byte_len, "%s%s%s%s*", base, base_sep, sub, sub_sep);
+    // Start search of path
+    WIN32_FIND_DATAA fdFile;
+    HANDLE find = FindFirstFileA(full_path, &fdFile);
+    if(find == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    do {
+        // Skip these more of like logical files.
+        if(strcmp(fdFile.cFileName, ".") == 0 || strcmp(fdFile.cFileName, "..") == 0) {
+            continue;
+        }
+        size_t name_sz = sub_len + strlen(fdFile.cFileName) + 2;
+        char name[name_sz];
+        snprintf(name, name_sz, "%s%s%s", sub, sub_sep, fdFile.cFileName);
+        // Enter Sub-directories
+        if(fdFile.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            get_file_list(list, base, name);
+            continue;
+        }
+        // Add file to list
+        FileNode *tmp = file_node_create_size_n(strlen(name));
+        tmp->size = fdFile.nFileSizeLow;
+        strcpy(tmp->path, name);
+        file_list_add(list, tmp);
+    } while(FindNextFileA(find, &fdFile));
+    FindClose(find);
+    return 1;
+}
+
+int pack(char *path, Key *key, int verbose) {
+    if(!path_is_dir(path)) {
+        fprintf(stderr, "packer: fatal error: Not a directory: ‘%s’\n", path);
+        return -1;
+    }
+    FileList list;
+    file_list_init(&list);
+    uint64_t start = stats_now();
+    get_file_list(&list, path, "");
+    stats_add_time(STAT_SCAN, start);
+    // Entries go in sorted, which keeps each directory's files together for unpack.
+    FileList *lists[1] = { &list };
+    PathIndex idx;
+    path_index_build(&idx, lists, 1);
+    file_list_free(&list);
+    int64_t  ignore = path_index_find(&idx, "__ignore_header__");
+    uint32_t count  = idx.count - (ignore >= 0);
+    if(verbose) {
+        printf("Files to pack: %u\n", count);
+    }
+    size_t path_len = strlen(path);
     char name[path_len + 10];
     for(unsigned i = 0; i < 100; i++) {
         if(i == 0) {
@@ -442,23 +1160,28 @@ int pack(char *path, Key *key, int verbose) {
         }
         if(i >= 99) {
             fprintf(stderr, "packer: fatal error: over a 100 name conflicts: ‘%s’\n", name);
+            path_index_free(&idx);
             return -1;
         }
     }
     // Calculate size of the first offset
-    size_t first_offset = 12 + 12 * list.count;
-    uint32_t ignore_sz  = 0;
-    FileNode *cur = list.head;
-    while(cur != NULL) {
-        first_offset += strlen(cur->path);
-        cur = cur->next;
+    char     entry_path[idx.max_len + 1];
+    size_t   first_offset = 12 + 12 * (size_t)count;
+    uint32_t ignore_sz    = 0;
+    PathIter it;
+    const PathEntry *cur;
+    path_iter_init(&it, &idx, 0, entry_path);
+    while((cur = path_iter_next(&it)) != NULL) {
+        if(it.pos - 1 != ignore) {
+            first_offset += strlen(entry_path);
+        }
     }
-    if(ignore != NULL) {
+    if(ignore >= 0) {
         if(verbose) {
             printf("Has a ‘__ignore_header__’\n");
         }
-        first_offset += ignore->size;
-        ignore_sz     = ignore->size;
+        ignore_sz     = idx.entries[ignore].size;
+        first_offset += ignore_sz;
     }
     // Begin File Creation
     if(verbose) {
@@ -466,43 +1189,1084 @@ int pack(char *path, Key *key, int verbose) {
     }
     FILE *pk       = fopen_check(name, "wb");
     fwrite_encoded("pack", 1, 4, pk, key);
-    fwrite_uint32_encoded(pk, list.count, key);
+    fwrite_uint32_encoded(pk, count, key);
     fwrite_uint32_encoded(pk, ignore_sz, key);
-    if(ignore != NULL) {
+    if(ignore >= 0) {
         char pth[path_len + 19];
         // Should probably handle the seperator like I do in get_file_list.
         snprintf(pth, path_len + 19, "%s/__ignore_header__", path);
         FILE *tmp = fopen_check(pth, "rb");
         fcopy_encoded(pk, tmp, key);
         fclose(tmp);
-        free(ignore);
     }
     // Write file list
-    cur = list.head;
+    start = stats_now();
     uint32_t cur_offset = first_offset;
-    while(cur != NULL) {
-        fwrite_uint32_encoded(pk, strlen(cur->path), key);
-        fwrite_uint32_encoded(pk, cur->size, key);
-        fwrite_uint32_encoded(pk, cur_offset, key);
-        fwrite_encoded(cur->path, 1, strlen(cur->path), pk, key);
-        cur_offset += cur->size;
-        cur = cur->next;
+    path_iter_init(&it, &idx, 0, entry_path);
+    while((cur = path_iter_next(&it)) != NULL) {
+        if(it.pos - 1 != ignore) {
+            fwrite_index_entry(pk, entry_path, cur->size, cur_offset, key);
+            cur_offset += cur->size;
+        }
     }
+    stats_add_time(STAT_INDEX_ENCODE, start);
     // Write Files
-    cur = list.head;
-    while(cur != NULL) {
+    path_iter_init(&it, &idx, 0, entry_path);
+    while((cur = path_iter_next(&it)) != NULL) {
+        if(it.pos - 1 == ignore) {
+            continue;
+        }
         if(verbose) {
-            printf("Adding: %s\n", cur->path);
+            printf("Adding: %s\n", entry_path);
         }
-        char pth[path_len + strlen(cur->path) + 2];
+        char pth[path_len + strlen(entry_path) + 2];
         // Should probably handle the seperator like I do in get_file_list.
-        snprintf(pth, path_len + strlen(cur->path) + 2, "%s/%s", path, cur->path);
+        snprintf(pth, path_len + strlen(entry_path) + 2, "%s/%s", path, entry_path);
+        start = stats_now();
         FILE *tmp = fopen_check(pth, "rb");
-        fcopy_encoded(pk, tmp, key);
+        int wrote = fcopy_encoded(pk, tmp, key);
         fclose(tmp);
-        cur = cur->next;
+        stats_add_time(STAT_PAYLOAD, start);
+        stats_file_done(entry_path, start, wrote);
     }
     fclose(pk);
-    file_list_free(&list);
+    path_index_free(&idx);
+    return 0;
+}
+
+
+typedef struct PackSource {
+    FILE      *fp;
+    FileList  list;
+    PathIndex idx;
+    PackHeader hdr;
+} PackSource;
+
+// Reads the index into list, or into idx when indexed is set.
+int pack_source_open(PackSource *src, char *path, Key *key, int indexed) {
+    file_list_init(&src->list);
+    memset(&src->idx, 0, sizeof(PathIndex));
+    src->fp = fopen_check(path, "rb");
+    if(pack_read_header(src->fp, key, &src->hdr)) {
+        return -1;
+    }
+    if(fseek(src->fp, src->hdr.ignore_len, SEEK_CUR) != 0) {
+        fprintf(stderr, "packer: fatal error: Too small to be a pack file.\n");
+        return -1;
+    }
+    if(indexed) {
+        return pack_read_path_index(src->fp, key, &src->hdr, &src->idx);
+    }
+    return pack_read_index(src->fp, key, &src->hdr, &src->list);
+}
+
+void pack_source_close(PackSource *src) {
+    file_list_free(&src->list);
+    path_index_free(&src->idx);
+    if(src->fp != NULL) {
+        fclose(src->fp);
+        src->fp = NULL;
+    }
+}
+
+// Writes a new pack made out of the listed entries of each source. Only the
+// index gets encoded again, payloads are moved in bulk from their sources.
+int pack_write_from(char *name, Key *key, PackSource *srcs, int n, PackSource *ignore, int verbose) {
+    Pattern key_pat;
+    pattern_init(&key_pat, key, NULL);
+    uint32_t ignore_len = ignore != NULL ? ignore->hdr.ignore_len : 0;
+    uint64_t offset     = 12 + (uint64_t)ignore_len;
+    uint32_t count      = 0;
+    for(int i = 0; i < n; i++) {
+        for(FileNode *cur = srcs[i].list.head; cur != NULL; cur = cur->next) {
+            offset += 12 + strlen(cur->path);
+            count++;
+        }
+    }
+    uint64_t first_offset = offset;
+    for(int i = 0; i < n; i++) {
+        for(FileNode *cur = srcs[i].list.head; cur != NULL; cur = cur->next) {
+            offset += cur->size;
+        }
+    }
+    if(offset > UINT32_MAX) {
+        fprintf(stderr, "packer: fatal error: ‘%s’ would be too large for a pack file.\n", name);
+        pattern_free(&key_pat);
+        return -1;
+    }
+    if(verbose) {
+        printf("Creating pack file ‘%s’ with %u files\n", name, count);
+    }
+    FILE *pk = fopen_check(name, "wb");
+    key_seek(key, 0);
+    fwrite_encoded("pack", 1, 4, pk, key);
+    fwrite_uint32_encoded(pk, count, key);
+    fwrite_uint32_encoded(pk, ignore_len, key);
+    // Ignore header sits at the same offset in every pack so never needs re-phasing.
+    if(ignore_len > 0 && fcopy_n_rephase(pk, 12, ignore->fp, 12, &key_pat, ignore_len) != (int)ignore_len) {
+        fprintf(stderr, "packer: fatal error: Failed to copy the ignore header.\n");
+        fclose(pk);
+        pattern_free(&key_pat);
+        return -1;
+    }
+    key_seek(key, 12 + (uint64_t)ignore_len);
+    uint64_t start = stats_now();
+    offset = first_offset;
+    for(int i = 0; i < n; i++) {
+        for(FileNode *cur = srcs[i].list.head; cur != NULL; cur = cur->next) {
+            fwrite_index_entry(pk, cur->path, cur->size, offset, key);
+            offset += cur->size;
+        }
+    }
+    stats_add_time(STAT_INDEX_ENCODE, start);
+    int ret = 0;
+    offset  = first_offset;
+    for(int i = 0; i < n && ret == 0; i++) {
+        for(FileNode *cur = srcs[i].list.head; cur != NULL; cur = cur->next) {
+            if(verbose) {
+                printf("Adding: %s\n", cur->path);
+            }
+            start = stats_now();
+            if(fcopy_n_rephase(pk, offset, srcs[i].fp, cur->offset, &key_pat, cur->size) != (int)cur->size) {
+                fprintf(stderr, "packer: fatal error: Failed to copy all of ‘%s’.\n", cur->path);
+                ret = -1;
+                break;
+            }
+            stats_add_time(STAT_PAYLOAD, start);
+            stats_file_done(cur->path, start, cur->size);
+            offset += cur->size;
+        }
+    }
+    fclose(pk);
+    pattern_free(&key_pat);
+    return ret;
+}
+
+int merge(char *dest, char **paths, int n, Key *key, int verbose) {
+    if(file_exists(dest)) {
+        fprintf(stderr, "packer: fatal error: ‘%s’ already exists.\n", dest);
+        return -1;
+    }
+    PackSource srcs[n];
+    PackSource *ignore = NULL;
+    int ret = 0;
+    for(int i = 0; i < n; i++) {
+        srcs[i].fp = NULL;
+        file_list_init(&srcs[i].list);
+        memset(&srcs[i].idx, 0, sizeof(PathIndex));
+    }
+    for(int i = 0; i < n; i++) {
+        if(verbose) {
+            printf("Reading index of ‘%s’\n", paths[i]);
+        }
+        if(pack_source_open(&srcs[i], paths[i], key, 0)) {
+            for(int j = 0; j <= i; j++) {
+                pack_source_close(&srcs[j]);
+            }
+            return -1;
+        }
+        if(ignore == NULL && srcs[i].hdr.ignore_len > 0) {
+            ignore = &srcs[i];
+        }
+    }
+    // Later packs win when the same path shows up more than once, the index
+    // only keeps the last so anything it does not point at gets dropped.
+    FileList *lists[n];
+    for(int i = 0; i < n; i++) {
+        lists[i] = &srcs[i].list;
+    }
+    PathIndex idx;
+    path_index_build(&idx, lists, n);
+    if(verbose) {
+        printf("Path index: %u files in %zu bytes\n", idx.count, path_index_memory(&idx));
+    }
+    uint32_t id = 0;
+    for(int i = 0; i < n; i++) {
+        FileNode *cur = srcs[i].list.head;
+        file_list_init(&srcs[i].list);
+        while(cur != NULL) {
+            FileNode *next = cur->next;
+            cur->next = NULL;
+            if(idx.entries[path_index_find(&idx, cur->path)].id == id) {
+                file_list_add(&srcs[i].list, cur);
+            } else {
+                if(verbose) {
+                    printf("Replacing ‘%s’ from ‘%s’\n", cur->path, paths[i]);
+                }
+                free(cur);
+            }
+            cur = next;
+            id++;
+        }
+    }
+    path_index_free(&idx);
+    ret = pack_write_from(dest, key, srcs, n, ignore, verbose);
+    for(int i = 0; i < n; i++) {
+        pack_source_close(&srcs[i]);
+    }
+    return ret;
+}
+
+// Length of the first path component, 0 when the path has no directory.
+size_t path_top_dir_len(const char *path) {
+    for(size_t i = 0; path[i] != '\0'; i++) {
+        if(path[i] == '/' || path[i] == '\\') {
+            return i;
+        }
+    }
+    return 0;
+}
+
+typedef struct SplitGroup {
+    char      *name;
+    size_t     name_len;
+    PackSource pk;
+} SplitGroup;
+
+SplitGroup* split_group_get(SplitGroup **groups, unsigned *group_cnt, PackSource *whole, const char *name, size_t name_len) {
+    for(unsigned g = 0; g < *group_cnt; g++) {
+        if((*groups)[g].name_len == name_len && memcmp((*groups)[g].name, name, name_len) == 0) {
+            return &(*groups)[g];
+        }
+    }
+    SplitGroup *tmp = realloc(*groups, sizeof(SplitGroup) * (*group_cnt + 1));
+    if(tmp == NULL) {
+        fprintf(stderr, "packer: fatal error: failed to allocate memory.\n");
+        exit(-1);
+    }
+    *groups = tmp;
+    SplitGroup *grp = &tmp[(*group_cnt)++];
+    grp->name     = malloc_checked(name_len + 1);
+    grp->name_len = name_len;
+    memcpy(grp->name, name, name_len);
+    grp->pk.fp  = whole->fp;
+    grp->pk.hdr = whole->hdr;
+    file_list_init(&grp->pk.list);
+    memset(&grp->pk.idx, 0, sizeof(PathIndex));
+    return grp;
+}
+
+void split_group_add(SplitGroup *grp, char *sub, const PathEntry *entry) {
+    FileNode *node = file_node_create(sub);
+    strcpy(node->path, sub);
+    node->offset = entry->offset;
+    node->size   = entry->size;
+    file_list_add(&grp->pk.list, node);
+}
+
+// Breaks a pack up into a pack per top level directory. The packs go where
+// unpack would put that directory, so unpacking one gives that part of the
+// tree. Files not in any directory, and the ignore header when there is one,
+// go in ‘__root__.pack’. It unpacks to ‘<base>/__root__/’ and its contents
+// belong directly in ‘<base>’.
+int split(char *src, Key *key, int verbose) {
+    PackSource whole;
+    whole.fp = NULL;
+    memset(&whole.idx, 0, sizeof(PathIndex));
+    if(pack_source_open(&whole, src, key, 1)) {
+        pack_source_close(&whole);
+        return -1;
+    }
+    size_t base_sz = strlen(src) + 1;
+    char   base[base_sz];
+    memcpy(base, src, base_sz);
+    dir_remove_extension(base);
+    if(dir_create_recursive(base)) {
+        fprintf(stderr, "packer: fatal error: Failed to create directory.\n");
+        pack_source_close(&whole);
+        return -1;
+    }
+    const PathIndex *idx = &whole.idx;
+    SplitGroup *groups    = NULL;
+    unsigned    group_cnt = 0;
+    int         ret       = 0;
+    char        path[idx->max_len + 1];
+    PathIter    it;
+    const PathEntry *entry;
+    path_iter_init(&it, idx, 0, path);
+    while((entry = path_iter_next(&it)) != NULL) {
+        size_t dir_len = path_top_dir_len(path);
+        if(dir_len == 0) {
+            split_group_add(split_group_get(&groups, &group_cnt, &whole, "__root__", 8), path, entry);
+            continue;
+        }
+        if(dir_len == 8 && memcmp(path, "__root__", 8) == 0) {
+            fprintf(stderr, "packer: fatal error: ‘__root__’ is reserved for files not in a directory.\n");
+            ret = -1;
+            break;
+        }
+        // Everything under this directory is one run in the index.
+        SplitGroup *grp = split_group_get(&groups, &group_cnt, &whole, path, dir_len);
+        char     prefix[dir_len + 2];
+        uint32_t first, last;
+        memcpy(prefix, path, dir_len + 1);
+        prefix[dir_len + 1] = '\0';
+        path_index_prefix(idx, prefix, &first, &last);
+        path_iter_init(&it, idx, first, path);
+        while(it.pos < last && (entry = path_iter_next(&it)) != NULL) {
+            split_group_add(grp, path + dir_len + 1, entry);
+        }
+    }
+    // The root part gets written even when the ignore header is all it has.
+    if(ret == 0 && whole.hdr.ignore_len > 0) {
+        split_group_get(&groups, &group_cnt, &whole, "__root__", 8);
+    }
+    for(unsigned g = 0; g < group_cnt; g++) {
+        size_t name_sz = base_sz + groups[g].name_len + 6;
+        char   name[name_sz];
+        snprintf(name, name_sz, "%s/%s.pack", base, groups[g].name);
+        // Only the root part carries the ignore header, like the original.
+        int         root   = groups[g].name_len == 8 && memcmp(groups[g].name, "__root__", 8) == 0;
+        PackSource *ignore = root ? &whole : NULL;
+        if(ret == 0 && file_exists(name)) {
+            fprintf(stderr, "packer: fatal error: ‘%s’ already exists.\n", name);
+            ret = -1;
+        }
+        if(ret == 0) {
+            ret = pack_write_from(name, key, &groups[g].pk, 1, ignore, verbose);
+        }
+        file_list_free(&groups[g].pk.list);
+        free(groups[g].name);
+    }
+    free(groups);
+    pack_source_close(&whole);
+    return ret;
+}
+
+// Finds needle in hay starting at from, returns n when there is no match.
+// Compares the first and last byte of the needle 16 positions at a time and
+// only does a full compare on the positions where both line up.
+size_t find_bytes(const uint8_t *hay, size_t n, const uint8_t *needle, size_t m, size_t from) {
+    if(m == 0 || n < m) {
+        return n;
+    }
+    size_t i = from;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last  = _mm_set1_epi8(needle[m - 1]);
+    for(; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(hay + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while(mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if(memcmp(hay + i + bit, needle, m) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for(; i + m <= n; i++) {
+        if(hay[i] == needle[0] && memcmp(hay + i, needle, m) == 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+// Large entries get broken up so one big file does not hold up a thread.
+#define SEARCH_UNIT_SZ (1024 * 1024)
+
+typedef struct SearchUnit {
+    const PathEntry *entry;
+    uint32_t  pos;     // Position of the entry in the index
+    uint32_t  start;   // Offset into the entry
+    uint32_t  len;     // Matches have to start in [start, start + len)
+    uint32_t *hits;    // Pairs of entry offset and needle index
+    uint32_t  hit_cnt;
+    uint32_t  hit_cap;
+} SearchUnit;
+
+// Distinct first bytes the SSE2 scan compares against at once, past this the
+// scan goes a byte at a time through heads.
+#define SEARCH_MAX_FIRSTS 16
+
+typedef struct SearchJob {
+    const uint8_t *map;
+    Pattern        key_pat;
+    char         **needles;
+    size_t        *needle_lens;
+    int            needle_cnt;
+    size_t         max_len;
+    int            heads[256]; // First needle starting with a byte, -1 for none
+    int           *chain;      // Next needle with the same first byte
+    uint8_t        firsts[256];
+    int            first_cnt;
+    SearchUnit    *units;
+    LONG           unit_cnt;
+    volatile LONG  next;
+} SearchJob;
+
+void search_add_hit(SearchUnit *unit, uint32_t offset, uint32_t needle) {
+    if(unit->hit_cnt == unit->hit_cap) {
+        unit->hit_cap = unit->hit_cap ? unit->hit_cap * 2 : 8;
+        uint32_t *tmp = realloc(unit->hits, sizeof(uint32_t) * 2 * unit->hit_cap);
+        if(tmp == NULL) {
+            fprintf(stderr, "packer: fatal error: failed to allocate memory.\n");
+            exit(-1);
+        }
+        unit->hits = tmp;
+    }
+    unit->hits[unit->hit_cnt * 2]     = offset;
+    unit->hits[unit->hit_cnt * 2 + 1] = needle;
+    unit->hit_cnt++;
+}
+
+// Links up the needles by first byte so every needle can be looked for in a
+// single pass over a unit.
+void search_needles_init(SearchJob *job) {
+    job->chain     = malloc_checked(sizeof(int) * job->needle_cnt);
+    job->first_cnt = 0;
+    for(int b = 0; b < 256; b++) {
+        job->heads[b] = -1;
+    }
+    // Backwards so each chain is in needle order.
+    for(int n = job->needle_cnt - 1; n >= 0; n--) {
+        uint8_t first = job->needles[n][0];
+        if(job->heads[first] < 0) {
+            job->firsts[job->first_cnt++] = first;
+        }
+        job->chain[n]     = job->heads[first];
+        job->heads[first] = n;
+    }
+}
+
+// Checks each needle starting with buf[at] against buf.
+void search_check_at(SearchJob *job, SearchUnit *unit, const uint8_t *buf, size_t avail, size_t at) {
+    for(int n = job->heads[buf[at]]; n >= 0; n = job->chain[n]) {
+        size_t m = job->needle_lens[n];
+        if(at + m <= avail && memcmp(buf + at, job->needles[n], m) == 0) {
+            search_add_hit(unit, unit->start + at, n);
+        }
+    }
+}
+
+// Finds every needle in one pass, so the hits come out in offset order.
+void search_unit_many(SearchJob *job, SearchUnit *unit, const uint8_t *buf, size_t avail) {
+    size_t limit = unit->len < avail ? unit->len : avail;
+    size_t i     = 0;
+#ifdef __SSE2__
+    if(job->first_cnt <= SEARCH_MAX_FIRSTS) {
+        __m128i firsts[SEARCH_MAX_FIRSTS];
+        for(int f = 0; f < job->first_cnt; f++) {
+            firsts[f] = _mm_set1_epi8(job->firsts[f]);
+        }
+        for(; i + 16 <= limit; i += 16) {
+            __m128i a   = _mm_loadu_si128((const __m128i*)(buf + i));
+            __m128i any = _mm_setzero_si128();
+            for(int f = 0; f < job->first_cnt; f++) {
+                any = _mm_or_si128(any, _mm_cmpeq_epi8(a, firsts[f]));
+            }
+            unsigned mask = _mm_movemask_epi8(any);
+            while(mask != 0) {
+                search_check_at(job, unit, buf, avail, i + __builtin_ctz(mask));
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+    for(; i < limit; i++) {
+        if(job->heads[buf[i]] >= 0) {
+            search_check_at(job, unit, buf, avail, i);
+        }
+    }
+}
+
+DWORD WINAPI search_worker(LPVOID arg) {
+    SearchJob *job = arg;
+    uint8_t   *buf = malloc_checked(SEARCH_UNIT_SZ + job->max_len);
+    while(1) {
+        LONG idx = InterlockedIncrement(&job->next) - 1;
+        if(idx >= job->unit_cnt) {
+            break;
+        }
+        SearchUnit *unit = &job->units[idx];
+        // Read a little past the end so matches crossing into the next unit are found.
+        size_t avail = unit->entry->size - unit->start;
+        if(avail > unit->len + job->max_len - 1) {
+            avail = unit->len + job->max_len - 1;
+        }
+        uint64_t pos = (uint64_t)unit->entry->offset + unit->start;
+        memcpy(buf, job->map + pos, avail);
+        pattern_apply(&job->key_pat, buf, avail, pos);
+        if(job->needle_cnt > 1) {
+            search_unit_many(job, unit, buf, avail);
+            continue;
+        }
+        const uint8_t *needle = (const uint8_t*)job->needles[0];
+        size_t at = find_bytes(buf, avail, needle, job->needle_lens[0], 0);
+        while(at < unit->len && at < avail) {
+            search_add_hit(unit, unit->start + at, 0);
+            at = find_bytes(buf, avail, needle, job->needle_lens[0], at + 1);
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+// Searches every entry of a pack for the given strings without unpacking it.
+// The pack is mapped and each unit is decoded into a thread's own buffer.
+int search(char *src, char **needles, int n, Key *key, int verbose) {
+    PackSource pk;
+    pk.fp = NULL;
+    memset(&pk.idx, 0, sizeof(PathIndex));
+    if(pack_source_open(&pk, src, key, 1)) {
+        pack_source_close(&pk);
+        return -1;
+    }
+    HANDLE file = CreateFileA(src, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER file_sz;
+    if(file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_sz)) {
+        fprintf(stderr, "packer: fatal error: failed to open ‘%s’\n", src);
+        pack_source_close(&pk);
+        return -1;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    const uint8_t *map = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if(map == NULL) {
+        fprintf(stderr, "packer: fatal error: failed to map ‘%s’\n", src);
+        if(mapping != NULL) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        pack_source_close(&pk);
+        return -1;
+    }
+    SearchJob job;
+    size_t    needle_lens[n];
+    job.map        = map;
+    job.needles    = needles;
+    job.needle_lens = needle_lens;
+    job.needle_cnt = n;
+    job.max_len    = 1;
+    job.next       = 0;
+    job.unit_cnt   = 0;
+    pattern_init(&job.key_pat, key, NULL);
+    for(int i = 0; i < n; i++) {
+        needle_lens[i] = strlen(needles[i]);
+        if(needle_lens[i] > job.max_len) {
+            job.max_len = needle_lens[i];
+        }
+    }
+    search_needles_init(&job);
+    size_t   unit_cap = 0;
+    char     path[pk.idx.max_len + 1];
+    PathIter it;
+    const PathEntry *cur;
+    path_iter_init(&it, &pk.idx, 0, path);
+    while((cur = path_iter_next(&it)) != NULL) {
+        if((uint64_t)cur->offset + cur->size > (uint64_t)file_sz.QuadPart) {
+            fprintf(stderr, "packer: error: ‘%s’ goes past the end of the pack, skipping it.\n", path);
+            continue;
+        }
+        unit_cap += (cur->size + SEARCH_UNIT_SZ - 1) / SEARCH_UNIT_SZ;
+    }
+    job.units = malloc_checked(sizeof(SearchUnit) * (unit_cap + 1));
+    for(uint32_t i = 0; i < pk.idx.count; i++) {
+        cur = &pk.idx.entries[i];
+        if((uint64_t)cur->offset + cur->size > (uint64_t)file_sz.QuadPart) {
+            continue;
+        }
+        for(uint32_t start = 0; start < cur->size; start += SEARCH_UNIT_SZ) {
+            SearchUnit *unit = &job.units[job.unit_cnt++];
+            unit->entry = cur;
+            unit->pos   = i;
+            unit->start = start;
+            unit->len   = cur->size - start < SEARCH_UNIT_SZ ? cur->size - start : SEARCH_UNIT_SZ;
+        }
+    }
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    unsigned thread_cnt = info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+    if(verbose) {
+        printf("Searching %u files in %ld units on %u threads.\n", pk.idx.count, (long)job.unit_cnt, thread_cnt);
+    }
+    uint64_t start = stats_now();
+    HANDLE threads[thread_cnt];
+    for(unsigned i = 0; i < thread_cnt; i++) {
+        threads[i] = CreateThread(NULL, 0, search_worker, &job, 0, NULL);
+        if(threads[i] == NULL) {
+            // Whatever threads did start will still get through all the units.
+            thread_cnt = i;
+            break;
+        }
+    }
+    if(thread_cnt == 0) {
+        search_worker(&job);
+    }
+    for(unsigned i = 0; i < thread_cnt; i++) {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    stats_add_time(STAT_PAYLOAD, start);
+    // Report in path order so the output does not depend on thread timing.
+    unsigned matches = 0;
+    path_iter_init(&it, &pk.idx, 0, path);
+    for(LONG i = 0; i < job.unit_cnt; i++) {
+        SearchUnit *unit = &job.units[i];
+        // Units are in index order so the paths only ever move forward.
+        while(it.pos <= unit->pos) {
+            path_iter_next(&it);
+        }
+        stats.bytes += unit->len;
+        stats.files += unit->start == 0;
+        for(uint32_t h = 0; h < unit->hit_cnt; h++) {
+            uint32_t offset = unit->hits[h * 2];
+            uint32_t needle = unit->hits[h * 2 + 1];
+            if(n > 1) {
+                printf("%s:%u:%s\n", path, offset, needles[needle]);
+            } else {
+                printf("%s:%u\n", path, offset);
+            }
+            matches++;
+        }
+        free(unit->hits);
+    }
+    if(verbose) {
+        printf("Found %u matches.\n", matches);
+    }
+    free(job.units);
+    free(job.chain);
+    pattern_free(&job.key_pat);
+    UnmapViewOfFile(map);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    pack_source_close(&pk);
+    return matches > 0 ? 0 : 1;
+}
+
+// Changes are applied once nothing has happened for the debounce window, but
+// never later than the max stale time after the first pending change.
+#define WATCH_DEBOUNCE_MS  250
+#define WATCH_MAX_STALE_MS 750
+#define WATCH_POLL_MS      50
+// Offset marking an entry that has to be read from the directory.
+#define WATCH_FRESH        UINT32_MAX
+
+typedef struct WatchChange {
+    struct WatchChange *next;
+    DWORD action;
+    char  path[];
+} WatchChange;
+
+typedef struct WatchQueue {
+    CRITICAL_SECTION lock;
+    HANDLE           dir;
+    WatchChange     *head;
+    WatchChange     *tail;
+    int              overflow;
+    ULONGLONG        first;
+    ULONGLONG        last;
+} WatchQueue;
+
+void watch_queue_push(WatchQueue *queue, const WCHAR *name, DWORD name_len, DWORD action) {
+    int chars = name_len / sizeof(WCHAR);
+    WatchChange *change = malloc_checked(sizeof(WatchChange) + chars * 4 + 1);
+    int len = WideCharToMultiByte(CP_ACP, 0, name, chars, change->path, chars * 4, NULL, NULL);
+    change->path[len] = '\0';
+    change->action    = action;
+    change->next      = NULL;
+    for(int i = 0; i < len; i++) {
+        if(change->path[i] == '\\') {
+            change->path[i] = '/';
+        }
+    }
+    ULONGLONG now = GetTickCount64();
+    EnterCriticalSection(&queue->lock);
+    if(queue->head == NULL) {
+        queue->head  = change;
+        queue->first = now;
+    } else {
+        queue->tail->next = change;
+    }
+    queue->tail = change;
+    queue->last = now;
+    LeaveCriticalSection(&queue->lock);
+}
+
+DWORD WINAPI watch_listener(LPVOID arg) {
+    WatchQueue *queue = arg;
+    // DWORD aligned as ReadDirectoryChangesW requires.
+    DWORD buffer[4096 * 4];
+    DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+                   FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE;
+    while(1) {
+        DWORD bytes = 0;
+        if(!ReadDirectoryChangesW(queue->dir, buffer, sizeof(buffer), TRUE, filter, &bytes, NULL, NULL)) {
+            fprintf(stderr, "packer: error: stopped getting directory changes.\n");
+            return 1;
+        }
+        if(bytes == 0) {
+            // Too much happened at once to fit in the buffer.
+            EnterCriticalSection(&queue->lock);
+            queue->overflow = 1;
+            queue->last     = GetTickCount64();
+            if(queue->head == NULL) {
+                queue->first = queue->last;
+            }
+            LeaveCriticalSection(&queue->lock);
+            continue;
+        }
+        uint8_t *cur = (uint8_t*)buffer;
+        while(1) {
+            FILE_NOTIFY_INFORMATION *info = (FILE_NOTIFY_INFORMATION*)cur;
+            watch_queue_push(queue, info->FileName, info->FileNameLength, info->Action);
+            if(info->NextEntryOffset == 0) {
+                break;
+            }
+            cur += info->NextEntryOffset;
+        }
+    }
+    return 0;
+}
+
+// Whether path, or a directory it is in, is one of the paths in idx. Only
+// the directories are checked when self is not set.
+int watch_covered(const PathIndex *idx, const char *path, int self) {
+    size_t len = strlen(path);
+    char   dir[len + 1];
+    memcpy(dir, path, len + 1);
+    for(size_t i = 0; i < len; i++) {
+        if(dir[i] == '/') {
+            dir[i] = '\0';
+            int found = path_index_find(idx, dir) >= 0;
+            dir[i] = '/';
+            if(found) {
+                return 1;
+            }
+        }
+    }
+    return self && path_index_find(idx, path) >= 0;
+}
+
+// Drops every changed path and anything under them in one pass over the list.
+int watch_remove(FileList *list, const PathIndex *changed) {
+    int       removed = 0;
+    FileNode *cur     = list->head;
+    file_list_init(list);
+    while(cur != NULL) {
+        FileNode *next = cur->next;
+        cur->next = NULL;
+        if(watch_covered(changed, cur->path, 1)) {
+            free(cur);
+            removed++;
+        } else {
+            file_list_add(list, cur);
+        }
+        cur = next;
+    }
+    return removed;
+}
+
+// Adds path, or everything under it, as entries to read from the directory.
+int watch_add(FileList *list, const char *base, const char *path) {
+    size_t full_sz = strlen(base) + strlen(path) + 2;
+    char   full[full_sz];
+    snprintf(full, full_sz, "%s/%s", base, path);
+    DWORD attrib = GetFileAttributesA(full);
+    if(attrib == INVALID_FILE_ATTRIBUTES) {
+        return 0;
+    }
+    FileNode *tail = list->tail;
+    if(attrib & FILE_ATTRIBUTE_DIRECTORY) {
+        get_file_list(list, base, path);
+    } else {
+        WIN32_FIND_DATAA data;
+        HANDLE find = FindFirstFileA(full, &data);
+        if(find == INVALID_HANDLE_VALUE) {
+            return 0;
+        }
+        FindClose(find);
+        FileNode *node = file_node_create_size_n(strlen(path));
+        strcpy(node->path, path);
+        node->size = data.nFileSizeLow;
+        file_list_add(list, node);
+    }
+    int added = 0;
+    for(FileNode *cur = tail->next; cur != NULL; cur = cur->next) {
+        cur->offset = WATCH_FRESH;
+        added++;
+    }
+    return added;
+}
+
+// Drops everything that changed and reads back whatever of it still exists.
+// Doing the whole batch at once means each entry is only looked at once no
+// matter how many changes there were.
+int watch_apply(FileList *list, const char *base, WatchChange *changes) {
+    FileList paths;
+    file_list_init(&paths);
+    while(changes != NULL) {
+        WatchChange *next = changes->next;
+        int skip = 0;
+        if(changes->action == FILE_ACTION_MODIFIED) {
+            // A directory is modified whenever anything in it is, the entry
+            // for the file itself covers that.
+            size_t full_sz = strlen(base) + strlen(changes->path) + 2;
+            char   full[full_sz];
+            snprintf(full, full_sz, "%s/%s", base, changes->path);
+            DWORD attrib = GetFileAttributesA(full);
+            skip = attrib != INVALID_FILE_ATTRIBUTES && (attrib & FILE_ATTRIBUTE_DIRECTORY);
+        }
+        if(!skip) {
+            FileNode *node = file_node_create(changes->path);
+            strcpy(node->path, changes->path);
+            file_list_add(&paths, node);
+        }
+        free(changes);
+        changes = next;
+    }
+    if(paths.count == 0) {
+        return 0;
+    }
+    FileList *lists[1] = { &paths };
+    PathIndex changed;
+    path_index_build(&changed, lists, 1);
+    file_list_free(&paths);
+    int touched = watch_remove(list, &changed);
+    // Anything under a directory that changed was picked up reading it.
+    char     path[changed.max_len + 1];
+    PathIter it;
+    path_iter_init(&it, &changed, 0, path);
+    while(path_iter_next(&it) != NULL) {
+        if(!watch_covered(&changed, path, 0)) {
+            touched += watch_add(list, base, path);
+        }
+    }
+    path_index_free(&changed);
+    return touched;
+}
+
+// Copies one entry to offset in the new pack, from the old pack when it has
+// not changed or from the directory when it has.
+void watch_copy_entry(FILE *pk, uint64_t offset, FileNode *node, const char *base, Key *key, Pattern *key_pat, FILE *old) {
+    uint64_t start = stats_now();
+    size_t   wrote = 0;
+    if(node->offset != WATCH_FRESH) {
+        wrote = fcopy_n_rephase(pk, offset, old, node->offset, key_pat, node->size);
+    } else {
+        size_t pth_sz = strlen(base) + strlen(node->path) + 2;
+        char   pth[pth_sz];
+        snprintf(pth, pth_sz, "%s/%s", base, node->path);
+        FILE *src = fopen(pth, "rb");
+        stats.fopens++;
+        if(src != NULL) {
+            key_seek(key, offset);
+            wrote = fcopy_n_encoded(pk, src, key, node->size);
+            fclose(src);
+        }
+    }
+    if(wrote < node->size) {
+        // Changed under us, pad it out so the offsets hold. The next change
+        // to it will get picked up.
+        fprintf(stderr, "packer: error: only got %u of %u bytes of ‘%s’\n", (unsigned)wrote, node->size, node->path);
+        key_seek(key, offset + wrote);
+        for(uint8_t zero = 0; wrote < node->size; wrote++) {
+            fwrite_encoded(&zero, 1, 1, pk, key);
+        }
+    }
+    stats_add_time(STAT_PAYLOAD, start);
+    stats_file_done(node->path, start, node->size);
+    node->offset = offset;
+}
+
+// The pack entries are copied forward from. When swapping in a new pack
+// fails the temporary file it was written to takes its place until the next
+// try, so tmp says which file fp is: 0 for the pack or 1 and 2 for the two
+// temporary names.
+typedef struct WatchPack {
+    FILE *fp;
+    int   tmp;
+} WatchPack;
+
+void watch_tmp_name(char *dest, size_t size, const char *name, int tmp) {
+    snprintf(dest, size, tmp == 1 ? "%s.tmp" : "%s.tmp2", name);
+}
+
+// Swaps temporary file tmp in for the pack, the file pk had open has to be
+// closed already. The entries point into the temporary file by now, so when
+// the swap fails it is the one to copy from until the next try.
+int watch_swap(const char *name, WatchPack *pk, int tmp) {
+    size_t name_len = strlen(name);
+    char   tmp_name[name_len + 6];
+    char   old_name[name_len + 6];
+    watch_tmp_name(tmp_name, name_len + 6, name, tmp);
+    int swapped = MoveFileExA(tmp_name, name, MOVEFILE_REPLACE_EXISTING);
+    if(pk->tmp != 0 && pk->tmp != tmp) {
+        // Whatever was copied from is out of date either way.
+        watch_tmp_name(old_name, name_len + 6, name, pk->tmp);
+        DeleteFileA(old_name);
+    }
+    if(!swapped) {
+        fprintf(stderr, "packer: error: failed to replace ‘%s’, trying again shortly.\n", name);
+        pk->fp  = fopen_check(tmp_name, "rb");
+        pk->tmp = tmp;
+        return 1;
+    }
+    pk->fp  = fopen_check(name, "rb");
+    pk->tmp = 0;
+    return 0;
+}
+
+// Writes the whole pack to a temporary file and swaps it in, so the pack on
+// disk is always complete. Entries that did not change are copied forward
+// from the current pack. Returns 0 once swapped in, 1 when the swap failed
+// and should be tried again and -1 when nothing was written.
+int watch_write(const char *base, const char *name, FileList *list, Key *key, Pattern *key_pat, WatchPack *cur_pk) {
+    size_t name_len = strlen(name);
+    char   tmp_name[name_len + 6];
+    // Never write over the file being copied from.
+    int    tmp = cur_pk->tmp == 1 ? 2 : 1;
+    watch_tmp_name(tmp_name, name_len + 6, name, tmp);
+    FileNode *ignore = NULL;
+    uint32_t  count  = 0;
+    uint64_t  offset = 12;
+    for(FileNode *cur = list->head; cur != NULL; cur = cur->next) {
+        if(ignore == NULL && strcmp(cur->path, "__ignore_header__") == 0) {
+            ignore  = cur;
+            offset += cur->size;
+            continue;
+        }
+        offset += 12 + strlen(cur->path);
+        count++;
+    }
+    uint64_t first_offset = offset;
+    for(FileNode *cur = list->head; cur != NULL; cur = cur->next) {
+        if(cur != ignore) {
+            offset += cur->size;
+        }
+    }
+    if(offset > UINT32_MAX) {
+        fprintf(stderr, "packer: error: ‘%s’ would be too large for a pack file, not updating it.\n", name);
+        return -1;
+    }
+    offset = first_offset;
+    FILE *old = cur_pk->fp;
+    FILE *pk  = fopen_check(tmp_name, "wb");
+    key_seek(key, 0);
+    fwrite_encoded("pack", 1, 4, pk, key);
+    fwrite_uint32_encoded(pk, count, key);
+    fwrite_uint32_encoded(pk, ignore != NULL ? ignore->size : 0, key);
+    if(ignore != NULL) {
+        watch_copy_entry(pk, 12, ignore, base, key, key_pat, old);
+    }
+    uint64_t start = stats_now();
+    key_seek(key, 12 + (uint64_t)(ignore != NULL ? ignore->size : 0));
+    for(FileNode *cur = list->head; cur != NULL; cur = cur->next) {
+        if(cur != ignore) {
+            fwrite_index_entry(pk, cur->path, cur->size, offset, key);
+            offset += cur->size;
+        }
+    }
+    stats_add_time(STAT_INDEX_ENCODE, start);
+    offset = first_offset;
+    for(FileNode *cur = list->head; cur != NULL; cur = cur->next) {
+        if(cur != ignore) {
+            watch_copy_entry(pk, offset, cur, base, key, key_pat, old);
+            offset += cur->size;
+        }
+    }
+    fclose(pk);
+    if(old != NULL) {
+        fclose(old);
+    }
+    return watch_swap(name, cur_pk, tmp);
+}
+
+// Packs the directory once then keeps the pack up to date with changes to it.
+int watch(char *path, Key *key, int verbose) {
+    if(!path_is_dir(path)) {
+        fprintf(stderr, "packer: fatal error: Not a directory: ‘%s’\n", path);
+        return -1;
+    }
+    size_t path_len = strlen(path);
+    char   name[path_len + 6];
+    snprintf(name, path_len + 6, "%s.pack", path);
+    WatchQueue queue;
+    memset(&queue, 0, sizeof(WatchQueue));
+    InitializeCriticalSection(&queue.lock);
+    // Start listening before the scan so nothing in between is missed.
+    queue.dir = CreateFileA(
+        path, FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL
+    );
+    if(queue.dir == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "packer: fatal error: failed to watch ‘%s’\n", path);
+        return -1;
+    }
+    HANDLE listener = CreateThread(NULL, 0, watch_listener, &queue, 0, NULL);
+    if(listener == NULL) {
+        fprintf(stderr, "packer: fatal error: failed to start watching ‘%s’\n", path);
+        return -1;
+    }
+    Pattern key_pat;
+    pattern_init(&key_pat, key, NULL);
+    FileList list;
+    file_list_init(&list);
+    uint64_t start = stats_now();
+    watch_add(&list, path, "");
+    stats_add_time(STAT_SCAN, start);
+    WatchPack pk   = { NULL, 0 };
+    int       retry = watch_write(path, name, &list, key, &key_pat, &pk);
+    if(retry < 0) {
+        return -1;
+    }
+    ULONGLONG tried = GetTickCount64();
+    if(verbose) {
+        printf("Packed %u files into ‘%s’, watching for changes.\n", list.count, name);
+        fflush(stdout);
+    }
+    while(1) {
+        Sleep(WATCH_POLL_MS);
+        ULONGLONG    now      = GetTickCount64();
+        WatchChange *changes  = NULL;
+        int          overflow = 0;
+        EnterCriticalSection(&queue.lock);
+        int pending = queue.head != NULL || queue.overflow;
+        if(pending && (now - queue.last >= WATCH_DEBOUNCE_MS || now - queue.first >= WATCH_MAX_STALE_MS)) {
+            changes  = queue.head;
+            overflow = queue.overflow;
+            queue.head     = NULL;
+            queue.tail     = NULL;
+            queue.overflow = 0;
+        } else {
+            pending = 0;
+        }
+        LeaveCriticalSection(&queue.lock);
+        if(!pending && retry > 0 && now - tried >= WATCH_DEBOUNCE_MS) {
+            // Nothing new, just try swapping in the pack already written.
+            fclose(pk.fp);
+            retry = watch_swap(name, &pk, pk.tmp);
+            tried = now;
+            continue;
+        }
+        if(!pending) {
+            continue;
+        }
+        start = stats_now();
+        int touched;
+        if(overflow) {
+            // Lost track of what changed, so everything gets read again.
+            fprintf(stderr, "packer: error: too many changes at once, rereading ‘%s’\n", path);
+            file_list_free(&list);
+            touched = watch_add(&list, path, "");
+            while(changes != NULL) {
+                WatchChange *next = changes->next;
+                free(changes);
+                changes = next;
+            }
+        } else {
+            touched = watch_apply(&list, path, changes);
+        }
+        stats_add_time(STAT_SCAN, start);
+        ULONGLONG began = GetTickCount64();
+        retry = watch_write(path, name, &list, key, &key_pat, &pk);
+        tried = GetTickCount64();
+        if(verbose && retry == 0) {
+            printf("Updated ‘%s’: %d entries touched, %u files, %llu ms\n", name, touched, list.count, (unsigned long long)(GetTickCount64() - began));
+            fflush(stdout);
+        }
+    }
     return 0;
 }
@@ -0,0 +1,351 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks PathIndex against a sorted array of the same paths. Random paths
+// with lots of shared prefixes, some holding 0x80 and 0xFF bytes, are split
+// over two FileLists with repeats so the last one has to win. Then find,
+// lower, prefix and the iterator are compared with a plain binary search or
+// scan of the array, and the builder has to give the same index. Doesn't use
+// any Windows calls so it runs anywhere.
+// make path-index-tests && ./path-index-tests [paths, 20000]
+// ./path-index-tests -memory [paths, 2000000] only reports how much memory
+// the index takes against the FileList it was built from.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "file-list.h"
+#include "path-index.h"
+
+// Bytes malloc adds to each FileNode, glibc and the mingw heap both use 16.
+#define MALLOC_OVERHEAD 16
+
+static int failures = 0;
+
+static uint64_t rng_state = 0x3c6ef372fe94f82b;
+
+// splitmix64, used to make up the paths.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+typedef struct RefPath {
+    char    *path;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t order; // Position over both lists taken one after the other.
+} RefPath;
+
+static int ref_cmp(const void *a, const void *b) {
+    const RefPath *x = a;
+    const RefPath *y = b;
+    int cmp = strcmp(x->path, y->path);
+    if(cmp != 0) {
+        return cmp;
+    }
+    return x->order < y->order ? -1 : 1;
+}
+
+// First spot in the sorted reference whose path is not less than key.
+static uint32_t ref_lower(const RefPath *ref, uint32_t count, const char *key) {
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(strcmp(ref[mid].path, key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// A few levels of directories picked from small sets so paths share long
+// prefixes, now and then a component is made of 0x80 or 0xFF bytes.
+static size_t make_path(char *path) {
+    static const char *names[] = { "data", "images", "sound", "a", "ab", "abc", "models", "z" };
+    size_t len   = 0;
+    int    depth = 1 + rng_next() % 4;
+    for(int d = 0; d < depth; d++) {
+        uint64_t r = rng_next();
+        switch(r % 8) {
+            case 0:
+                len += sprintf(path + len, "\xFF\xFF");
+                break;
+            case 1:
+                len += sprintf(path + len, "x\x80");
+                break;
+            default:
+                len += sprintf(path + len, "%s", names[(r >> 8) % 8]);
+                break;
+        }
+        path[len++] = '/';
+    }
+    len += sprintf(path + len, "f%u.bin", (unsigned)(rng_next() % 1000));
+    return len;
+}
+
+static FileNode* make_node(const char *path, uint32_t offset, uint32_t size) {
+    FileNode *node = file_node_create_size_n(strlen(path));
+    memcpy(node->path, path, strlen(path));
+    node->offset = offset;
+    node->size   = size;
+    return node;
+}
+
+// The index holds exactly the reference in order, checked with the iterator
+// from the start and from a spot in the middle of a block.
+static int check_iter(const PathIndex *idx, const RefPath *ref, uint32_t count) {
+    char           *buf = malloc(idx->max_len + 1);
+    PathIter        it;
+    const PathEntry *entry;
+    uint32_t        pos = 0;
+    int             ok  = idx->count == count;
+    path_iter_init(&it, idx, 0, buf);
+    while(ok && (entry = path_iter_next(&it)) != NULL) {
+        ok = pos < count && strcmp(it.path, ref[pos].path) == 0 &&
+             entry->offset == ref[pos].offset && entry->size == ref[pos].size;
+        pos++;
+    }
+    ok &= pos == count;
+    uint32_t start = count > PATH_INDEX_BLOCK + 5 ? PATH_INDEX_BLOCK + 5 : 0;
+    path_iter_init(&it, idx, start, buf);
+    for(pos = start; ok && pos < count && pos < start + 2 * PATH_INDEX_BLOCK; pos++) {
+        entry = path_iter_next(&it);
+        ok = entry != NULL && strcmp(it.path, ref[pos].path) == 0;
+    }
+    free(buf);
+    return ok;
+}
+
+// Every path is found where it should be, paths are all "....bin" so
+// one with a byte added or cut off the end is never in the index.
+static int check_find(const PathIndex *idx, const RefPath *ref, uint32_t count) {
+    char key[256];
+    int  ok = 1;
+    for(uint32_t i = 0; ok && i < count; i++) {
+        size_t len = strlen(ref[i].path);
+        ok = path_index_find(idx, ref[i].path) == (int64_t)i;
+        memcpy(key, ref[i].path, len);
+        memcpy(key + len, "x", 2);
+        ok &= path_index_find(idx, key) == -1;
+        key[len - 1] = '\0';
+        ok &= path_index_find(idx, key) == -1;
+    }
+    ok &= path_index_find(idx, "") == -1;
+    ok &= path_index_find(idx, "\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF") == -1;
+    return ok;
+}
+
+// Random keys made the same way as the paths, cut at random lengths, so
+// most land between two paths somewhere inside a block.
+static int check_lower(const PathIndex *idx, const RefPath *ref, uint32_t count) {
+    char key[256];
+    int  ok = 1;
+    for(int i = 0; ok && i < 20000; i++) {
+        size_t len = make_path(key);
+        key[rng_next() % (len + 1)] = '\0';
+        ok = path_index_lower(idx, key) == ref_lower(ref, count, key);
+    }
+    return ok;
+}
+
+// Every prefix of a sample of the paths, the range has to be exactly the
+// paths that start with it.
+static int check_prefix_of(const PathIndex *idx, const RefPath *ref, uint32_t count, const char *prefix) {
+    size_t   len   = strlen(prefix);
+    uint32_t first = 0;
+    uint32_t last  = 0;
+    uint32_t want  = 0;
+    path_index_prefix(idx, prefix, &first, &last);
+    while(want < count && strncmp(ref[want].path, prefix, len) < 0) {
+        want++;
+    }
+    if(first != want) {
+        return 0;
+    }
+    while(want < count && strncmp(ref[want].path, prefix, len) == 0) {
+        want++;
+    }
+    return last == want;
+}
+
+static int check_prefix(const PathIndex *idx, const RefPath *ref, uint32_t count, size_t *widest) {
+    static const char *fixed[] = { "", "\xFF", "\xFF\xFF/", "x\x80", "x\x80/\xFF", "a", "ab/", "zz", "\x01" };
+    char key[256];
+    int  ok = 1;
+    *widest = 0;
+    for(size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        ok &= check_prefix_of(idx, ref, count, fixed[i]);
+    }
+    for(uint32_t i = 0; ok && count > 0 && i < 500; i++) {
+        const char *path = ref[rng_next() % count].path;
+        size_t      len  = strlen(path);
+        for(size_t cut = 0; ok && cut <= len; cut++) {
+            uint32_t first, last;
+            memcpy(key, path, cut);
+            key[cut] = '\0';
+            ok = check_prefix_of(idx, ref, count, key);
+            path_index_prefix(idx, key, &first, &last);
+            if(last - first > *widest) {
+                *widest = last - first;
+            }
+        }
+    }
+    return ok;
+}
+
+static int same_index(const PathIndex *a, const PathIndex *b) {
+    return a->count == b->count && a->max_len == b->max_len && a->data_sz == b->data_sz &&
+           memcmp(a->data, b->data, a->data_sz) == 0 &&
+           memcmp(a->entries, b->entries, sizeof(PathEntry) * a->count) == 0;
+}
+
+static int check_empty(void) {
+    PathIndex        idx;
+    PathIndexBuilder builder;
+    PathIter         it;
+    char             buf[1];
+    uint32_t         first = 1;
+    uint32_t         last  = 1;
+    path_index_builder_init(&builder);
+    path_index_builder_finish(&builder, &idx);
+    path_index_prefix(&idx, "", &first, &last);
+    path_iter_init(&it, &idx, 0, buf);
+    int ok = idx.count == 0 && path_index_find(&idx, "a") == -1 && path_index_find(&idx, "") == -1 &&
+             path_index_lower(&idx, "a") == 0 && first == 0 && last == 0 && path_iter_next(&it) == NULL;
+    path_index_free(&idx);
+    FileList list;
+    FileList *lists[1] = { &list };
+    file_list_init(&list);
+    path_index_build(&idx, lists, 1);
+    path_index_prefix(&idx, "\xFF", &first, &last);
+    ok &= idx.count == 0 && path_index_find(&idx, "\xFF") == -1 && first == 0 && last == 0;
+    path_index_free(&idx);
+    return ok;
+}
+
+// Builds a list of paths spread over a handful of directories and reports
+// what the index takes next to the list.
+static void report_memory(uint32_t count) {
+    static const char *dirs[] = { "data/images/", "data/sound/effects/", "models/", "scripts/lua/", "textures/terrain/" };
+    FileList  list;
+    FileList *lists[1] = { &list };
+    PathIndex idx;
+    size_t    list_bytes = sizeof(FileList);
+    char      path[256];
+    file_list_init(&list);
+    for(uint32_t i = 0; i < count; i++) {
+        size_t len = sprintf(path, "%s%u/file_%u.dat", dirs[i % 5], i / 1000, i);
+        file_list_add(&list, make_node(path, i, i));
+        list_bytes += sizeof(FileNode) + len + 1 + MALLOC_OVERHEAD;
+    }
+    path_index_build(&idx, lists, 1);
+    printf("%u paths in %d directories\n", count, 5);
+    printf("  %-12s %12zu bytes\n", "FileList", list_bytes);
+    printf("  %-12s %12zu bytes\n", "PathIndex", path_index_memory(&idx));
+    path_index_free(&idx);
+    file_list_free(&list);
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1 && strcmp(argv[1], "-memory") == 0) {
+        report_memory(argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000);
+        return 0;
+    }
+    uint32_t  total = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+    RefPath  *ref   = malloc(sizeof(RefPath) * (total + 1));
+    FileList  first_list, second_list;
+    FileList *lists[2] = { &first_list, &second_list };
+    char      path[256];
+    if(ref == NULL) {
+        fprintf(stderr, "path-index-tests: failed to allocate reference\n");
+        return 1;
+    }
+    file_list_init(&first_list);
+    file_list_init(&second_list);
+    // Repeats are common since the names come from small sets, a third of
+    // the paths go in the second list and replace any match in the first.
+    for(uint32_t i = 0; i < total; i++) {
+        make_path(path);
+        file_list_add(i % 3 == 2 ? &second_list : &first_list, make_node(path, rng_next(), i));
+    }
+    PathIndexBuilder builder;
+    uint32_t         count = 0;
+    path_index_builder_init(&builder);
+    for(int l = 0; l < 2; l++) {
+        for(FileNode *cur = lists[l]->head; cur != NULL; cur = cur->next) {
+            size_t len = strlen(cur->path);
+            memcpy(path_index_builder_add(&builder, len, cur->offset, cur->size), cur->path, len);
+            ref[count].path   = cur->path;
+            ref[count].offset = cur->offset;
+            ref[count].size   = cur->size;
+            ref[count].order  = count;
+            count++;
+        }
+    }
+    // Sort and keep only the last of each path.
+    qsort(ref, count, sizeof(RefPath), ref_cmp);
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(i + 1 < count && strcmp(ref[i].path, ref[i + 1].path) == 0) {
+            continue;
+        }
+        ref[kept++] = ref[i];
+    }
+    PathIndex idx, built;
+    size_t    widest = 0;
+    path_index_build(&idx, lists, 2);
+    path_index_builder_finish(&builder, &built);
+    printf("PathIndex against a sorted array, %u paths, %u distinct, %u blocks\n", count, kept,
+           (kept + PATH_INDEX_BLOCK - 1) / PATH_INDEX_BLOCK);
+    printf("  %-28s %s\n", "empty index", verdict(check_empty()));
+    printf("  %-28s %s\n", "iterates in order", verdict(check_iter(&idx, ref, kept)));
+    printf("  %-28s %s\n", "finds every path", verdict(check_find(&idx, ref, kept)));
+    printf("  %-28s %s\n", "lower bound", verdict(check_lower(&idx, ref, kept)));
+    int prefix_ok = check_prefix(&idx, ref, kept, &widest);
+    // The widest range has to span blocks or the test missed the point.
+    printf("  %-28s %s\n", "prefix ranges", verdict(prefix_ok && widest > 4 * PATH_INDEX_BLOCK));
+    printf("  %-28s %s\n", "builder gives the same index", verdict(same_index(&idx, &built)));
+    path_index_free(&idx);
+    path_index_free(&built);
+    file_list_free(&first_list);
+    file_list_free(&second_list);
+    free(ref);
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
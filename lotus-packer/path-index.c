@@ -0,0 +1,295 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "path-index.h"
+
+typedef struct BuildItem {
+    const char *path;
+    PathEntry   entry;
+} BuildItem;
+
+static void* path_index_alloc(size_t size) {
+    void *tmp = malloc(size > 0 ? size : 1);
+    if(tmp == NULL) {
+        fprintf(stderr, "packer: fatal error: failed to allocate memory for path index.\n");
+        exit(-1);
+    }
+    return tmp;
+}
+
+static int build_item_cmp(const void *a, const void *b) {
+    const BuildItem *x = a;
+    const BuildItem *y = b;
+    int cmp = strcmp(x->path, y->path);
+    if(cmp != 0) {
+        return cmp;
+    }
+    return x->entry.id < y->entry.id ? -1 : 1;
+}
+
+static uint8_t* varint_write(uint8_t *dest, size_t val) {
+    while(val >= 0x80) {
+        *dest++ = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    *dest++ = val;
+    return dest;
+}
+
+static const uint8_t* varint_read(const uint8_t *src, size_t *val) {
+    size_t tmp   = 0;
+    unsigned sft = 0;
+    while(*src & 0x80) {
+        tmp |= (size_t)(*src++ & 0x7F) << sft;
+        sft += 7;
+    }
+    *val = tmp | ((size_t)*src++ << sft);
+    return src;
+}
+
+// Decodes one path on top of the previous one sitting in path.
+static const uint8_t* decode_path(const uint8_t *src, char *path, int first) {
+    size_t shared = 0;
+    size_t len    = 0;
+    if(!first) {
+        src = varint_read(src, &shared);
+    }
+    src = varint_read(src, &len);
+    memcpy(path + shared, src, len);
+    path[shared + len] = '\0';
+    return src + len;
+}
+
+// Sorts the items, drops duplicates and front codes what is left.
+static void index_items(PathIndex *idx, BuildItem *items, uint32_t count, size_t bound) {
+    qsort(items, count, sizeof(BuildItem), build_item_cmp);
+    // Only keep the last of any duplicates.
+    uint32_t kept = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        if(i + 1 < count && strcmp(items[i].path, items[i + 1].path) == 0) {
+            continue;
+        }
+        items[kept++] = items[i];
+    }
+    idx->count   = kept;
+    idx->max_len = 0;
+    idx->entries = path_index_alloc(sizeof(PathEntry) * kept);
+    idx->blocks  = path_index_alloc(sizeof(size_t) * ((kept + PATH_INDEX_BLOCK - 1) / PATH_INDEX_BLOCK));
+    idx->data    = path_index_alloc(bound);
+    uint8_t    *dest = idx->data;
+    const char *prev = "";
+    for(uint32_t i = 0; i < kept; i++) {
+        const char *path = items[i].path;
+        size_t      len  = strlen(path);
+        size_t      shared = 0;
+        if(i % PATH_INDEX_BLOCK == 0) {
+            idx->blocks[i / PATH_INDEX_BLOCK] = dest - idx->data;
+        } else {
+            while(path[shared] != '\0' && path[shared] == prev[shared]) {
+                shared++;
+            }
+            dest = varint_write(dest, shared);
+        }
+        dest = varint_write(dest, len - shared);
+        memcpy(dest, path + shared, len - shared);
+        dest += len - shared;
+        if(len > idx->max_len) {
+            idx->max_len = len;
+        }
+        idx->entries[i] = items[i].entry;
+        prev = path;
+    }
+    idx->data_sz = dest - idx->data;
+    uint8_t *shrunk = realloc(idx->data, idx->data_sz > 0 ? idx->data_sz : 1);
+    if(shrunk != NULL) {
+        idx->data = shrunk;
+    }
+    free(items);
+}
+
+void path_index_build(PathIndex *idx, FileList **lists, int n) {
+    size_t total = 0;
+    for(int i = 0; i < n; i++) {
+        total += lists[i]->count;
+    }
+    BuildItem *items = path_index_alloc(sizeof(BuildItem) * total);
+    uint32_t   count = 0;
+    size_t     bound = 0;
+    for(int i = 0; i < n; i++) {
+        for(FileNode *cur = lists[i]->head; cur != NULL; cur = cur->next) {
+            items[count].path         = cur->path;
+            items[count].entry.offset = cur->offset;
+            items[count].entry.size   = cur->size;
+            items[count].entry.id     = count;
+            bound += strlen(cur->path) + 2 * sizeof(size_t);
+            count++;
+        }
+    }
+    index_items(idx, items, count, bound);
+}
+
+void path_index_builder_init(PathIndexBuilder *b) {
+    memset(b, 0, sizeof(PathIndexBuilder));
+}
+
+char* path_index_builder_add(PathIndexBuilder *b, size_t len, uint32_t offset, uint32_t size) {
+    if(b->count == b->cap) {
+        b->cap     = b->cap ? b->cap * 2 : 64;
+        b->starts  = realloc(b->starts, sizeof(size_t) * b->cap);
+        b->entries = realloc(b->entries, sizeof(PathEntry) * b->cap);
+    }
+    while(b->paths_sz + len + 1 > b->paths_cap) {
+        b->paths_cap = b->paths_cap ? b->paths_cap * 2 : 4096;
+        b->paths     = realloc(b->paths, b->paths_cap);
+    }
+    if(b->starts == NULL || b->entries == NULL || b->paths == NULL) {
+        fprintf(stderr, "packer: fatal error: failed to allocate memory for path index.\n");
+        exit(-1);
+    }
+    char *path = b->paths + b->paths_sz;
+    path[len]  = '\0';
+    b->starts[b->count]         = b->paths_sz;
+    b->entries[b->count].offset = offset;
+    b->entries[b->count].size   = size;
+    b->entries[b->count].id     = b->count;
+    b->paths_sz += len + 1;
+    b->count++;
+    return path;
+}
+
+void path_index_builder_finish(PathIndexBuilder *b, PathIndex *idx) {
+    BuildItem *items = path_index_alloc(sizeof(BuildItem) * b->count);
+    size_t     bound = 0;
+    for(uint32_t i = 0; i < b->count; i++) {
+        // A path from a bad pack can hold a NUL, strlen stops there like it does elsewhere.
+        items[i].path  = b->paths + b->starts[i];
+        items[i].entry = b->entries[i];
+        bound += strlen(items[i].path) + 2 * sizeof(size_t);
+    }
+    index_items(idx, items, b->count, bound);
+    free(b->paths);
+    free(b->starts);
+    free(b->entries);
+    memset(b, 0, sizeof(PathIndexBuilder));
+}
+
+void path_index_free(PathIndex *idx) {
+    free(idx->data);
+    free(idx->blocks);
+    free(idx->entries);
+    memset(idx, 0, sizeof(PathIndex));
+}
+
+static uint32_t lower_bound(const PathIndex *idx, const char *key, int *equal) {
+    char     path[idx->max_len + 1];
+    uint32_t blocks = (idx->count + PATH_INDEX_BLOCK - 1) / PATH_INDEX_BLOCK;
+    uint32_t lo = 0;
+    uint32_t hi = blocks;
+    *equal = 0;
+    // Find the first block that starts after key, key is in the one before it.
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        decode_path(idx->data + idx->blocks[mid], path, 1);
+        if(strcmp(path, key) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if(lo == 0) {
+        return 0;
+    }
+    uint32_t       pos = (lo - 1) * PATH_INDEX_BLOCK;
+    uint32_t       end = pos + PATH_INDEX_BLOCK < idx->count ? pos + PATH_INDEX_BLOCK : idx->count;
+    const uint8_t *src = idx->data + idx->blocks[lo - 1];
+    for(; pos < end; pos++) {
+        src = decode_path(src, path, pos % PATH_INDEX_BLOCK == 0);
+        int cmp = strcmp(path, key);
+        if(cmp >= 0) {
+            *equal = cmp == 0;
+            return pos;
+        }
+    }
+    return end;
+}
+
+uint32_t path_index_lower(const PathIndex *idx, const char *key) {
+    int equal;
+    return lower_bound(idx, key, &equal);
+}
+
+int64_t path_index_find(const PathIndex *idx, const char *path) {
+    int      equal;
+    uint32_t pos = lower_bound(idx, path, &equal);
+    return equal ? (int64_t)pos : -1;
+}
+
+void path_index_prefix(const PathIndex *idx, const char *prefix, uint32_t *first, uint32_t *last) {
+    size_t len = strlen(prefix);
+    char   succ[len + 1];
+    memcpy(succ, prefix, len + 1);
+    *first = path_index_lower(idx, prefix);
+    // The smallest string greater than everything starting with prefix.
+    while(len > 0 && (uint8_t)succ[len - 1] == 0xFF) {
+        len--;
+    }
+    if(len == 0) {
+        *last = idx->count;
+        return;
+    }
+    succ[len - 1]++;
+    succ[len] = '\0';
+    *last = path_index_lower(idx, succ);
+}
+
+size_t path_index_memory(const PathIndex *idx) {
+    size_t blocks = (idx->count + PATH_INDEX_BLOCK - 1) / PATH_INDEX_BLOCK;
+    return sizeof(PathIndex) + idx->data_sz + blocks * sizeof(size_t) + idx->count * sizeof(PathEntry);
+}
+
+void path_iter_init(PathIter *it, const PathIndex *idx, uint32_t pos, char *buf) {
+    it->idx  = idx;
+    it->path = buf;
+    buf[0]   = '\0';
+    if(pos >= idx->count) {
+        it->pos  = idx->count;
+        it->next = NULL;
+        return;
+    }
+    // Decode up to pos so the path before it is in the buffer.
+    uint32_t cur = pos - pos % PATH_INDEX_BLOCK;
+    it->next = idx->data + idx->blocks[cur / PATH_INDEX_BLOCK];
+    for(; cur < pos; cur++) {
+        it->next = decode_path(it->next, buf, cur % PATH_INDEX_BLOCK == 0);
+    }
+    it->pos = pos;
+}
+
+const PathEntry* path_iter_next(PathIter *it) {
+    if(it->pos >= it->idx->count) {
+        return NULL;
+    }
+    it->next = decode_path(it->next, it->path, it->pos % PATH_INDEX_BLOCK == 0);
+    return &it->idx->entries[it->pos++];
+}
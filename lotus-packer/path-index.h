@@ -0,0 +1,92 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file-list.h"
+
+// Paths are front coded in blocks of this many. The first path in a block is
+// stored whole, the rest only store what differs from the path before them.
+#define PATH_INDEX_BLOCK 16
+
+typedef struct PathEntry {
+    uint32_t offset;
+    uint32_t size;
+    uint32_t id;     // Position in the lists the index was built from.
+} PathEntry;
+
+// A sorted, read only index of the paths in a pack.
+typedef struct PathIndex {
+    uint8_t   *data;    // Front coded paths.
+    size_t     data_sz;
+    size_t    *blocks;  // Start of each block in data.
+    PathEntry *entries;
+    uint32_t   count;
+    uint32_t   max_len; // Longest path, for sizing decode buffers.
+} PathIndex;
+
+// Collects entries one at a time, for building an index straight from a
+// pack's header without going through a FileList.
+typedef struct PathIndexBuilder {
+    char      *paths;   // Every path added so far, NUL terminated.
+    size_t     paths_sz;
+    size_t     paths_cap;
+    size_t    *starts;  // Start of each path in paths.
+    PathEntry *entries;
+    uint32_t   count;
+    uint32_t   cap;
+} PathIndexBuilder;
+
+// Walks the index in sorted order decoding paths into a caller buffer of at
+// least max_len + 1 bytes.
+typedef struct PathIter {
+    const PathIndex *idx;
+    const uint8_t   *next;
+    uint32_t         pos;
+    char            *path;
+} PathIter;
+
+// Builds the index from the lists taken one after the other, when a path
+// shows up more than once only the last one is kept. The lists are left alone
+// and can be freed afterwards.
+void path_index_build (PathIndex *idx, FileList **lists, int n);
+void path_index_free  (PathIndex *idx);
+void path_index_builder_init(PathIndexBuilder *b);
+// Adds an entry and returns where its len byte path goes, only good until
+// the next add.
+char* path_index_builder_add(PathIndexBuilder *b, size_t len, uint32_t offset, uint32_t size);
+// Builds the index the same as path_index_build would and frees the builder.
+void path_index_builder_finish(PathIndexBuilder *b, PathIndex *idx);
+// Returns the position of path or -1 when it is not in the index.
+int64_t path_index_find  (const PathIndex *idx, const char *path);
+// First position whose path is not less than key.
+uint32_t path_index_lower (const PathIndex *idx, const char *key);
+// Every path starting with prefix is in [*first, *last).
+void path_index_prefix(const PathIndex *idx, const char *prefix, uint32_t *first, uint32_t *last);
+size_t path_index_memory(const PathIndex *idx);
+
+void path_iter_init(PathIter *it, const PathIndex *idx, uint32_t pos, char *buf);
+// Decodes the next path, returns NULL once past the end.
+const PathEntry* path_iter_next(PathIter *it);
+
+#endif // PATH_INDEX_H
@@ -0,0 +1,439 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// POSIX versions of the Win32 calls in windows.h.
+
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "windows.h"
+
+int win32_fail_moves   = 0;
+int win32_crash_writes = 0;
+
+typedef enum HandleKind {
+    HANDLE_FILE,
+    HANDLE_FIND,
+    HANDLE_THREAD
+} HandleKind;
+
+// Every HANDLE points at one of these.
+typedef struct Handle {
+    HandleKind kind;
+    int        fd;
+    // Directory search, name is the pattern or empty for everything.
+    DIR       *dir;
+    char       dir_path[4096];
+    char       name[260];
+    // Thread.
+    pthread_t  thread;
+    DWORD    (*start)(LPVOID);
+    LPVOID     arg;
+} Handle;
+
+// Views have to be unmapped with their size, which the caller doesn't pass.
+typedef struct View {
+    struct View *next;
+    void        *addr;
+    size_t       size;
+} View;
+
+static View           *views      = NULL;
+static pthread_mutex_t views_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Handle* handle_new(HandleKind kind) {
+    Handle *h = calloc(1, sizeof(Handle));
+    if(h == NULL) {
+        fprintf(stderr, "packer: fatal error: failed to allocate memory.\n");
+        exit(-1);
+    }
+    h->kind = kind;
+    h->fd   = -1;
+    return h;
+}
+
+DWORD GetFileAttributesA(const char *path) {
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        return INVALID_FILE_ATTRIBUTES;
+    }
+    return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+BOOL CreateDirectory(const char *path, void *security) {
+    (void)security;
+    return mkdir(path, 0777) == 0;
+}
+
+BOOL CopyFileA(const char *src, const char *dest, BOOL fail_if_exists) {
+    int in = open(src, O_RDONLY);
+    if(in < 0) {
+        return FALSE;
+    }
+    int out = open(dest, O_WRONLY | O_CREAT | (fail_if_exists ? O_EXCL : O_TRUNC), 0666);
+    if(out < 0) {
+        close(in);
+        return FALSE;
+    }
+    char    buf[4096 * 16];
+    ssize_t got;
+    BOOL    ok = TRUE;
+    while(ok && (got = read(in, buf, sizeof(buf))) > 0) {
+        ok = write(out, buf, got) == got;
+    }
+    ok &= got == 0;
+    close(in);
+    ok &= close(out) == 0;
+    return ok;
+}
+
+BOOL CreateHardLinkA(const char *name, const char *existing, void *security) {
+    (void)security;
+    return link(existing, name) == 0;
+}
+
+BOOL DeleteFileA(const char *path) {
+    return unlink(path) == 0;
+}
+
+BOOL MoveFileExA(const char *src, const char *dest, DWORD flags) {
+    (void)flags;
+    if(win32_fail_moves > 0) {
+        win32_fail_moves--;
+        return FALSE;
+    }
+    return rename(src, dest) == 0;
+}
+
+static BOOL find_fill(Handle *h, WIN32_FIND_DATAA *data) {
+    struct dirent *ent;
+    while((ent = readdir(h->dir)) != NULL) {
+        if(h->name[0] != '\0' && strcmp(h->name, ent->d_name) != 0) {
+            continue;
+        }
+        char        full[sizeof(h->dir_path) + sizeof(ent->d_name) + 1];
+        struct stat st;
+        snprintf(full, sizeof(full), "%s/%s", h->dir_path, ent->d_name);
+        if(stat(full, &st) != 0) {
+            continue;
+        }
+        data->dwFileAttributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+        data->nFileSizeLow     = st.st_size;
+        snprintf(data->cFileName, sizeof(data->cFileName), "%s", ent->d_name);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Only handles "dir/*" and a plain path, which is all the packer asks for.
+HANDLE FindFirstFileA(const char *pattern, WIN32_FIND_DATAA *data) {
+    Handle *h = handle_new(HANDLE_FIND);
+    snprintf(h->dir_path, sizeof(h->dir_path), "%s", pattern);
+    char *sep = strrchr(h->dir_path, '/');
+    if(strcmp(sep != NULL ? sep + 1 : h->dir_path, "*") != 0) {
+        snprintf(h->name, sizeof(h->name), "%.259s", sep != NULL ? sep + 1 : h->dir_path);
+    }
+    if(sep == NULL) {
+        strcpy(h->dir_path, ".");
+    } else if(sep == h->dir_path) {
+        strcpy(h->dir_path, "/");
+    } else {
+        *sep = '\0';
+    }
+    h->dir = opendir(h->dir_path);
+    if(h->dir == NULL || !find_fill(h, data)) {
+        if(h->dir != NULL) {
+            closedir(h->dir);
+        }
+        free(h);
+        return INVALID_HANDLE_VALUE;
+    }
+    return h;
+}
+
+BOOL FindNextFileA(HANDLE find, WIN32_FIND_DATAA *data) {
+    return find_fill(find, data);
+}
+
+BOOL FindClose(HANDLE find) {
+    return CloseHandle(find);
+}
+
+HANDLE CreateFileA(const char *path, DWORD access, DWORD share, void *security, DWORD creation, DWORD flags, HANDLE templ) {
+    int mode = access & GENERIC_WRITE ? O_RDWR : O_RDONLY;
+    (void)share;
+    (void)security;
+    (void)flags;
+    (void)templ;
+    if(creation == CREATE_ALWAYS) {
+        mode |= O_CREAT | O_TRUNC;
+    }
+    int fd = open(path, mode, 0666);
+    if(fd < 0) {
+        return INVALID_HANDLE_VALUE;
+    }
+    Handle *h = handle_new(HANDLE_FILE);
+    h->fd = fd;
+    return h;
+}
+
+BOOL GetFileSizeEx(HANDLE file, LARGE_INTEGER *size) {
+    struct stat st;
+    if(fstat(((Handle*)file)->fd, &st) != 0) {
+        return FALSE;
+    }
+    size->QuadPart = st.st_size;
+    return TRUE;
+}
+
+BOOL SetFilePointerEx(HANDLE file, LARGE_INTEGER to, LARGE_INTEGER *pos, DWORD method) {
+    off_t at = lseek(((Handle*)file)->fd, to.QuadPart, method == FILE_BEGIN ? SEEK_SET : SEEK_CUR);
+    if(at < 0) {
+        return FALSE;
+    }
+    if(pos != NULL) {
+        pos->QuadPart = at;
+    }
+    return TRUE;
+}
+
+BOOL ReadFile(HANDLE file, void *buf, DWORD n, DWORD *got, void *overlapped) {
+    ssize_t ret = read(((Handle*)file)->fd, buf, n);
+    (void)overlapped;
+    *got = ret > 0 ? ret : 0;
+    return ret >= 0;
+}
+
+BOOL WriteFile(HANDLE file, const void *buf, DWORD n, DWORD *wrote, void *overlapped) {
+    (void)overlapped;
+    if(win32_crash_writes > 0 && --win32_crash_writes == 0) {
+        ssize_t half = write(((Handle*)file)->fd, buf, n / 2);
+        (void)half;
+        _exit(3);
+    }
+    ssize_t ret = write(((Handle*)file)->fd, buf, n);
+    *wrote = ret > 0 ? ret : 0;
+    return ret >= 0;
+}
+
+BOOL FlushFileBuffers(HANDLE file) {
+    return fsync(((Handle*)file)->fd) == 0;
+}
+
+// The mapping is the file handle again, MapViewOfFile does the work.
+HANDLE CreateFileMappingA(HANDLE file, void *security, DWORD protect, DWORD size_high, DWORD size_low, const char *name) {
+    Handle *h = handle_new(HANDLE_FILE);
+    (void)security;
+    (void)protect;
+    (void)size_high;
+    (void)size_low;
+    (void)name;
+    h->fd = dup(((Handle*)file)->fd);
+    if(h->fd < 0) {
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+// Always maps the whole file, mapping an empty file fails like on Windows.
+void* MapViewOfFile(HANDLE mapping, DWORD access, DWORD offset_high, DWORD offset_low, size_t size) {
+    struct stat st;
+    (void)access;
+    (void)offset_high;
+    (void)offset_low;
+    (void)size;
+    if(fstat(((Handle*)mapping)->fd, &st) != 0 || st.st_size == 0) {
+        return NULL;
+    }
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ((Handle*)mapping)->fd, 0);
+    View *view = malloc(sizeof(View));
+    if(addr == MAP_FAILED || view == NULL) {
+        if(addr != MAP_FAILED) {
+            munmap(addr, st.st_size);
+        }
+        free(view);
+        return NULL;
+    }
+    view->addr = addr;
+    view->size = st.st_size;
+    pthread_mutex_lock(&views_lock);
+    view->next = views;
+    views      = view;
+    pthread_mutex_unlock(&views_lock);
+    return addr;
+}
+
+BOOL UnmapViewOfFile(const void *addr) {
+    pthread_mutex_lock(&views_lock);
+    View **cur = &views;
+    while(*cur != NULL && (*cur)->addr != addr) {
+        cur = &(*cur)->next;
+    }
+    View *view = *cur;
+    if(view != NULL) {
+        *cur = view->next;
+    }
+    pthread_mutex_unlock(&views_lock);
+    if(view == NULL) {
+        return FALSE;
+    }
+    munmap(view->addr, view->size);
+    free(view);
+    return TRUE;
+}
+
+BOOL CloseHandle(HANDLE handle) {
+    Handle *h = handle;
+    if(h == NULL || h == INVALID_HANDLE_VALUE) {
+        return FALSE;
+    }
+    if(h->fd >= 0) {
+        close(h->fd);
+    }
+    if(h->dir != NULL) {
+        closedir(h->dir);
+    }
+    if(h->kind == HANDLE_THREAD) {
+        // Like closing a thread handle on Windows the thread carries on.
+        pthread_detach(h->thread);
+    }
+    free(h);
+    return TRUE;
+}
+
+static void* thread_start(void *arg) {
+    Handle *h = arg;
+    h->start(h->arg);
+    return NULL;
+}
+
+HANDLE CreateThread(void *security, size_t stack, DWORD (*start)(LPVOID), LPVOID arg, DWORD flags, DWORD *id) {
+    Handle *h = handle_new(HANDLE_THREAD);
+    (void)security;
+    (void)stack;
+    (void)flags;
+    (void)id;
+    h->start = start;
+    h->arg   = arg;
+    if(pthread_create(&h->thread, NULL, thread_start, h) != 0) {
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+// Only ever used to wait for a thread to finish.
+DWORD WaitForSingleObject(HANDLE handle, DWORD ms) {
+    Handle *h = handle;
+    (void)ms;
+    if(h->kind == HANDLE_THREAD && pthread_join(h->thread, NULL) == 0) {
+        h->kind = HANDLE_FILE;
+    }
+    return 0;
+}
+
+void InitializeCriticalSection(CRITICAL_SECTION *cs) {
+    pthread_mutex_init(cs, NULL);
+}
+
+void EnterCriticalSection(CRITICAL_SECTION *cs) {
+    pthread_mutex_lock(cs);
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION *cs) {
+    pthread_mutex_unlock(cs);
+}
+
+LONG InterlockedIncrement(volatile LONG *val) {
+    return __atomic_add_fetch(val, 1, __ATOMIC_SEQ_CST);
+}
+
+LONG InterlockedExchange(volatile LONG *val, LONG to) {
+    return __atomic_exchange_n(val, to, __ATOMIC_SEQ_CST);
+}
+
+void GetSystemInfo(SYSTEM_INFO *info) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    info->dwNumberOfProcessors = cpus > 0 ? cpus : 1;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *count) {
+    count->QuadPart = now_ns();
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *freq) {
+    freq->QuadPart = 1000000000;
+    return TRUE;
+}
+
+ULONGLONG GetTickCount64(void) {
+    return now_ns() / 1000000;
+}
+
+void Sleep(DWORD ms) {
+    usleep((useconds_t)ms * 1000);
+}
+
+BOOL ReadDirectoryChangesW(HANDLE dir, void *buffer, DWORD length, BOOL subtree, DWORD filter, DWORD *returned, void *overlapped, void *routine) {
+    (void)dir;
+    (void)buffer;
+    (void)length;
+    (void)subtree;
+    (void)filter;
+    (void)returned;
+    (void)overlapped;
+    (void)routine;
+    return FALSE;
+}
+
+// Only ASCII names come through here in the tests.
+int WideCharToMultiByte(DWORD code_page, DWORD flags, const WCHAR *wide, int wide_len, char *out, int out_len, const char *def, BOOL *used_def) {
+    (void)code_page;
+    (void)flags;
+    (void)def;
+    (void)used_def;
+    int len = wide_len < out_len ? wide_len : out_len;
+    for(int i = 0; i < len; i++) {
+        out[i] = wide[i] < 0x80 ? (char)wide[i] : '?';
+    }
+    return len;
+}
+
+BOOL SetConsoleCtrlHandler(PHANDLER_ROUTINE routine, BOOL add) {
+    (void)routine;
+    (void)add;
+    return TRUE;
+}
@@ -0,0 +1,158 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef POSIX_WINDOWS_H
+#define POSIX_WINDOWS_H
+
+// Just enough of the Win32 API on top of POSIX to build the packer and run
+// its tests on Linux, see win32.c. Only what packer.c and stats.c call is
+// here, with only the behaviour they rely on. It is not used for the
+// Windows build.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+typedef uint32_t           DWORD;
+typedef int                BOOL;
+typedef long               LONG;
+typedef unsigned long long ULONGLONG;
+typedef uint16_t           WCHAR;
+typedef void              *HANDLE;
+typedef void              *LPVOID;
+typedef pthread_mutex_t    CRITICAL_SECTION;
+
+typedef union LARGE_INTEGER {
+    long long QuadPart;
+} LARGE_INTEGER;
+
+typedef struct SYSTEM_INFO {
+    DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+typedef struct WIN32_FIND_DATAA {
+    DWORD dwFileAttributes;
+    DWORD nFileSizeLow;
+    char  cFileName[260];
+} WIN32_FIND_DATAA;
+
+typedef struct FILE_NOTIFY_INFORMATION {
+    DWORD NextEntryOffset;
+    DWORD Action;
+    DWORD FileNameLength;
+    WCHAR FileName[1];
+} FILE_NOTIFY_INFORMATION;
+
+typedef BOOL (*PHANDLER_ROUTINE)(DWORD);
+
+#define WINAPI
+#define TRUE  1
+#define FALSE 0
+#define INFINITE 0xFFFFFFFF
+#define CP_ACP   0
+
+#define ERROR_PATH_NOT_FOUND 3
+
+#define CTRL_C_EVENT     0
+#define CTRL_BREAK_EVENT 1
+#define CTRL_CLOSE_EVENT 2
+
+#define FILE_ACTION_ADDED            1
+#define FILE_ACTION_REMOVED          2
+#define FILE_ACTION_MODIFIED         3
+#define FILE_ACTION_RENAMED_OLD_NAME 4
+#define FILE_ACTION_RENAMED_NEW_NAME 5
+
+#define FILE_NOTIFY_CHANGE_FILE_NAME  0x01
+#define FILE_NOTIFY_CHANGE_DIR_NAME   0x02
+#define FILE_NOTIFY_CHANGE_SIZE       0x08
+#define FILE_NOTIFY_CHANGE_LAST_WRITE 0x10
+
+#define FILE_ATTRIBUTE_DIRECTORY   0x10
+#define FILE_ATTRIBUTE_NORMAL      0x80
+#define FILE_FLAG_BACKUP_SEMANTICS 0x02000000
+#define FILE_LIST_DIRECTORY        0x01
+#define FILE_SHARE_READ            0x01
+#define FILE_SHARE_WRITE           0x02
+#define FILE_SHARE_DELETE          0x04
+#define FILE_MAP_READ              0x04
+#define GENERIC_READ               0x80000000
+#define GENERIC_WRITE              0x40000000
+#define CREATE_ALWAYS              2
+#define OPEN_EXISTING              3
+#define FILE_BEGIN                 0
+#define PAGE_READONLY              0x02
+#define INVALID_FILE_ATTRIBUTES    ((DWORD)-1)
+#define INVALID_HANDLE_VALUE       ((HANDLE)(intptr_t)-1)
+#define MOVEFILE_REPLACE_EXISTING  0x01
+#define MOVEFILE_WRITE_THROUGH     0x08
+
+// Files and directories.
+DWORD  GetFileAttributesA(const char *path);
+BOOL   CreateDirectory   (const char *path, void *security);
+BOOL   CopyFileA         (const char *src, const char *dest, BOOL fail_if_exists);
+BOOL   CreateHardLinkA   (const char *name, const char *existing, void *security);
+BOOL   DeleteFileA       (const char *path);
+BOOL   MoveFileExA       (const char *src, const char *dest, DWORD flags);
+HANDLE FindFirstFileA    (const char *pattern, WIN32_FIND_DATAA *data);
+BOOL   FindNextFileA     (HANDLE find, WIN32_FIND_DATAA *data);
+BOOL   FindClose         (HANDLE find);
+
+// File handles and read only mappings of them.
+HANDLE CreateFileA       (const char *path, DWORD access, DWORD share, void *security, DWORD creation, DWORD flags, HANDLE templ);
+BOOL   GetFileSizeEx     (HANDLE file, LARGE_INTEGER *size);
+BOOL   SetFilePointerEx  (HANDLE file, LARGE_INTEGER to, LARGE_INTEGER *pos, DWORD method);
+BOOL   ReadFile          (HANDLE file, void *buf, DWORD n, DWORD *got, void *overlapped);
+BOOL   WriteFile         (HANDLE file, const void *buf, DWORD n, DWORD *wrote, void *overlapped);
+BOOL   FlushFileBuffers  (HANDLE file);
+HANDLE CreateFileMappingA(HANDLE file, void *security, DWORD protect, DWORD size_high, DWORD size_low, const char *name);
+void*  MapViewOfFile     (HANDLE mapping, DWORD access, DWORD offset_high, DWORD offset_low, size_t size);
+BOOL   UnmapViewOfFile   (const void *view);
+BOOL   CloseHandle       (HANDLE handle);
+
+// Threads and locks.
+HANDLE CreateThread             (void *security, size_t stack, DWORD (*start)(LPVOID), LPVOID arg, DWORD flags, DWORD *id);
+DWORD  WaitForSingleObject      (HANDLE handle, DWORD ms);
+void   InitializeCriticalSection(CRITICAL_SECTION *cs);
+void   EnterCriticalSection     (CRITICAL_SECTION *cs);
+void   LeaveCriticalSection     (CRITICAL_SECTION *cs);
+LONG   InterlockedIncrement     (volatile LONG *val);
+LONG   InterlockedExchange      (volatile LONG *val, LONG to);
+void   GetSystemInfo            (SYSTEM_INFO *info);
+
+// Time.
+BOOL      QueryPerformanceCounter  (LARGE_INTEGER *count);
+BOOL      QueryPerformanceFrequency(LARGE_INTEGER *freq);
+ULONGLONG GetTickCount64           (void);
+void      Sleep                    (DWORD ms);
+
+// Change notifications never arrive here, watch is tested by feeding its
+// changes in directly.
+BOOL ReadDirectoryChangesW(HANDLE dir, void *buffer, DWORD length, BOOL subtree, DWORD filter, DWORD *returned, void *overlapped, void *routine);
+int  WideCharToMultiByte  (DWORD code_page, DWORD flags, const WCHAR *wide, int wide_len, char *out, int out_len, const char *def, BOOL *used_def);
+BOOL SetConsoleCtrlHandler(PHANDLER_ROUTINE routine, BOOL add);
+
+// Tests set this to make that many of the next MoveFileExA calls fail, the
+// way they do on Windows while something else has the file open.
+extern int win32_fail_moves;
+// When set the process dies in the middle of that many WriteFile calls from
+// now, with only half the bytes written, like a crash or power cut would.
+extern int win32_crash_writes;
+
+#endif // POSIX_WINDOWS_H
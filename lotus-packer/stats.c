@@ -0,0 +1,143 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+#include "stats.h"
+
+Stats stats;
+
+static const char   *stats_mode    = "";
+static FILE         *stats_out     = NULL;
+static volatile LONG stats_printed = 0;
+static const char *phase_names[STAT_PHASE_COUNT] = {
+    "scan",
+    "index_encode",
+    "index_decode",
+    "payload_copy",
+    "directory_create"
+};
+
+// Prints the report once, whichever of exit or Ctrl+C gets here first.
+static void stats_report(void) {
+    if(InterlockedExchange(&stats_printed, 1) == 0) {
+        stats_print_json(stats_out);
+    }
+}
+
+static void stats_at_exit(void) {
+    stats_report();
+}
+
+// Ctrl+C and closing the console end the process without running atexit,
+// and that is the only way watch mode ever ends.
+static BOOL WINAPI stats_ctrl_handler(DWORD type) {
+    if(type == CTRL_C_EVENT || type == CTRL_BREAK_EVENT || type == CTRL_CLOSE_EVENT) {
+        stats_report();
+    }
+    return FALSE;
+}
+
+void stats_enable(const char *mode, const char *path) {
+    memset(&stats, 0, sizeof(Stats));
+    stats_out = stderr;
+    if(path != NULL) {
+        stats_out = fopen(path, "w");
+        if(stats_out == NULL) {
+            fprintf(stderr, "packer: fatal error: failed to open ‘%s’\n", path);
+            exit(-1);
+        }
+    }
+    stats.enabled = 1;
+    stats.start   = stats_now();
+    stats_mode    = mode;
+    atexit(stats_at_exit);
+    SetConsoleCtrlHandler(stats_ctrl_handler, TRUE);
+}
+
+uint64_t stats_now(void) {
+    static LARGE_INTEGER freq = { .QuadPart = 0 };
+    if(!stats.enabled) {
+        return 0;
+    }
+    if(freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    // Split up so the multiply does not overflow for long uptimes.
+    uint64_t sec = now.QuadPart / freq.QuadPart;
+    uint64_t rem = now.QuadPart % freq.QuadPart;
+    return sec * 1000000000 + rem * 1000000000 / freq.QuadPart;
+}
+
+void stats_add_time(StatPhase phase, uint64_t start) {
+    if(stats.enabled) {
+        stats.phase_ns[phase] += stats_now() - start;
+    }
+}
+
+void stats_file_done(const char *path, uint64_t start, uint64_t bytes) {
+    stats.files++;
+    stats.bytes += bytes;
+    if(!stats.enabled) {
+        return;
+    }
+    uint64_t took = stats_now() - start;
+    if(took >= stats.max_file_ns) {
+        stats.max_file_ns = took;
+        snprintf(stats.max_file, sizeof(stats.max_file), "%s", path);
+    }
+}
+
+static void json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for(; *str != '\0'; str++) {
+        unsigned char c = *str;
+        if(c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if(c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void stats_print_json(FILE *out) {
+    uint64_t total = stats_now() - stats.start;
+    double   secs  = total / 1e9;
+    fprintf(out, "{\"mode\":");
+    json_string(out, stats_mode);
+    fprintf(out, ",\"total_ns\":%llu,\"phases_ns\":{", (unsigned long long)total);
+    for(int i = 0; i < STAT_PHASE_COUNT; i++) {
+        fprintf(out, "%s\"%s\":%llu", i ? "," : "", phase_names[i], (unsigned long long)stats.phase_ns[i]);
+    }
+    fprintf(out, "},\"files\":%llu,\"bytes\":%llu,", (unsigned long long)stats.files, (unsigned long long)stats.bytes);
+    fprintf(out, "\"files_per_sec\":%.1f,\"bytes_per_sec\":%.1f,", secs > 0 ? stats.files / secs : 0.0, secs > 0 ? stats.bytes / secs : 0.0);
+    fprintf(out, "\"stdio_calls\":{\"fopen\":%llu,\"fread\":%llu,\"fwrite\":%llu},", (unsigned long long)stats.fopens, (unsigned long long)stats.freads, (unsigned long long)stats.fwrites);
+    fprintf(out, "\"max_file_ns\":%llu,\"max_file\":", (unsigned long long)stats.max_file_ns);
+    json_string(out, stats.max_file);
+    fprintf(out, "}\n");
+    fflush(out);
+}
@@ -0,0 +1,61 @@
+/*
+MIT License
+Copyright (c) 2019 Keith J. Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum StatPhase {
+    STAT_SCAN,
+    STAT_INDEX_ENCODE,
+    STAT_INDEX_DECODE,
+    STAT_PAYLOAD,
+    STAT_MKDIR,
+    STAT_PHASE_COUNT
+} StatPhase;
+
+typedef struct Stats {
+    int      enabled;
+    uint64_t start;
+    uint64_t phase_ns[STAT_PHASE_COUNT];
+    // Calls made into stdio, not reads and writes that reach the disk.
+    uint64_t fopens;
+    uint64_t freads;
+    uint64_t fwrites;
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t max_file_ns;
+    char     max_file[260];
+} Stats;
+
+extern Stats stats;
+
+// Starts the clock and prints the JSON report to path, or stderr when it is
+// NULL, once the program exits or is stopped with Ctrl+C.
+void     stats_enable(const char *mode, const char *path);
+// Monotonic time in nanoseconds, 0 when stats are off.
+uint64_t stats_now(void);
+void     stats_add_time(StatPhase phase, uint64_t start);
+// Records a file being done, for files/s and the slowest file.
+void     stats_file_done(const char *path, uint64_t start, uint64_t bytes);
+void     stats_print_json(FILE *out);
+
+#endif // STATS_H
@@ -0,0 +1,196 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Compares masking and rejecting against Lemire's multiply and shift for
+// bounds just above a power of two, where masking is at its worst. Both
+// run on rdrand, where the draws dominate, so time per value over time per
+// raw draw gives the draws each one needed, next to what's expected. Then
+// the same bounds through rand64_bounded_fill on the default backend, the
+// raw speed of the generators, the samplers on top of them and shuffling.
+// make rand64-bench
+// ./rand64-bench [thousands of values]
+
+#define _POSIX_C_SOURCE 199309L
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rand64.h"
+
+static const int bounds[] = { 1, 2, 4, 8, 16, 24, 32, 40, 48, 56, 62, 63 };
+
+// Masking keeps a draw with odds range over the next power of two.
+static double mask_draws(uint64_t range) {
+    int bits = 64 - __builtin_clzll(range - 1);
+    return ldexp(1.0, bits) / range;
+}
+
+// Lemire throws away 2^64 mod range of the 2^64 possible draws.
+static double lemire_draws(uint64_t range) {
+    return 1 / (1 - (double)(-range % range) / 18446744073709551616.0);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t count = 100000;
+    if(argc > 1) {
+        count = strtoull(argv[1], NULL, 10) * 1000;
+    }
+    if(count == 0) {
+        fprintf(stderr, "rand64-bench: fatal error: nothing to draw\n");
+        return 1;
+    }
+    uint64_t *buf = malloc(count * sizeof(uint64_t));
+    if(buf == NULL) {
+        fprintf(stderr, "rand64-bench: fatal error: out of memory\n");
+        return 1;
+    }
+    // The fill columns are timed on the fastest backend.
+    Rand64Backend fast = RAND64_XOSHIRO;
+    if(rand64_use(RAND64_RDRAND) < 0) {
+        fprintf(stderr, "rand64-bench: fatal error: no rdrand on this CPU\n");
+        return 1;
+    }
+    // Touch the pages before anything is timed.
+    rand64_fill(buf, count);
+    uint64_t sink  = 0;
+    double   start = now_sec();
+    for(size_t i = 0; i < count; i++) {
+        sink += rand64_rdrand();
+    }
+    double draw = (now_sec() - start) / count;
+    printf("rdrand %.1f ns per draw\n\n", draw * 1e9);
+    printf("bound    mask ns  draws (want)  lemire ns  draws (want)  fill ns\n");
+    for(size_t b = 0; b < sizeof(bounds) / sizeof(bounds[0]); b++) {
+        int      bits  = bounds[b];
+        uint64_t range = ((uint64_t)1 << bits) + 1;
+        rand64_use(RAND64_RDRAND);
+        start = now_sec();
+        for(size_t i = 0; i < count; i++) {
+            sink += rand64_rdrand_maximum(range - 1);
+        }
+        double mask = (now_sec() - start) / count;
+        start = now_sec();
+        for(size_t i = 0; i < count; i++) {
+            sink += rand64_bounded(range);
+        }
+        double lemire = (now_sec() - start) / count;
+        rand64_use(fast);
+        start = now_sec();
+        rand64_bounded_fill(buf, count, range);
+        double fill = (now_sec() - start) / count;
+        sink += buf[count - 1];
+        printf("2^%-2d+1  %7.1f  %5.2f (%4.2f)  %9.1f  %5.2f (%4.2f)  %7.2f\n", bits,
+               mask * 1e9, mask / draw, mask_draws(range),
+               lemire * 1e9, lemire / draw, lemire_draws(range), fill * 1e9);
+    }
+    printf("\n");
+    start = now_sec();
+    rand64_fill(buf, count);
+    double fill = now_sec() - start;
+    sink += buf[count - 1];
+    printf("rand64_fill         %6.2f ns  %6.2f GB/s\n", fill / count * 1e9, count * 8 / fill / 1e9);
+    Rand64Philox philox;
+    rand64_philox_init(&philox, 1, 0);
+    start = now_sec();
+    for(size_t i = 0; i < count; i++) {
+        sink += rand64_philox(&philox);
+    }
+    double each = now_sec() - start;
+    printf("rand64_philox       %6.2f ns  %6.2f GB/s\n", each / count * 1e9, count * 8 / each / 1e9);
+    start = now_sec();
+    rand64_philox_fill(&philox, buf, count);
+    fill = now_sec() - start;
+    sink += buf[count - 1];
+    printf("rand64_philox_fill  %6.2f ns  %6.2f GB/s\n", fill / count * 1e9, count * 8 / fill / 1e9);
+    start = now_sec();
+    for(size_t i = 0; i < count; i++) {
+        sink += rand64_secure();
+    }
+    each = now_sec() - start;
+    printf("rand64_secure       %6.2f ns  %6.2f GB/s\n", each / count * 1e9, count * 8 / each / 1e9);
+    start = now_sec();
+    rand64_secure_fill(buf, count);
+    fill = now_sec() - start;
+    sink += buf[count - 1];
+    printf("rand64_secure_fill  %6.2f ns  %6.2f GB/s\n", fill / count * 1e9, count * 8 / fill / 1e9);
+    double *samples = malloc(count * sizeof(double));
+    if(samples == NULL) {
+        fprintf(stderr, "rand64-bench: fatal error: out of memory\n");
+        return 1;
+    }
+    rand64_philox_init(&philox, 1, 0);
+    Rand64Gen gens[2];
+    rand64_gen_init(&gens[0]);
+    rand64_gen_init_philox(&gens[1], &philox);
+    const char *gen_names[2] = { "default", "philox" };
+    rand64_double_fill(&gens[0], samples, count);
+    double total = 0;
+    printf("\n");
+    for(int g = 0; g < 2; g++) {
+        start = now_sec();
+        rand64_double_fill(&gens[g], samples, count);
+        double uniform = now_sec() - start;
+        total += samples[count - 1];
+        start = now_sec();
+        rand64_float_fill(&gens[g], (float*)samples, count);
+        double single = now_sec() - start;
+        total += ((float*)samples)[count - 1];
+        start = now_sec();
+        rand64_normal_fill(&gens[g], samples, count);
+        double gauss = now_sec() - start;
+        total += samples[count - 1];
+        start = now_sec();
+        rand64_exponential_fill(&gens[g], samples, count);
+        double expo = now_sec() - start;
+        total += samples[count - 1];
+        printf("%-8s double %5.2f ns  float %5.2f ns  normal %5.2f ns  exponential %5.2f ns\n", gen_names[g],
+               uniform / count * 1e9, single / count * 1e9, gauss / count * 1e9, expo / count * 1e9);
+    }
+    free(samples);
+
+    printf("\n");
+    for(size_t i = 0; i < count; i++) {
+        buf[i] = i;
+    }
+    start = now_sec();
+    rand64_shuffle(&gens[0], buf, count, sizeof(uint64_t));
+    double serial = now_sec() - start;
+    sink += buf[0];
+    start = now_sec();
+    if(rand64_shuffle_parallel(buf, count, sizeof(uint64_t), 1, 0) < 0) {
+        fprintf(stderr, "rand64-bench: fatal error: out of memory\n");
+        return 1;
+    }
+    double parallel = now_sec() - start;
+    sink += buf[0];
+    printf("rand64_shuffle           %6.2f ns per element\n", serial / count * 1e9);
+    printf("rand64_shuffle_parallel  %6.2f ns per element\n", parallel / count * 1e9);
+    printf("\n%016llx %f\n", (unsigned long long)sink, total);
+    free(buf);
+    return 0;
+}
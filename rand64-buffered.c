@@ -0,0 +1,91 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "rand64.h"
+
+// 64 values is half a KiB per thread and makes the refill call cheap next
+// to the rdrands it does.
+#define BUFFER_SIZE 64
+
+__extension__ typedef unsigned __int128 uint128;
+
+static __thread uint64_t buffer[BUFFER_SIZE];
+static __thread size_t   left;
+static uint64_t          failures;
+static pthread_once_t    once = PTHREAD_ONCE_INIT;
+
+// Values still in the buffer were meant for the parent, a forked child
+// must not hand the same ones out again.
+static void forked(void) {
+    left = 0;
+}
+
+static void setup(void) {
+    pthread_atfork(NULL, NULL, forked);
+}
+
+static void refill(void) {
+    pthread_once(&once, setup);
+    size_t got = rand64_fill(buffer, BUFFER_SIZE);
+    while(got == 0) {
+        // rdrand only runs dry when many cores hammer it, give them a
+        // moment before trying again.
+        __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+        sched_yield();
+        got = rand64_fill(buffer, BUFFER_SIZE);
+    }
+    if(got < BUFFER_SIZE) {
+        __atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+    }
+    left = got;
+}
+
+uint64_t rand64_buffered(void) {
+    if(left == 0) {
+        refill();
+    }
+    return buffer[--left];
+}
+
+// Lemire's multiply and shift like rand64_bounded.
+uint64_t rand64_buffered_maximum(uint64_t max) {
+    uint64_t range = max + 1;
+    if(range == 0) {
+        return rand64_buffered();
+    }
+    uint128  m   = (uint128)rand64_buffered() * range;
+    uint64_t low = (uint64_t)m;
+    if(low < range) {
+        uint64_t threshold = -range % range;
+        while(low < threshold) {
+            m   = (uint128)rand64_buffered() * range;
+            low = (uint64_t)m;
+        }
+    }
+    return m >> 64;
+}
+
+uint64_t rand64_failures(void) {
+    return __atomic_load_n(&failures, __ATOMIC_RELAXED);
+}
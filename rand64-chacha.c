@@ -0,0 +1,386 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// ChaCha20 keystream as a CSPRNG, one per thread. Each refill makes a
+// batch of blocks, the first 32 bytes become the next key and the rest is
+// handed out, zeroing every byte once it's gone (Bernstein's fast key
+// erasure). So whatever is read out of memory later can't give back what
+// was already returned. Fresh entropy from rdseed (or /dev/urandom) is
+// mixed into the key every RESEED_BYTES or RESEED_SECONDS, and a forked
+// child throws its copy away and starts over.
+
+#define _DEFAULT_SOURCE
+#include <cpuid.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "rand64.h"
+
+#define BATCH_BLOCKS   64 // 4 KiB per refill, a multiple of eight.
+#define BATCH_BYTES    (BATCH_BLOCKS * 64)
+#define RESEED_BYTES   ((uint64_t)1 << 30)
+#define RESEED_SECONDS 60
+
+__extension__ typedef unsigned __int128 uint128;
+
+typedef struct Secure {
+    uint32_t key[8];
+    uint8_t  batch[BATCH_BYTES];
+    size_t   left;     // Unread bytes at the end of batch.
+    uint64_t bytes;    // Made since the last reseed.
+    time_t   reseeded; // Seconds on the monotonic clock.
+    int      seeded;
+} Secure;
+
+static __thread Secure  secure;
+static pthread_once_t   once = PTHREAD_ONCE_INIT;
+static int              has_rdseed;
+
+static const uint32_t sigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 };
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define QR(a, b, c, d) (                   \
+    a += b, d ^= a, d = ROTL32(d, 16),     \
+    c += d, b ^= c, b = ROTL32(b, 12),     \
+    a += b, d ^= a, d = ROTL32(d, 8),      \
+    c += d, b ^= c, b = ROTL32(b, 7)       \
+)
+
+// Block counter in words 12 and 13, the nonce words stay zero since every
+// key is only ever used for one batch.
+static void chacha_block(const uint32_t key[8], uint64_t counter, uint8_t *out) {
+    uint32_t in[16];
+    uint32_t x[16];
+    memcpy(in, sigma, 16);
+    memcpy(in + 4, key, 32);
+    in[12] = (uint32_t)counter;
+    in[13] = counter >> 32;
+    in[14] = 0;
+    in[15] = 0;
+    memcpy(x, in, sizeof(x));
+    for(int i = 0; i < 10; i++) {
+        QR(x[0], x[4], x[8],  x[12]);
+        QR(x[1], x[5], x[9],  x[13]);
+        QR(x[2], x[6], x[10], x[14]);
+        QR(x[3], x[7], x[11], x[15]);
+        QR(x[0], x[5], x[10], x[15]);
+        QR(x[1], x[6], x[11], x[12]);
+        QR(x[2], x[7], x[8],  x[13]);
+        QR(x[3], x[4], x[9],  x[14]);
+    }
+    for(int i = 0; i < 16; i++) {
+        x[i] += in[i];
+    }
+    memcpy(out, x, 64);
+}
+
+#ifdef __AVX2__
+// Rotating by 16 and 8 moves whole bytes, a shuffle does that in one go.
+#define ROTL_X8(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#define QR_X8(a, b, c, d) (                                                               \
+    a = _mm256_add_epi32(a, b), d = _mm256_xor_si256(d, a), d = _mm256_shuffle_epi8(d, rot16), \
+    c = _mm256_add_epi32(c, d), b = _mm256_xor_si256(b, c), b = ROTL_X8(b, 12),           \
+    a = _mm256_add_epi32(a, b), d = _mm256_xor_si256(d, a), d = _mm256_shuffle_epi8(d, rot8),  \
+    c = _mm256_add_epi32(c, d), b = _mm256_xor_si256(b, c), b = ROTL_X8(b, 7)             \
+)
+
+// Eight blocks at once, lane j of every word belongs to block counter + j.
+static void chacha_x8(const uint32_t key[8], uint64_t counter, uint8_t *out) {
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8  = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                           3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    __m256i  in[16];
+    __m256i  x[16];
+    uint32_t lo[8];
+    uint32_t hi[8];
+    for(int i = 0; i < 4; i++) {
+        in[i] = _mm256_set1_epi32(sigma[i]);
+    }
+    for(int i = 0; i < 8; i++) {
+        in[i + 4] = _mm256_set1_epi32(key[i]);
+        lo[i]     = (uint32_t)(counter + i);
+        hi[i]     = (counter + i) >> 32;
+    }
+    in[12] = _mm256_loadu_si256((const __m256i*)lo);
+    in[13] = _mm256_loadu_si256((const __m256i*)hi);
+    in[14] = _mm256_setzero_si256();
+    in[15] = _mm256_setzero_si256();
+    memcpy(x, in, sizeof(x));
+    for(int i = 0; i < 10; i++) {
+        QR_X8(x[0], x[4], x[8],  x[12]);
+        QR_X8(x[1], x[5], x[9],  x[13]);
+        QR_X8(x[2], x[6], x[10], x[14]);
+        QR_X8(x[3], x[7], x[11], x[15]);
+        QR_X8(x[0], x[5], x[10], x[15]);
+        QR_X8(x[1], x[6], x[11], x[12]);
+        QR_X8(x[2], x[7], x[8],  x[13]);
+        QR_X8(x[3], x[4], x[9],  x[14]);
+    }
+    // Four words of eight blocks at a time, transposed back into blocks. The
+    // unpacks work within 128 bit halves so the low half ends up with block
+    // j and the high half with block j + 4.
+    for(int g = 0; g < 4; g++) {
+        __m256i w0 = _mm256_add_epi32(x[g * 4],     in[g * 4]);
+        __m256i w1 = _mm256_add_epi32(x[g * 4 + 1], in[g * 4 + 1]);
+        __m256i w2 = _mm256_add_epi32(x[g * 4 + 2], in[g * 4 + 2]);
+        __m256i w3 = _mm256_add_epi32(x[g * 4 + 3], in[g * 4 + 3]);
+        __m256i t0 = _mm256_unpacklo_epi32(w0, w1);
+        __m256i t1 = _mm256_unpacklo_epi32(w2, w3);
+        __m256i t2 = _mm256_unpackhi_epi32(w0, w1);
+        __m256i t3 = _mm256_unpackhi_epi32(w2, w3);
+        __m256i b[4];
+        b[0] = _mm256_unpacklo_epi64(t0, t1);
+        b[1] = _mm256_unpackhi_epi64(t0, t1);
+        b[2] = _mm256_unpacklo_epi64(t2, t3);
+        b[3] = _mm256_unpackhi_epi64(t2, t3);
+        for(int j = 0; j < 4; j++) {
+            _mm_storeu_si128((__m128i*)(out + j * 64 + g * 16),       _mm256_castsi256_si128(b[j]));
+            _mm_storeu_si128((__m128i*)(out + (j + 4) * 64 + g * 16), _mm256_extracti128_si256(b[j], 1));
+        }
+    }
+}
+#elif defined(__SSE2__)
+#define ROTL_X4(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+#define QR_X4(a, b, c, d) (                                                       \
+    a = _mm_add_epi32(a, b), d = _mm_xor_si128(d, a), d = ROTL_X4(d, 16),        \
+    c = _mm_add_epi32(c, d), b = _mm_xor_si128(b, c), b = ROTL_X4(b, 12),        \
+    a = _mm_add_epi32(a, b), d = _mm_xor_si128(d, a), d = ROTL_X4(d, 8),         \
+    c = _mm_add_epi32(c, d), b = _mm_xor_si128(b, c), b = ROTL_X4(b, 7)          \
+)
+
+// Four blocks at once, lane j of every word belongs to block counter + j.
+static void chacha_x4(const uint32_t key[8], uint64_t counter, uint8_t *out) {
+    __m128i in[16];
+    __m128i x[16];
+    for(int i = 0; i < 4; i++) {
+        in[i] = _mm_set1_epi32(sigma[i]);
+    }
+    for(int i = 0; i < 8; i++) {
+        in[i + 4] = _mm_set1_epi32(key[i]);
+    }
+    uint64_t c0 = counter;
+    uint64_t c1 = counter + 1;
+    uint64_t c2 = counter + 2;
+    uint64_t c3 = counter + 3;
+    in[12] = _mm_setr_epi32(c0, c1, c2, c3);
+    in[13] = _mm_setr_epi32(c0 >> 32, c1 >> 32, c2 >> 32, c3 >> 32);
+    in[14] = _mm_setzero_si128();
+    in[15] = _mm_setzero_si128();
+    memcpy(x, in, sizeof(x));
+    for(int i = 0; i < 10; i++) {
+        QR_X4(x[0], x[4], x[8],  x[12]);
+        QR_X4(x[1], x[5], x[9],  x[13]);
+        QR_X4(x[2], x[6], x[10], x[14]);
+        QR_X4(x[3], x[7], x[11], x[15]);
+        QR_X4(x[0], x[5], x[10], x[15]);
+        QR_X4(x[1], x[6], x[11], x[12]);
+        QR_X4(x[2], x[7], x[8],  x[13]);
+        QR_X4(x[3], x[4], x[9],  x[14]);
+    }
+    // Four words of four blocks at a time, transposed back into blocks.
+    for(int g = 0; g < 4; g++) {
+        __m128i w0 = _mm_add_epi32(x[g * 4],     in[g * 4]);
+        __m128i w1 = _mm_add_epi32(x[g * 4 + 1], in[g * 4 + 1]);
+        __m128i w2 = _mm_add_epi32(x[g * 4 + 2], in[g * 4 + 2]);
+        __m128i w3 = _mm_add_epi32(x[g * 4 + 3], in[g * 4 + 3]);
+        __m128i t0 = _mm_unpacklo_epi32(w0, w1);
+        __m128i t1 = _mm_unpacklo_epi32(w2, w3);
+        __m128i t2 = _mm_unpackhi_epi32(w0, w1);
+        __m128i t3 = _mm_unpackhi_epi32(w2, w3);
+        _mm_storeu_si128((__m128i*)(out + g * 16),       _mm_unpacklo_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(out + g * 16 + 64),  _mm_unpackhi_epi64(t0, t1));
+        _mm_storeu_si128((__m128i*)(out + g * 16 + 128), _mm_unpacklo_epi64(t2, t3));
+        _mm_storeu_si128((__m128i*)(out + g * 16 + 192), _mm_unpackhi_epi64(t2, t3));
+    }
+}
+#endif
+
+// BATCH_BLOCKS blocks starting at counter, it's a multiple of eight.
+static void keystream(const uint32_t key[8], uint64_t counter, uint8_t *out) {
+#ifdef __AVX2__
+    for(int i = 0; i < BATCH_BLOCKS; i += 8) {
+        chacha_x8(key, counter + i, out + i * 64);
+    }
+#elif defined(__SSE2__)
+    for(int i = 0; i < BATCH_BLOCKS; i += 4) {
+        chacha_x4(key, counter + i, out + i * 64);
+    }
+#else
+    for(int i = 0; i < BATCH_BLOCKS; i++) {
+        chacha_block(key, counter + i, out + i * 64);
+    }
+#endif
+}
+
+static time_t monotonic_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+// Only the forking thread lives on in the child, so wiping its state is
+// enough to keep parent and child from handing out the same bytes.
+static void forked(void) {
+    memset(&secure, 0, sizeof(secure));
+}
+
+static void setup(void) {
+    unsigned a, b, c, d;
+    if(__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        has_rdseed = (b & bit_RDSEED) != 0;
+    }
+    pthread_atfork(NULL, NULL, forked);
+}
+
+static int entropy_urandom(uint32_t words[8]) {
+    int fd = open("/dev/urandom", O_RDONLY);
+    if(fd < 0) {
+        return 0;
+    }
+    ssize_t got = read(fd, words, 32);
+    close(fd);
+    return got == 32;
+}
+
+static void entropy(uint32_t words[8]) {
+    if(has_rdseed) {
+        uint64_t value;
+        int      i = 0;
+        while(i < 4 && rand64_rdseed(&value)) {
+            memcpy(words + i * 2, &value, 8);
+            i++;
+        }
+        if(i == 4) {
+            return;
+        }
+    }
+    if(!entropy_urandom(words)) {
+        // A CSPRNG with nothing to seed it from can't return anything safe.
+        fprintf(stderr, "rand64: fatal error: no entropy for the ChaCha20 key\n");
+        abort();
+    }
+}
+
+static void reseed(Secure *s) {
+    uint32_t fresh[8];
+    pthread_once(&once, setup);
+    entropy(fresh);
+    for(int i = 0; i < 8; i++) {
+        s->key[i] = s->seeded ? s->key[i] ^ fresh[i] : fresh[i];
+    }
+    memset(fresh, 0, sizeof(fresh));
+    s->bytes    = 0;
+    s->reseeded = monotonic_sec();
+    s->seeded   = 1;
+}
+
+static void check_reseed(Secure *s) {
+    if(!s->seeded || s->bytes >= RESEED_BYTES || monotonic_sec() - s->reseeded >= RESEED_SECONDS) {
+        reseed(s);
+    }
+}
+
+static void refill(Secure *s) {
+    check_reseed(s);
+    keystream(s->key, 0, s->batch);
+    memcpy(s->key, s->batch, 32);
+    memset(s->batch, 0, 32);
+    s->left   = BATCH_BYTES - 32;
+    s->bytes += BATCH_BYTES;
+}
+
+static inline void take(Secure *s, void *out, size_t n) {
+    uint8_t *from = s->batch + BATCH_BYTES - s->left;
+    memcpy(out, from, n);
+    memset(from, 0, n);
+    s->left -= n;
+}
+
+uint64_t rand64_secure(void) {
+    Secure  *s = &secure;
+    uint64_t value;
+    if(s->left < 8) {
+        refill(s);
+    }
+    take(s, &value, 8);
+    return value;
+}
+
+uint64_t rand64_secure_maximum(uint64_t max) {
+    uint64_t range = max + 1;
+    if(range == 0) {
+        return rand64_secure();
+    }
+    uint128  m   = (uint128)rand64_secure() * range;
+    uint64_t low = (uint64_t)m;
+    if(low < range) {
+        uint64_t threshold = -range % range;
+        while(low < threshold) {
+            m   = (uint128)rand64_secure() * range;
+            low = (uint64_t)m;
+        }
+    }
+    return m >> 64;
+}
+
+void rand64_secure_bytes(void *buf, size_t n) {
+    Secure  *s   = &secure;
+    uint8_t *out = buf;
+    while(n > 0) {
+        // Whole batches go straight out with the next key made from a block
+        // of its own, which saves copying and wiping them.
+        if(s->left == 0 && n >= BATCH_BYTES) {
+            uint8_t next[64];
+            check_reseed(s);
+            chacha_block(s->key, 0, next);
+            keystream(s->key, 1, out);
+            memcpy(s->key, next, 32);
+            memset(next, 0, sizeof(next));
+            s->bytes += BATCH_BYTES + 64;
+            out      += BATCH_BYTES;
+            n        -= BATCH_BYTES;
+            continue;
+        }
+        if(s->left == 0) {
+            refill(s);
+        }
+        size_t count = n < s->left ? n : s->left;
+        take(s, out, count);
+        out += count;
+        n   -= count;
+    }
+}
+
+size_t rand64_secure_fill(uint64_t *buf, size_t n) {
+    rand64_secure_bytes(buf, n * sizeof(uint64_t));
+    return n;
+}
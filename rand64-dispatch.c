@@ -0,0 +1,290 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Picks the backend behind rand64 the first time it's called. The
+// assembly in rand64.s only runs once CPUID says it can.
+
+#define _DEFAULT_SOURCE
+#include <cpuid.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rand64.h"
+
+// How many raw values rand64_bounded_fill draws before mapping them.
+#define BOUNDED_BLOCK 64
+
+__extension__ typedef unsigned __int128 uint128;
+
+typedef struct Backend {
+    Rand64Backend id;
+    uint64_t (*next)(void);
+    size_t   (*fill)(uint64_t *buf, size_t n);
+} Backend;
+
+typedef struct Xoshiro {
+    uint64_t s[4];
+    int      seeded;
+} Xoshiro;
+
+static int            has_rdrand;
+static int            has_rdseed;
+static const Backend *current;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+// One state per thread and seed source.
+static __thread Xoshiro cpu_state;
+static __thread Xoshiro os_state;
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t xoshiro_next(uint64_t s[4]) {
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t      = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3]  = rotl(s[3], 45);
+    return result;
+}
+
+static void seed_os(Xoshiro *x) {
+    int     fd  = open("/dev/urandom", O_RDONLY);
+    ssize_t got = -1;
+    if(fd >= 0) {
+        got = read(fd, x->s, sizeof(x->s));
+        close(fd);
+    }
+    if(got != sizeof(x->s)) {
+        // Anything made up from the time or addresses here would be easy
+        // to guess and could repeat across processes.
+        fprintf(stderr, "rand64: fatal error: no entropy to seed xoshiro256**\n");
+        abort();
+    }
+}
+
+// rdseed, then rdrand, then the OS for whatever the CPU couldn't give.
+static void seed_cpu(Xoshiro *x) {
+    for(int i = 0; i < 4; i++) {
+        if(has_rdseed && rand64_rdseed(&x->s[i])) {
+            continue;
+        }
+        if(has_rdrand) {
+            x->s[i] = rand64_rdrand();
+            continue;
+        }
+        seed_os(x);
+        return;
+    }
+}
+
+static inline uint64_t *cpu_words(void) {
+    if(!cpu_state.seeded) {
+        seed_cpu(&cpu_state);
+        cpu_state.seeded = 1;
+    }
+    return cpu_state.s;
+}
+
+static inline uint64_t *os_words(void) {
+    if(!os_state.seeded) {
+        seed_os(&os_state);
+        // All zero is the one state xoshiro can't leave.
+        if(!(os_state.s[0] | os_state.s[1] | os_state.s[2] | os_state.s[3])) {
+            os_state.s[0] = 1;
+        }
+        os_state.seeded = 1;
+    }
+    return os_state.s;
+}
+
+// Works on a copy so the stores to buf can't be taken as touching the state.
+static size_t xoshiro_fill(uint64_t state[4], uint64_t *buf, size_t n) {
+    uint64_t s[4] = { state[0], state[1], state[2], state[3] };
+    for(size_t i = 0; i < n; i++) {
+        buf[i] = xoshiro_next(s);
+    }
+    for(int i = 0; i < 4; i++) {
+        state[i] = s[i];
+    }
+    return n;
+}
+
+static uint64_t cpu_next(void) {
+    return xoshiro_next(cpu_words());
+}
+
+static size_t cpu_fill(uint64_t *buf, size_t n) {
+    return xoshiro_fill(cpu_words(), buf, n);
+}
+
+static uint64_t os_next(void) {
+    return xoshiro_next(os_words());
+}
+
+static size_t os_fill(uint64_t *buf, size_t n) {
+    return xoshiro_fill(os_words(), buf, n);
+}
+
+static const Backend backends[] = {
+    { RAND64_RDRAND,   rand64_rdrand, rand64_rdrand_fill },
+    { RAND64_XOSHIRO,  cpu_next,      cpu_fill           },
+    { RAND64_PORTABLE, os_next,       os_fill            },
+    { RAND64_CHACHA,   rand64_secure, rand64_secure_fill }
+};
+
+// Only the forking thread lives on in the child, wiping its states makes
+// the child seed its own instead of repeating the parent's values.
+static void forked(void) {
+    memset(&cpu_state, 0, sizeof(cpu_state));
+    memset(&os_state, 0, sizeof(os_state));
+}
+
+static void detect(void) {
+    unsigned a, b, c, d;
+    if(__get_cpuid(1, &a, &b, &c, &d)) {
+        has_rdrand = (c & bit_RDRND) != 0;
+    }
+    if(__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        has_rdseed = (b & bit_RDSEED) != 0;
+    }
+    pthread_atfork(NULL, NULL, forked);
+}
+
+static int supported(Rand64Backend backend) {
+    switch(backend) {
+        case RAND64_RDRAND:   return has_rdrand;
+        case RAND64_XOSHIRO:  return has_rdrand || has_rdseed;
+        case RAND64_PORTABLE: return 1;
+        case RAND64_CHACHA:   return 1;
+    }
+    return 0;
+}
+
+// Threads racing through here all land on the same pick. Callers use
+// rand64 for tokens and nonces, so the default has to be one nobody can
+// predict from earlier values, xoshiro is only there through rand64_use.
+static const Backend *pick(void) {
+    pthread_once(&once, detect);
+    const Backend *backend = &backends[has_rdrand ? RAND64_RDRAND : RAND64_CHACHA];
+    __atomic_store_n(&current, backend, __ATOMIC_RELEASE);
+    return backend;
+}
+
+static inline const Backend *get(void) {
+    const Backend *backend = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    return backend ? backend : pick();
+}
+
+uint64_t rand64(void) {
+    return get()->next();
+}
+
+size_t rand64_fill(uint64_t *buf, size_t n) {
+    return get()->fill(buf, n);
+}
+
+// Lemire's multiply and shift: the top half of x * range is the value and
+// the bottom half says whether x fell in the few that would bias it. The
+// modulo for that cutoff only runs once the bottom half is already below
+// range, which is range / 2^64 of the time.
+uint64_t rand64_bounded(uint64_t range) {
+    const Backend *backend = get();
+    if(range == 0) {
+        return backend->next();
+    }
+    uint128  m   = (uint128)backend->next() * range;
+    uint64_t low = (uint64_t)m;
+    if(low < range) {
+        uint64_t threshold = -range % range;
+        while(low < threshold) {
+            m   = (uint128)backend->next() * range;
+            low = (uint64_t)m;
+        }
+    }
+    return m >> 64;
+}
+
+uint64_t rand64_maximum(uint64_t max) {
+    // max + 1 wraps to 0 for the full range.
+    return rand64_bounded(max + 1);
+}
+
+// rdrand can come up short, rand64_rdrand finishes the job since it tries
+// until it gets a value.
+static void fill_all(const Backend *backend, uint64_t *buf, size_t n) {
+    size_t got = backend->fill(buf, n);
+    for(size_t i = got; i < n; i++) {
+        buf[i] = backend->next();
+    }
+}
+
+void rand64_bounded_fill(uint64_t *buf, size_t n, uint64_t range) {
+    const Backend *backend = get();
+    if(range == 0) {
+        fill_all(backend, buf, n);
+        return;
+    }
+    uint64_t threshold = 0;
+    int      have      = 0;
+    // Raw values go straight into buf a block at a time and get mapped in
+    // place while they're still in cache.
+    for(size_t start = 0; start < n; start += BOUNDED_BLOCK) {
+        size_t count = n - start < BOUNDED_BLOCK ? n - start : BOUNDED_BLOCK;
+        fill_all(backend, buf + start, count);
+        for(size_t i = start; i < start + count; i++) {
+            uint128  m   = (uint128)buf[i] * range;
+            uint64_t low = (uint64_t)m;
+            if(low < range) {
+                if(!have) {
+                    threshold = -range % range;
+                    have      = 1;
+                }
+                while(low < threshold) {
+                    m   = (uint128)backend->next() * range;
+                    low = (uint64_t)m;
+                }
+            }
+            buf[i] = m >> 64;
+        }
+    }
+}
+
+int rand64_use(Rand64Backend backend) {
+    get();
+    if(backend < RAND64_RDRAND || backend > RAND64_CHACHA || !supported(backend)) {
+        return -1;
+    }
+    __atomic_store_n(&current, &backends[backend], __ATOMIC_RELEASE);
+    return 0;
+}
+
+Rand64Backend rand64_backend(void) {
+    return get()->id;
+}
@@ -0,0 +1,178 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Philox4x32-10 from Salmon et al, "Parallel Random Numbers: As Easy as
+// 1, 2, 3". Each 128 bit block is ten rounds of multiply and xor over a
+// counter under a key, so any block can be made straight from its index.
+// The low half of the counter is the block, the high half the stream.
+
+#include "rand64.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#define PHILOX_M0 0xD2511F53
+#define PHILOX_M1 0xCD9E8D57
+#define PHILOX_W0 0x9E3779B9
+#define PHILOX_W1 0xBB67AE85
+#define ROUNDS    10
+
+static void philox_block(const uint32_t key[2], uint64_t block, uint64_t stream, uint64_t out[2]) {
+    uint32_t c0 = (uint32_t)block;
+    uint32_t c1 = block >> 32;
+    uint32_t c2 = (uint32_t)stream;
+    uint32_t c3 = stream >> 32;
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for(int r = 0; r < ROUNDS; r++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0  = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1  = (uint32_t)p1;
+        c2  = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3  = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0 | (uint64_t)c1 << 32;
+    out[1] = c2 | (uint64_t)c3 << 32;
+}
+
+#ifdef __AVX2__
+// Full 32 x 32 multiply of every lane, mul_epu32 only does the even ones
+// so the odd ones get shifted down for a second.
+#define MULHILO(x, m, hi, lo) do {                                  \
+    __m256i even_ = _mm256_mul_epu32(x, m);                         \
+    __m256i odd_  = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), m);  \
+    hi = _mm256_blend_epi32(_mm256_srli_epi64(even_, 32), odd_, 0xAA); \
+    lo = _mm256_blend_epi32(even_, _mm256_slli_epi64(odd_, 32), 0xAA); \
+} while(0)
+
+// Eight blocks at once, one per lane. The low word of block can't carry
+// within the eight, the caller makes sure.
+static void philox_x8(const uint32_t key[2], uint64_t block, uint64_t stream, uint64_t *out) {
+    const __m256i m0 = _mm256_set1_epi64x(PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi64x(PHILOX_M1);
+    __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((uint32_t)block), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i c1 = _mm256_set1_epi32(block >> 32);
+    __m256i c2 = _mm256_set1_epi32((uint32_t)stream);
+    __m256i c3 = _mm256_set1_epi32(stream >> 32);
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+    for(int r = 0; r < ROUNDS; r++) {
+        __m256i hi0, lo0, hi1, lo1;
+        MULHILO(c0, m0, hi0, lo0);
+        MULHILO(c2, m1, hi1, lo1);
+        c0  = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(k0));
+        c1  = lo1;
+        c2  = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(k1));
+        c3  = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    // Lanes hold one word of each block, turn that into whole blocks. The
+    // unpacks work within 128 bit halves so blocks come out as 0|4, 1|5...
+    __m256i a_lo = _mm256_unpacklo_epi32(c0, c1);
+    __m256i a_hi = _mm256_unpackhi_epi32(c0, c1);
+    __m256i b_lo = _mm256_unpacklo_epi32(c2, c3);
+    __m256i b_hi = _mm256_unpackhi_epi32(c2, c3);
+    __m256i r0   = _mm256_unpacklo_epi64(a_lo, b_lo);
+    __m256i r1   = _mm256_unpackhi_epi64(a_lo, b_lo);
+    __m256i r2   = _mm256_unpacklo_epi64(a_hi, b_hi);
+    __m256i r3   = _mm256_unpackhi_epi64(a_hi, b_hi);
+    _mm256_storeu_si256((__m256i*)out,        _mm256_permute2x128_si256(r0, r1, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 4),  _mm256_permute2x128_si256(r2, r3, 0x20));
+    _mm256_storeu_si256((__m256i*)(out + 8),  _mm256_permute2x128_si256(r0, r1, 0x31));
+    _mm256_storeu_si256((__m256i*)(out + 12), _mm256_permute2x128_si256(r2, r3, 0x31));
+}
+#endif
+
+void rand64_philox_init(Rand64Philox *philox, uint64_t seed, uint64_t stream) {
+    philox->key[0]   = (uint32_t)seed;
+    philox->key[1]   = seed >> 32;
+    philox->stream   = stream;
+    philox->position = 0;
+    philox->spare    = 0;
+}
+
+uint64_t rand64_philox(Rand64Philox *philox) {
+    if(philox->position & 1) {
+        philox->position++;
+        return philox->spare;
+    }
+    uint64_t out[2];
+    philox_block(philox->key, philox->position >> 1, philox->stream, out);
+    philox->spare = out[1];
+    philox->position++;
+    return out[0];
+}
+
+void rand64_philox_fill(Rand64Philox *philox, uint64_t *buf, size_t n) {
+    size_t i = 0;
+    // An odd position would get rounded down below.
+    if(n == 0) {
+        return;
+    }
+    if(philox->position & 1) {
+        buf[i++] = philox->spare;
+        philox->position++;
+    }
+    uint64_t block = philox->position >> 1;
+#ifdef __AVX2__
+    while(n - i >= 16) {
+        if((uint32_t)block <= UINT32_MAX - 7) {
+            philox_x8(philox->key, block, philox->stream, buf + i);
+            block += 8;
+            i     += 16;
+        } else {
+            philox_block(philox->key, block, philox->stream, buf + i);
+            block += 1;
+            i     += 2;
+        }
+    }
+#endif
+    while(n - i >= 2) {
+        philox_block(philox->key, block, philox->stream, buf + i);
+        block += 1;
+        i     += 2;
+    }
+    philox->position = block << 1;
+    if(i < n) {
+        uint64_t out[2];
+        philox_block(philox->key, block, philox->stream, out);
+        buf[i]        = out[0];
+        philox->spare = out[1];
+        philox->position++;
+    }
+}
+
+void rand64_philox_seek(Rand64Philox *philox, uint64_t position) {
+    philox->position = position;
+    if(position & 1) {
+        uint64_t out[2];
+        philox_block(philox->key, position >> 1, philox->stream, out);
+        philox->spare = out[1];
+    }
+}
+
+void rand64_philox_skip(Rand64Philox *philox, uint64_t count) {
+    rand64_philox_seek(philox, philox->position + count);
+}
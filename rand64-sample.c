@@ -0,0 +1,283 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Bulk samplers on top of any of the generators. Raw values are made a
+// block at a time and turned into doubles or floats four or more at once.
+// Normal and exponential use the ziggurat: 256 layers of equal area, nearly
+// every value is a table lookup and a multiply, and the few that land
+// outside a layer's rectangle are finished off one by one.
+
+#include <math.h>
+#include <pthread.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "rand64.h"
+
+#define BLOCK  256
+#define LAYERS 256
+
+// Normal and exponential ziggurats from Marsaglia and Tsang, "The
+// Ziggurat Method for Generating Random Variables". R is where the tail
+// starts and V the area of every layer.
+#define NORMAL_R      3.6541528853610088
+#define NORMAL_V      0.00492867323399
+#define EXPONENTIAL_R 7.69711747013104972
+#define EXPONENTIAL_V 0.0039496598225815571993
+
+typedef struct Ziggurat {
+    double x[LAYERS + 1]; // Right edge of each layer, x[0] stretched to hold the tail's area.
+    double f[LAYERS + 1]; // The density at each edge.
+} Ziggurat;
+
+static Ziggurat       normal;
+static Ziggurat       exponential;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static double normal_pdf(double x) {
+    return exp(-x * x / 2);
+}
+
+static double normal_inverse(double y) {
+    return sqrt(-2 * log(y));
+}
+
+static double exponential_pdf(double x) {
+    return exp(-x);
+}
+
+static double exponential_inverse(double y) {
+    return -log(y);
+}
+
+// Each layer sits on the one below with the same area, the top one ends
+// at 0 with a density of 1.
+static void build(Ziggurat *z, double r, double v, double (*pdf)(double), double (*inverse)(double)) {
+    z->x[0] = v / pdf(r);
+    z->x[1] = r;
+    for(int i = 1; i < LAYERS - 1; i++) {
+        z->x[i + 1] = inverse(pdf(z->x[i]) + v / z->x[i]);
+    }
+    z->x[LAYERS] = 0;
+    for(int i = 0; i <= LAYERS; i++) {
+        z->f[i] = pdf(z->x[i]);
+    }
+}
+
+static void setup(void) {
+    build(&normal,      NORMAL_R,      NORMAL_V,      normal_pdf,      normal_inverse);
+    build(&exponential, EXPONENTIAL_R, EXPONENTIAL_V, exponential_pdf, exponential_inverse);
+}
+
+static void fill_default(void *state, uint64_t *buf, size_t n) {
+    (void)state;
+    size_t got = rand64_fill(buf, n);
+    for(size_t i = got; i < n; i++) {
+        buf[i] = rand64();
+    }
+}
+
+static void fill_secure(void *state, uint64_t *buf, size_t n) {
+    (void)state;
+    rand64_secure_fill(buf, n);
+}
+
+static void fill_philox(void *state, uint64_t *buf, size_t n) {
+    rand64_philox_fill(state, buf, n);
+}
+
+void rand64_gen_init(Rand64Gen *gen) {
+    gen->fill  = fill_default;
+    gen->state = NULL;
+}
+
+void rand64_gen_init_secure(Rand64Gen *gen) {
+    gen->fill  = fill_secure;
+    gen->state = NULL;
+}
+
+void rand64_gen_init_philox(Rand64Gen *gen, Rand64Philox *philox) {
+    gen->fill  = fill_philox;
+    gen->state = philox;
+}
+
+static inline uint64_t next(const Rand64Gen *gen) {
+    uint64_t value;
+    gen->fill(gen->state, &value, 1);
+    return value;
+}
+
+// Top 53 bits over 2^53, every double in [0, 1) that's a multiple of 2^-53.
+static inline double to_double(uint64_t x) {
+    return (x >> 11) * 0x1.0p-53;
+}
+
+#ifdef __AVX2__
+// to_double for four values, AVX2 can't convert 64 bit integers. The top
+// 52 bits under the exponent of 1.0 make [1, 2), and the 53rd is added
+// back after taking the 1 off. Both steps are exact so it gives the same
+// doubles as to_double.
+static inline __m256d to_double_x4(__m256i x) {
+    const __m256i one   = _mm256_set1_epi64x(0x3FF0000000000000);
+    const __m256i ulp   = _mm256_set1_epi64x(0x3CA0000000000000); // 2^-53
+    __m256d       upper = _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(x, 12), one));
+    __m256i       bit   = _mm256_and_si256(_mm256_srli_epi64(x, 11), _mm256_set1_epi64x(1));
+    __m256i       low   = _mm256_and_si256(_mm256_sub_epi64(_mm256_setzero_si256(), bit), ulp);
+    return _mm256_add_pd(_mm256_sub_pd(upper, _mm256_set1_pd(1.0)), _mm256_castsi256_pd(low));
+}
+#endif
+
+void rand64_double_fill(const Rand64Gen *gen, double *out, size_t n) {
+    uint64_t raw[BLOCK];
+    for(size_t start = 0; start < n; start += BLOCK) {
+        size_t count = n - start < BLOCK ? n - start : BLOCK;
+        size_t i     = 0;
+        gen->fill(gen->state, raw, count);
+#ifdef __AVX2__
+        for(; i + 4 <= count; i += 4) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(raw + i));
+            _mm256_storeu_pd(out + start + i, to_double_x4(x));
+        }
+#endif
+        for(; i < count; i++) {
+            out[start + i] = to_double(raw[i]);
+        }
+    }
+}
+
+// Two floats out of every value, 24 bits each.
+void rand64_float_fill(const Rand64Gen *gen, float *out, size_t n) {
+    uint64_t raw[BLOCK];
+    for(size_t start = 0; start < n; start += BLOCK * 2) {
+        size_t count = n - start < BLOCK * 2 ? n - start : BLOCK * 2;
+        gen->fill(gen->state, raw, (count + 1) / 2);
+        for(size_t i = 0; i < count / 2; i++) {
+            out[start + i * 2]     = ((uint32_t)raw[i] >> 8) * 0x1.0p-24f;
+            out[start + i * 2 + 1] = (raw[i] >> 40) * 0x1.0p-24f;
+        }
+        if(count & 1) {
+            out[start + count - 1] = ((uint32_t)raw[count / 2] >> 8) * 0x1.0p-24f;
+        }
+    }
+}
+
+// Low 8 bits pick the layer, the top 53 the spot in it, so the two don't
+// share bits.
+static inline int    layer(uint64_t x)      { return x & (LAYERS - 1); }
+static inline double signed_unit(uint64_t x) { return 2 * to_double(x) - 1; }
+
+// Everything past the fast test, for a value that fell outside its
+// layer's rectangle. Starts from that value and draws fresh ones until
+// one is accepted, which is the same as having run the whole algorithm.
+static double normal_slow(const Rand64Gen *gen, uint64_t bits) {
+    for(;;) {
+        int    i = layer(bits);
+        double u = signed_unit(bits);
+        double x = u * normal.x[i];
+        if(fabs(x) < normal.x[i + 1]) {
+            return x;
+        }
+        if(i == 0) {
+            // The tail past R, Marsaglia's method.
+            double t;
+            double y;
+            do {
+                t = -log(1 - to_double(next(gen))) / NORMAL_R;
+                y = -log(1 - to_double(next(gen)));
+            } while(2 * y < t * t);
+            return u < 0 ? -(NORMAL_R + t) : NORMAL_R + t;
+        }
+        if(normal.f[i + 1] + (normal.f[i] - normal.f[i + 1]) * to_double(next(gen)) < normal_pdf(x)) {
+            return x;
+        }
+        bits = next(gen);
+    }
+}
+
+static double exponential_slow(const Rand64Gen *gen, uint64_t bits) {
+    for(;;) {
+        int    i = layer(bits);
+        double x = to_double(bits) * exponential.x[i];
+        if(x < exponential.x[i + 1]) {
+            return x;
+        }
+        if(i == 0) {
+            // No memory, so the tail is just R plus another one.
+            return EXPONENTIAL_R - log(1 - to_double(next(gen)));
+        }
+        if(exponential.f[i + 1] + (exponential.f[i] - exponential.f[i + 1]) * to_double(next(gen)) < exponential_pdf(x)) {
+            return x;
+        }
+        bits = next(gen);
+    }
+}
+
+// Takes the layer and spot from each value and keeps it if it's inside the
+// layer's rectangle, about 99 in 100 are. The rest go to slow. symmetric
+// is a constant in both callers, so each gets its own copy without it.
+static inline void ziggurat_fill(const Rand64Gen *gen, double *out, size_t n, const Ziggurat *z,
+                                 int symmetric, double (*slow)(const Rand64Gen*, uint64_t)) {
+    uint64_t raw[BLOCK];
+    pthread_once(&once, setup);
+    for(size_t start = 0; start < n; start += BLOCK) {
+        size_t count = n - start < BLOCK ? n - start : BLOCK;
+        size_t i     = 0;
+        gen->fill(gen->state, raw, count);
+#ifdef __AVX2__
+        const __m256i mask = _mm256_set1_epi64x(LAYERS - 1);
+        const __m256d abs  = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7FFFFFFFFFFFFFFF));
+        for(; i + 4 <= count; i += 4) {
+            __m256i r    = _mm256_loadu_si256((const __m256i*)(raw + i));
+            __m256i idx  = _mm256_and_si256(r, mask);
+            __m256d u    = to_double_x4(r);
+            if(symmetric) {
+                u = _mm256_sub_pd(_mm256_add_pd(u, u), _mm256_set1_pd(1.0));
+            }
+            __m256d x    = _mm256_mul_pd(u, _mm256_i64gather_pd(z->x, idx, 8));
+            __m256d edge = _mm256_i64gather_pd(z->x + 1, idx, 8);
+            __m256d test = symmetric ? _mm256_and_pd(x, abs) : x;
+            int     in   = _mm256_movemask_pd(_mm256_cmp_pd(test, edge, _CMP_LT_OQ));
+            _mm256_storeu_pd(out + start + i, x);
+            if(in != 0xF) {
+                for(int j = 0; j < 4; j++) {
+                    if(!(in & (1 << j))) {
+                        out[start + i + j] = slow(gen, raw[i + j]);
+                    }
+                }
+            }
+        }
+#endif
+        for(; i < count; i++) {
+            int    l = layer(raw[i]);
+            double x = (symmetric ? signed_unit(raw[i]) : to_double(raw[i])) * z->x[l];
+            out[start + i] = (symmetric ? fabs(x) : x) < z->x[l + 1] ? x : slow(gen, raw[i]);
+        }
+    }
+}
+
+void rand64_normal_fill(const Rand64Gen *gen, double *out, size_t n) {
+    ziggurat_fill(gen, out, n, &normal, 1, normal_slow);
+}
+
+void rand64_exponential_fill(const Rand64Gen *gen, double *out, size_t n) {
+    ziggurat_fill(gen, out, n, &exponential, 0, exponential_slow);
+}
@@ -0,0 +1,337 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Shuffling and sampling arrays of any element size. Random indexes are
+// drawn a block at a time with Lemire's multiply and shift. The parallel
+// shuffle needs pthreads.
+// gcc -O3 -c rand64-shuffle.c && link with -lpthread -lm
+
+#define _DEFAULT_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rand64.h"
+
+#define BLOCK        256
+#define CHUNK        (1 << 20) // Elements per scatter job.
+#define BUCKET_BYTES (1 << 18) // About what fits in L2.
+#define MAX_BUCKETS  4096
+#define MAX_THREADS  64
+
+__extension__ typedef unsigned __int128 uint128;
+
+static inline uint64_t next(const Rand64Gen *gen) {
+    uint64_t value;
+    gen->fill(gen->state, &value, 1);
+    return value;
+}
+
+// Maps the raw x into [0, range), drawing again on the rare reject.
+static inline uint64_t bounded(const Rand64Gen *gen, uint64_t x, uint64_t range) {
+    uint128  m   = (uint128)x * range;
+    uint64_t low = (uint64_t)m;
+    if(low < range) {
+        uint64_t threshold = -range % range;
+        while(low < threshold) {
+            m   = (uint128)next(gen) * range;
+            low = (uint64_t)m;
+        }
+    }
+    return m >> 64;
+}
+
+// In (0, 1), never 0 so it can go through log.
+static inline double open_unit(uint64_t x) {
+    return ((x >> 11) + 0.5) * 0x1.0p-53;
+}
+
+static inline void swap(uint8_t *a, uint8_t *b, size_t size) {
+    uint8_t tmp[64];
+    while(size > 0) {
+        size_t n = size < sizeof(tmp) ? size : sizeof(tmp);
+        memcpy(tmp, a, n);
+        memcpy(a, b, n);
+        memcpy(b, tmp, n);
+        a    += n;
+        b    += n;
+        size -= n;
+    }
+}
+
+// Fisher-Yates from the top down, with the raw draws made a block at a
+// time. Prefetching the swap targets was tried and came out slower, the
+// swaps don't depend on each other so the CPU already overlaps the misses.
+static inline void fisher_yates(const Rand64Gen *gen, uint8_t *base, size_t count, size_t size) {
+    uint64_t raw[BLOCK];
+    size_t   i = count;
+    while(i > 1) {
+        size_t batch = i - 1 < BLOCK ? i - 1 : BLOCK;
+        gen->fill(gen->state, raw, batch);
+        for(size_t b = 0; b < batch; b++, i--) {
+            swap(base + (i - 1) * size, base + bounded(gen, raw[b], i) * size, size);
+        }
+    }
+}
+
+// Constant sizes get their own copy so the swaps become plain moves.
+static void shuffle_any(const Rand64Gen *gen, void *base, size_t count, size_t size) {
+    switch(size) {
+        case 4:  fisher_yates(gen, base, count, 4);    break;
+        case 8:  fisher_yates(gen, base, count, 8);    break;
+        case 16: fisher_yates(gen, base, count, 16);   break;
+        default: fisher_yates(gen, base, count, size); break;
+    }
+}
+
+void rand64_shuffle(const Rand64Gen *gen, void *base, size_t count, size_t size) {
+    shuffle_any(gen, base, count, size);
+}
+
+// Floyd's algorithm: for each j from count - k up, take a random index up
+// to j, or j itself when that one's already taken. k draws and k slots of
+// memory no matter how big count is.
+static int sample_floyd(const Rand64Gen *gen, const uint8_t *base, size_t count, size_t size, uint8_t *out, size_t k) {
+    int bits = 1;
+    while(((size_t)1 << bits) < k * 2) {
+        bits++;
+    }
+    size_t    slots = (size_t)1 << bits;
+    uint64_t *taken = calloc(slots, sizeof(uint64_t)); // Index + 1, 0 is empty.
+    if(taken == NULL) {
+        return -1;
+    }
+    uint64_t raw[BLOCK];
+    size_t   found = 0;
+    for(size_t j = count - k; j < count;) {
+        size_t batch = count - j < BLOCK ? count - j : BLOCK;
+        gen->fill(gen->state, raw, batch);
+        for(size_t b = 0; b < batch; b++, j++) {
+            uint64_t pick = bounded(gen, raw[b], j + 1);
+            for(int pass = 0; pass < 2; pass++) {
+                size_t slot = (pick * 0x9E3779B97F4A7C15) >> (64 - bits);
+                while(taken[slot] != 0 && taken[slot] != pick + 1) {
+                    slot = (slot + 1) & (slots - 1);
+                }
+                if(taken[slot] == 0) {
+                    taken[slot] = pick + 1;
+                    break;
+                }
+                // Already in, j can't be since it's bigger than any before.
+                pick = j;
+            }
+            memcpy(out + found++ * size, base + pick * size, size);
+        }
+    }
+    free(taken);
+    return 0;
+}
+
+// Li's Algorithm L: after the first k the gaps between replacements are
+// drawn directly, so it takes about k * log(count / k) draws and reads the
+// array front to back.
+static void sample_reservoir(const Rand64Gen *gen, const uint8_t *base, size_t count, size_t size, uint8_t *out, size_t k) {
+    memcpy(out, base, k * size);
+    double w = exp(log(open_unit(next(gen))) / k);
+    size_t i = k - 1;
+    for(;;) {
+        double skip = floor(log(open_unit(next(gen))) / log1p(-w)) + 1;
+        if(skip >= count - i) {
+            break;
+        }
+        i += (size_t)skip;
+        memcpy(out + bounded(gen, next(gen), k) * size, base + i * size, size);
+        w *= exp(log(open_unit(next(gen))) / k);
+    }
+}
+
+int rand64_sample_k(const Rand64Gen *gen, const void *base, size_t count, size_t size, void *out, size_t k) {
+    if(k > count) {
+        return -1;
+    }
+    if(k == 0) {
+        return 0;
+    }
+    // Floyd's table stays small next to the array, past that reading the
+    // array once is cheaper than a hash table as big as the sample.
+    if(k <= count / 8) {
+        return sample_floyd(gen, base, count, size, out, k);
+    }
+    sample_reservoir(gen, base, count, size, out, k);
+    return 0;
+}
+
+// The parallel shuffle sends every element to a random bucket, then
+// shuffles each bucket on its own. Independent uniform buckets followed by
+// uniform orders within them is a uniform order of the whole. Buckets are
+// sized to stay in cache so the second pass runs at memory speed, and the
+// first only writes to a few thousand places at a time.
+typedef struct ShuffleJob {
+    uint8_t  *base;
+    uint8_t  *scratch;
+    size_t    count;
+    size_t    size;
+    uint64_t  seed;
+    size_t    chunks;
+    size_t    buckets;
+    int       bits;
+    size_t   *offsets; // Per chunk and bucket, first counts then write positions.
+    size_t   *starts;  // Where each bucket begins, buckets + 1 of them.
+    int       phase;
+    uint64_t  next;    // Next chunk or bucket to claim, shared by all workers.
+} ShuffleJob;
+
+enum { PHASE_COUNT, PHASE_SCATTER, PHASE_SHUFFLE };
+
+// Chunk c draws its buckets from Philox stream c, so counting and then
+// scattering see the same draws without keeping them around.
+static void chunk_pass(ShuffleJob *job, size_t chunk, int scatter) {
+    Rand64Philox philox;
+    uint64_t     raw[BLOCK];
+    size_t      *offsets = job->offsets + chunk * job->buckets;
+    size_t       first   = chunk * CHUNK;
+    size_t       last    = first + CHUNK < job->count ? first + CHUNK : job->count;
+    rand64_philox_init(&philox, job->seed, chunk);
+    for(size_t start = first; start < last; start += BLOCK) {
+        size_t batch = last - start < BLOCK ? last - start : BLOCK;
+        rand64_philox_fill(&philox, raw, batch);
+        for(size_t i = 0; i < batch; i++) {
+            size_t bucket = raw[i] >> (64 - job->bits);
+            if(scatter) {
+                memcpy(job->scratch + offsets[bucket]++ * job->size, job->base + (start + i) * job->size, job->size);
+            } else {
+                offsets[bucket]++;
+            }
+        }
+    }
+}
+
+// Bucket b gets stream 2^63 + b, well clear of the chunk streams.
+static void bucket_pass(ShuffleJob *job, size_t bucket) {
+    Rand64Philox philox;
+    Rand64Gen    gen;
+    size_t       start = job->starts[bucket];
+    size_t       count = job->starts[bucket + 1] - start;
+    rand64_philox_init(&philox, job->seed, ((uint64_t)1 << 63) | bucket);
+    rand64_gen_init_philox(&gen, &philox);
+    shuffle_any(&gen, job->scratch + start * job->size, count, job->size);
+    memcpy(job->base + start * job->size, job->scratch + start * job->size, count * job->size);
+}
+
+static void* shuffle_worker(void *arg) {
+    ShuffleJob *job   = arg;
+    size_t      total = job->phase == PHASE_SHUFFLE ? job->buckets : job->chunks;
+    for(;;) {
+        uint64_t item = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if(item >= total) {
+            break;
+        }
+        if(job->phase == PHASE_SHUFFLE) {
+            bucket_pass(job, item);
+        } else {
+            chunk_pass(job, item, job->phase == PHASE_SCATTER);
+        }
+    }
+    return NULL;
+}
+
+// This thread works too, so only start threads - 1. If some fail to start
+// the rest just pick up more.
+static void run_phase(ShuffleJob *job, int phase, int threads) {
+    pthread_t workers[MAX_THREADS];
+    int       started = 0;
+    job->phase = phase;
+    job->next  = 0;
+    for(int i = 1; i < threads; i++) {
+        if(pthread_create(&workers[started], NULL, shuffle_worker, job) == 0) {
+            started++;
+        }
+    }
+    shuffle_worker(job);
+    for(int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+}
+
+int rand64_shuffle_parallel(void *base, size_t count, size_t size, uint64_t seed, int threads) {
+    ShuffleJob job;
+    // The scratch copy is count * size bytes.
+    if(size != 0 && count > SIZE_MAX / size) {
+        return -1;
+    }
+    job.base    = base;
+    job.count   = count;
+    job.size    = size;
+    job.seed    = seed;
+    job.chunks  = (count + CHUNK - 1) / CHUNK;
+    job.bits    = 0;
+    while(((size_t)1 << job.bits) < MAX_BUCKETS && ((size_t)BUCKET_BYTES << job.bits) < count * size) {
+        job.bits++;
+    }
+    job.buckets = (size_t)1 << job.bits;
+    // Small enough to stay in cache anyway.
+    if(job.bits == 0) {
+        Rand64Philox philox;
+        Rand64Gen    gen;
+        rand64_philox_init(&philox, seed, (uint64_t)1 << 63);
+        rand64_gen_init_philox(&gen, &philox);
+        shuffle_any(&gen, base, count, size);
+        return 0;
+    }
+    job.scratch = malloc(count * size);
+    job.offsets = calloc(job.chunks * job.buckets, sizeof(size_t));
+    job.starts  = malloc((job.buckets + 1) * sizeof(size_t));
+    if(job.scratch == NULL || job.offsets == NULL || job.starts == NULL) {
+        free(job.scratch);
+        free(job.offsets);
+        free(job.starts);
+        return -1;
+    }
+
+    if(threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    run_phase(&job, PHASE_COUNT, threads);
+    // Bucket by bucket and chunk by chunk within each, so where anything
+    // lands doesn't depend on which thread got there first.
+    size_t position = 0;
+    for(size_t b = 0; b < job.buckets; b++) {
+        job.starts[b] = position;
+        for(size_t c = 0; c < job.chunks; c++) {
+            size_t n = job.offsets[c * job.buckets + b];
+            job.offsets[c * job.buckets + b] = position;
+            position += n;
+        }
+    }
+    job.starts[job.buckets] = position;
+    run_phase(&job, PHASE_SCATTER, threads);
+    run_phase(&job, PHASE_SHUFFLE, threads);
+
+    free(job.scratch);
+    free(job.offsets);
+    free(job.starts);
+    return 0;
+}
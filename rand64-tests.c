@@ -0,0 +1,915 @@
+/*
+MIT License
+Copyright (c) 2022 Keith-Cancel
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the “Software”), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Checks for rand64. Philox has to give the Random123 known answers and
+// ChaCha20 the RFC 8439 ones, and the bulk paths have to give the same
+// values as one block at a time. The generator sources are pulled in whole
+// so the block functions can be called straight, some of the known answers
+// use counters the public API never reaches and ChaCha20 is never run on a
+// known key otherwise. The samplers and shuffles get moment, tail and
+// chi-square checks on fixed Philox seeds, with bounds loose enough that a
+// correct one only fails them about one run in millions, and the parallel
+// shuffle has to give the same permutation whatever the thread count.
+// rand64_fill is linked with --wrap so the buffered values and the default
+// sampler source can be fed short fills, the way rdrand comes up short when
+// many cores hammer it. Every generator with state gets forked after a
+// draw, and the child's values have to differ from the parent's. The
+// bounded draws get their edge ranges and chi-square checks on ranges
+// small and large.
+// make rand64-tests && ./rand64-tests
+
+// rand64-chacha.c goes first, it sets the feature macros it needs before
+// any system header.
+#include "rand64-chacha.c"
+#include "rand64-philox.c"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "rand64.h"
+
+static int failures = 0;
+
+static uint64_t rng_state = 0x243f6a8885a308d3;
+
+// splitmix64, only used to pick positions and lengths.
+static uint64_t rng_next(void) {
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static const char* verdict(int ok) {
+    if(!ok) {
+        failures++;
+    }
+    return ok ? "ok" : "FAIL";
+}
+
+// rand64_fill as the other objects see it. Passes through to the real one
+// unless told to give nothing for a few calls or leave values off the end.
+size_t __real_rand64_fill(uint64_t *buf, size_t n);
+
+static int    empty_fills = 0;
+static size_t short_by    = 0;
+static size_t fill_calls  = 0;
+
+size_t __wrap_rand64_fill(uint64_t *buf, size_t n) {
+    fill_calls++;
+    if(empty_fills > 0) {
+        empty_fills--;
+        return 0;
+    }
+    return __real_rand64_fill(buf, n > short_by ? n - short_by : 1);
+}
+
+// Philox4x32-10 answers from Random123's kat_vectors, counter and key words
+// low first.
+static void philox_known_answers(void) {
+    static const struct {
+        const char *name;
+        uint32_t    ctr[4];
+        uint32_t    key[2];
+        uint32_t    out[4];
+    } kats[] = {
+        { "zero",
+          { 0x00000000, 0x00000000, 0x00000000, 0x00000000 }, { 0x00000000, 0x00000000 },
+          { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+        { "all ones",
+          { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff },
+          { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+        { "pi",
+          { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 },
+          { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } },
+    };
+    printf("Philox4x32-10 known answers\n");
+    for(size_t i = 0; i < sizeof(kats) / sizeof(kats[0]); i++) {
+        uint64_t block  = kats[i].ctr[0] | (uint64_t)kats[i].ctr[1] << 32;
+        uint64_t stream = kats[i].ctr[2] | (uint64_t)kats[i].ctr[3] << 32;
+        uint64_t out[2];
+        philox_block(kats[i].key, block, stream, out);
+        int ok = out[0] == (kats[i].out[0] | (uint64_t)kats[i].out[1] << 32) &&
+                 out[1] == (kats[i].out[2] | (uint64_t)kats[i].out[3] << 32);
+        printf("  %-10s %016llx %016llx  %s\n", kats[i].name, (unsigned long long)out[0],
+               (unsigned long long)out[1], verdict(ok));
+    }
+    // The same answer through the public API where its counter is reachable.
+    Rand64Philox philox;
+    rand64_philox_init(&philox, 0, 0);
+    uint64_t a = rand64_philox(&philox);
+    uint64_t b = rand64_philox(&philox);
+    printf("  %-10s %016llx %016llx  %s\n", "zero, api", (unsigned long long)a, (unsigned long long)b,
+           verdict(a == 0xe169c58d6627e8d5 && b == 0x9b00dbd8bc57ac4c));
+}
+
+// n values from position by rand64_philox_fill against one block at a time.
+static int philox_fill_matches(uint64_t seed, uint64_t stream, uint64_t position, size_t n, uint64_t *buf) {
+    Rand64Philox philox;
+    rand64_philox_init(&philox, seed, stream);
+    rand64_philox_seek(&philox, position);
+    rand64_philox_fill(&philox, buf, n);
+    for(size_t i = 0; i < n; i++) {
+        uint64_t out[2];
+        uint64_t pos = position + i;
+        philox_block(philox.key, pos >> 1, stream, out);
+        if(buf[i] != out[pos & 1]) {
+            return 0;
+        }
+    }
+    // The state has to carry on where the fill stopped.
+    uint64_t out[2];
+    uint64_t pos = position + n;
+    philox_block(philox.key, pos >> 1, stream, out);
+    return philox.position == pos && rand64_philox(&philox) == out[pos & 1];
+}
+
+static void philox_fills(void) {
+    uint64_t buf[256];
+    int      odd   = 1;
+    int      carry = 1;
+    int      mixed = 1;
+    int      split = 1;
+    printf("Philox fills against single blocks\n");
+    // Every length up to a few AVX2 steps from every parity of position.
+    for(size_t n = 0; n <= 64; n++) {
+        odd &= philox_fill_matches(1, 0, 0, n, buf);
+        odd &= philox_fill_matches(1, 0, 1, n, buf);
+        odd &= philox_fill_matches(7, 3, 13, n, buf);
+    }
+    printf("  %-34s %s\n", "lengths 0-64, even and odd start", verdict(odd));
+    // Eight blocks at a time can't cross the low counter word wrapping, the
+    // fill has to step over it one block at a time and carry into the high
+    // word.
+    for(uint64_t back = 0; back < 40; back++) {
+        uint64_t block = ((uint64_t)1 << 32) - back;
+        carry &= philox_fill_matches(42, 5, block * 2, 96, buf);
+        carry &= philox_fill_matches(42, 5, block * 2 + 1, 97, buf);
+        carry &= philox_fill_matches(42, 5, (((uint64_t)9 << 32) - back) * 2 + 1, 64, buf);
+    }
+    printf("  %-34s %s\n", "across the 2^32 block carry", verdict(carry));
+    for(int i = 0; i < 2000; i++) {
+        uint64_t r = rng_next();
+        mixed &= philox_fill_matches(rng_next(), rng_next(), r >> 1, rng_next() % 256, buf);
+    }
+    printf("  %-34s %s\n", "random seeds, streams, positions", verdict(mixed));
+    // Chopping a fill up, or mixing in single draws, changes nothing.
+    Rand64Philox whole;
+    Rand64Philox parts;
+    uint64_t     want[256];
+    rand64_philox_init(&whole, 99, 1);
+    rand64_philox_init(&parts, 99, 1);
+    rand64_philox_fill(&whole, want, 256);
+    for(size_t i = 0; i < 256;) {
+        size_t n = rng_next() % 20;
+        n = n < 256 - i ? n : 256 - i;
+        if(n == 0) {
+            buf[i++] = rand64_philox(&parts);
+            continue;
+        }
+        rand64_philox_fill(&parts, buf + i, n);
+        i += n;
+    }
+    split = memcmp(buf, want, sizeof(want)) == 0;
+    rand64_philox_skip(&whole, 1000);
+    rand64_philox_seek(&parts, 1256);
+    split &= rand64_philox(&whole) == rand64_philox(&parts);
+    printf("  %-34s %s\n", "split fills, skip and seek", verdict(split));
+}
+
+// RFC 8439 appendix A.1, the ones with a zero nonce since the nonce words
+// are always zero here. Keys as bytes like the RFC has them.
+static void chacha_known_answers(void) {
+    static const struct {
+        uint8_t  key[32];
+        uint64_t counter;
+        uint8_t  out[64];
+    } kats[] = {
+        { { 0 }, 0,
+          { 0x76, 0xb8, 0xe0, 0xad, 0xa0, 0xf1, 0x3d, 0x90, 0x40, 0x5d, 0x6a, 0xe5, 0x53, 0x86, 0xbd, 0x28,
+            0xbd, 0xd2, 0x19, 0xb8, 0xa0, 0x8d, 0xed, 0x1a, 0xa8, 0x36, 0xef, 0xcc, 0x8b, 0x77, 0x0d, 0xc7,
+            0xda, 0x41, 0x59, 0x7c, 0x51, 0x57, 0x48, 0x8d, 0x77, 0x24, 0xe0, 0x3f, 0xb8, 0xd8, 0x4a, 0x37,
+            0x6a, 0x43, 0xb8, 0xf4, 0x15, 0x18, 0xa1, 0x1c, 0xc3, 0x87, 0xb6, 0x69, 0xb2, 0xee, 0x65, 0x86 } },
+        { { 0 }, 1,
+          { 0x9f, 0x07, 0xe7, 0xbe, 0x55, 0x51, 0x38, 0x7a, 0x98, 0xba, 0x97, 0x7c, 0x73, 0x2d, 0x08, 0x0d,
+            0xcb, 0x0f, 0x29, 0xa0, 0x48, 0xe3, 0x65, 0x69, 0x12, 0xc6, 0x53, 0x3e, 0x32, 0xee, 0x7a, 0xed,
+            0x29, 0xb7, 0x21, 0x76, 0x9c, 0xe6, 0x4e, 0x43, 0xd5, 0x71, 0x33, 0xb0, 0x74, 0xd8, 0x39, 0xd5,
+            0x31, 0xed, 0x1f, 0x28, 0x51, 0x0a, 0xfb, 0x45, 0xac, 0xe1, 0x0a, 0x1f, 0x4b, 0x79, 0x4d, 0x6f } },
+        { { [31] = 0x01 }, 1,
+          { 0x3a, 0xeb, 0x52, 0x24, 0xec, 0xf8, 0x49, 0x92, 0x9b, 0x9d, 0x82, 0x8d, 0xb1, 0xce, 0xd4, 0xdd,
+            0x83, 0x20, 0x25, 0xe8, 0x01, 0x8b, 0x81, 0x60, 0xb8, 0x22, 0x84, 0xf3, 0xc9, 0x49, 0xaa, 0x5a,
+            0x8e, 0xca, 0x00, 0xbb, 0xb4, 0xa7, 0x3b, 0xda, 0xd1, 0x92, 0xb5, 0xc4, 0x2f, 0x73, 0xf2, 0xfd,
+            0x4e, 0x27, 0x36, 0x44, 0xc8, 0xb3, 0x61, 0x25, 0xa6, 0x4a, 0xdd, 0xeb, 0x00, 0x6c, 0x13, 0xa0 } },
+        { { [1] = 0xff }, 2,
+          { 0x72, 0xd5, 0x4d, 0xfb, 0xf1, 0x2e, 0xc4, 0x4b, 0x36, 0x26, 0x92, 0xdf, 0x94, 0x13, 0x7f, 0x32,
+            0x8f, 0xea, 0x8d, 0xa7, 0x39, 0x90, 0x26, 0x5e, 0xc1, 0xbb, 0xbe, 0xa1, 0xae, 0x9a, 0xf0, 0xca,
+            0x13, 0xb2, 0x5a, 0xa2, 0x6c, 0xb4, 0xa6, 0x48, 0xcb, 0x9b, 0x9d, 0x1b, 0xe6, 0x5b, 0x2c, 0x09,
+            0x24, 0xa6, 0x6c, 0x54, 0xd5, 0x45, 0xec, 0x1b, 0x73, 0x74, 0xf4, 0x87, 0x2e, 0x99, 0xf0, 0x96 } },
+    };
+    printf("ChaCha20 RFC 8439 known answers\n");
+    for(size_t i = 0; i < sizeof(kats) / sizeof(kats[0]); i++) {
+        uint32_t key[8];
+        uint8_t  out[64];
+        // Key words are little endian like the rest of the state.
+        for(int w = 0; w < 8; w++) {
+            const uint8_t *b = kats[i].key + w * 4;
+            key[w] = b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+        }
+        chacha_block(key, kats[i].counter, out);
+        printf("  A.1 test vector #%zu                %s\n", i + 1, verdict(memcmp(out, kats[i].out, 64) == 0));
+    }
+}
+
+// A batch from keystream, which runs the widest SIMD path built, against
+// BATCH_BLOCKS single blocks.
+static int chacha_batch_matches(const uint32_t key[8], uint64_t counter) {
+    static uint8_t batch[BATCH_BYTES];
+    uint8_t        block[64];
+    keystream(key, counter, batch);
+    for(int i = 0; i < BATCH_BLOCKS; i++) {
+        chacha_block(key, counter + i, block);
+        if(memcmp(batch + i * 64, block, 64) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void chacha_batches(void) {
+    uint32_t key[8] = { 0 };
+    int      fixed  = 1;
+    int      carry  = 1;
+    int      mixed  = 1;
+#ifdef __AVX2__
+    printf("ChaCha20 eight wide AVX2 blocks against single blocks\n");
+#elif defined(__SSE2__)
+    printf("ChaCha20 four wide SSE2 blocks against single blocks\n");
+#else
+    printf("ChaCha20 batches against single blocks\n");
+#endif
+    fixed &= chacha_batch_matches(key, 0);
+    fixed &= chacha_batch_matches(key, 1);
+    printf("  %-34s %s\n", "zero key", verdict(fixed));
+    // Every lane works out its own counter, the high word has to pick up
+    // the carry in whichever lane wraps.
+    for(uint64_t back = 0; back <= BATCH_BLOCKS; back++) {
+        for(int w = 0; w < 8; w++) {
+            key[w] = rng_next();
+        }
+        carry &= chacha_batch_matches(key, ((uint64_t)1 << 32) - back);
+    }
+    printf("  %-34s %s\n", "across the 2^32 block carry", verdict(carry));
+    for(int i = 0; i < 200; i++) {
+        for(int w = 0; w < 8; w++) {
+            key[w] = rng_next();
+        }
+        mixed &= chacha_batch_matches(key, rng_next());
+    }
+    printf("  %-34s %s\n", "random keys and counters", verdict(mixed));
+}
+
+// Draws per sampler check.
+#define SAMPLES (1 << 22)
+// Chi-square bins.
+#define BINS    256
+// Where the ziggurats in rand64-sample.c start their tails.
+#define NORMAL_R      3.6541528853610088
+#define EXPONENTIAL_R 7.69711747013104972
+
+// Bounds for a measured value, sd is its standard deviation at SAMPLES.
+static int within(double value, double expect, double sd) {
+    return fabs(value - expect) <= 6 * sd;
+}
+
+static void print_check(const char *name, double value, double expect, double sd) {
+    printf("  %-24s %12.6g %12.6g  %s\n", name, value, expect, verdict(within(value, expect, sd)));
+}
+
+// Chi-square of counts against the bin probabilities, printed against its
+// degrees of freedom.
+static void print_chi_square(const char *name, const uint64_t *counts, const double *prob, int bins, size_t n) {
+    double chi = 0;
+    for(int b = 0; b < bins; b++) {
+        double expect = prob[b] * n;
+        chi += (counts[b] - expect) * (counts[b] - expect) / expect;
+    }
+    print_check(name, chi, bins - 1, sqrt(2.0 * (bins - 1)));
+}
+
+static double normal_cdf(double x) {
+    return erfc(-x / sqrt(2)) / 2;
+}
+
+static void sampler_distributions(void) {
+    double      *out    = malloc(SAMPLES * sizeof(double));
+    float       *outf   = malloc(SAMPLES * sizeof(float));
+    uint64_t    *raw    = malloc(SAMPLES * sizeof(uint64_t));
+    uint64_t     counts[BINS];
+    double       prob[BINS];
+    Rand64Philox philox;
+    Rand64Gen    gen;
+    if(out == NULL || outf == NULL || raw == NULL) {
+        fprintf(stderr, "rand64-tests: failed to allocate samples\n");
+        exit(1);
+    }
+    rand64_gen_init_philox(&gen, &philox);
+
+    // Uniform doubles have to be exactly the top 53 bits, whichever path
+    // made them.
+    printf("Samplers over %d Philox draws\n", SAMPLES);
+    printf("  %-24s %12s %12s\n", "", "measured", "expected");
+    rand64_philox_init(&philox, 0x5eed, 0);
+    rand64_double_fill(&gen, out, SAMPLES);
+    rand64_philox_init(&philox, 0x5eed, 0);
+    rand64_philox_fill(&philox, raw, SAMPLES);
+    int    exact = 1;
+    double sum   = 0;
+    double sum2  = 0;
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < SAMPLES; i++) {
+        exact &= out[i] == (raw[i] >> 11) * 0x1.0p-53;
+        sum   += out[i];
+        sum2  += out[i] * out[i];
+        counts[(int)(out[i] * BINS)]++;
+    }
+    for(int b = 0; b < BINS; b++) {
+        prob[b] = 1.0 / BINS;
+    }
+    printf("  %-24s %12s %12s  %s\n", "double is top 53 bits", "", "", verdict(exact));
+    print_check("double mean", sum / SAMPLES, 0.5, sqrt(1.0 / 12 / SAMPLES));
+    print_check("double variance", sum2 / SAMPLES - (sum / SAMPLES) * (sum / SAMPLES), 1.0 / 12, sqrt(1.0 / 180 / SAMPLES));
+    print_chi_square("double chi-square", counts, prob, BINS, SAMPLES);
+
+    rand64_philox_init(&philox, 0x5eed, 1);
+    rand64_float_fill(&gen, outf, SAMPLES);
+    int in_range = 1;
+    sum = 0;
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < SAMPLES; i++) {
+        in_range &= outf[i] >= 0 && outf[i] < 1;
+        sum      += outf[i];
+        counts[(int)(outf[i] * BINS)]++;
+    }
+    printf("  %-24s %12s %12s  %s\n", "float in [0, 1)", "", "", verdict(in_range));
+    print_check("float mean", sum / SAMPLES, 0.5, sqrt(1.0 / 12 / SAMPLES));
+    print_chi_square("float chi-square", counts, prob, BINS, SAMPLES);
+
+    // Normal, the moments and how often the tail past the ziggurat's R is
+    // hit, which only the slow path makes.
+    rand64_philox_init(&philox, 0x5eed, 2);
+    rand64_normal_fill(&gen, out, SAMPLES);
+    double m[5]  = { 0 };
+    size_t tail  = 0;
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < SAMPLES; i++) {
+        double x = out[i];
+        m[1] += x;
+        m[2] += x * x;
+        m[3] += x * x * x;
+        m[4] += x * x * x * x;
+        tail += fabs(x) > NORMAL_R;
+        // Bins of equal width over [-4, 4), the two ends take the rest.
+        int b = (int)floor((x + 4) * BINS / 8);
+        counts[b < 0 ? 0 : b >= BINS ? BINS - 1 : b]++;
+    }
+    for(int b = 0; b < BINS; b++) {
+        double lo = b == 0 ? -INFINITY : -4 + b * 8.0 / BINS;
+        double hi = b == BINS - 1 ? INFINITY : -4 + (b + 1) * 8.0 / BINS;
+        prob[b] = normal_cdf(hi) - normal_cdf(lo);
+    }
+    double p_tail = erfc(NORMAL_R / sqrt(2));
+    print_check("normal mean", m[1] / SAMPLES, 0, sqrt(1.0 / SAMPLES));
+    print_check("normal variance", m[2] / SAMPLES, 1, sqrt(2.0 / SAMPLES));
+    print_check("normal skewness", m[3] / SAMPLES, 0, sqrt(15.0 / SAMPLES));
+    print_check("normal kurtosis", m[4] / SAMPLES, 3, sqrt(96.0 / SAMPLES));
+    print_check("normal past R", (double)tail / SAMPLES, p_tail, sqrt(p_tail * (1 - p_tail) / SAMPLES));
+    print_chi_square("normal chi-square", counts, prob, BINS, SAMPLES);
+
+    // Exponential, same again against rate 1.
+    rand64_philox_init(&philox, 0x5eed, 3);
+    rand64_exponential_fill(&gen, out, SAMPLES);
+    int positive = 1;
+    sum  = 0;
+    sum2 = 0;
+    tail = 0;
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < SAMPLES; i++) {
+        double x = out[i];
+        positive &= x >= 0;
+        sum      += x;
+        sum2     += x * x;
+        tail     += x > EXPONENTIAL_R;
+        int b = (int)(x * BINS / 8);
+        counts[b >= BINS ? BINS - 1 : b]++;
+    }
+    for(int b = 0; b < BINS; b++) {
+        double hi = b == BINS - 1 ? 0 : exp(-(b + 1) * 8.0 / BINS);
+        prob[b] = exp(-b * 8.0 / BINS) - hi;
+    }
+    p_tail = exp(-EXPONENTIAL_R);
+    printf("  %-24s %12s %12s  %s\n", "exponential >= 0", "", "", verdict(positive));
+    print_check("exponential mean", sum / SAMPLES, 1, sqrt(1.0 / SAMPLES));
+    print_check("exponential variance", sum2 / SAMPLES - (sum / SAMPLES) * (sum / SAMPLES), 1, sqrt(8.0 / SAMPLES));
+    print_check("exponential past R", (double)tail / SAMPLES, p_tail, sqrt(p_tail * (1 - p_tail) / SAMPLES));
+    print_chi_square("exponential chi-square", counts, prob, BINS, SAMPLES);
+    free(raw);
+    free(outf);
+    free(out);
+}
+
+// Fills count elements of size bytes with their index in the first 4
+// bytes and a copy of it in the last 4, so a swap that tears an element or
+// moves the wrong bytes shows up.
+static void index_fill(uint8_t *base, size_t count, size_t size) {
+    memset(base, 0, count * size);
+    for(uint32_t i = 0; i < count; i++) {
+        memcpy(base + i * size, &i, 4);
+        memcpy(base + i * size + size - 4, &i, 4);
+    }
+}
+
+// Every index is there once and each element is still whole.
+static int is_permutation(const uint8_t *base, size_t count, size_t size) {
+    uint8_t *seen = calloc(count, 1);
+    int      ok   = seen != NULL;
+    for(size_t i = 0; ok && i < count; i++) {
+        uint32_t a, b;
+        memcpy(&a, base + i * size, 4);
+        memcpy(&b, base + i * size + size - 4, 4);
+        ok = a == b && a < count && !seen[a];
+        if(ok) {
+            seen[a] = 1;
+        }
+    }
+    free(seen);
+    return ok;
+}
+
+// Rank of a permutation of 0 .. n - 1 among all n! of them.
+static size_t perm_rank(const uint32_t *perm, int n) {
+    size_t rank = 0;
+    for(int i = 0; i < n; i++) {
+        int smaller = 0;
+        for(int j = i + 1; j < n; j++) {
+            smaller += perm[j] < perm[i];
+        }
+        rank = rank * (n - i) + smaller;
+    }
+    return rank;
+}
+
+static void shuffles(void) {
+    static const size_t sizes[] = { 4, 8, 16, 12, 100 };
+    Rand64Philox philox;
+    Rand64Gen    gen;
+    uint64_t     counts[BINS];
+    double       prob[BINS];
+    rand64_gen_init_philox(&gen, &philox);
+    rand64_philox_init(&philox, 0x5eed, 4);
+    printf("Shuffles and samples\n");
+    printf("  %-24s %12s %12s\n", "", "measured", "expected");
+
+    // Each element size has its own copy of Fisher-Yates.
+    int perms = 1;
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint8_t *buf = malloc(1000 * sizes[s]);
+        if(buf == NULL) {
+            fprintf(stderr, "rand64-tests: failed to allocate shuffle buffer\n");
+            exit(1);
+        }
+        for(size_t n = 0; n <= 1000; n += n < 20 ? 1 : 327) {
+            index_fill(buf, n, sizes[s]);
+            rand64_shuffle(&gen, buf, n, sizes[s]);
+            perms &= is_permutation(buf, n, sizes[s]);
+        }
+        free(buf);
+    }
+    printf("  %-24s %12s %12s  %s\n", "shuffle permutes", "", "", verdict(perms));
+
+    // All 120 orders of 5 equally likely.
+    uint64_t orders[120] = { 0 };
+    double   order_prob[120];
+    for(size_t t = 0; t < 120 * 2000; t++) {
+        uint32_t perm[5] = { 0, 1, 2, 3, 4 };
+        rand64_shuffle(&gen, perm, 5, sizeof(uint32_t));
+        orders[perm_rank(perm, 5)]++;
+    }
+    for(int i = 0; i < 120; i++) {
+        order_prob[i] = 1.0 / 120;
+    }
+    print_chi_square("orders of 5 chi-square", orders, order_prob, 120, 120 * 2000);
+
+    // Where each of 16 elements ends up, 256 cells.
+    memset(counts, 0, sizeof(counts));
+    for(size_t t = 0; t < 50000; t++) {
+        uint64_t perm[16];
+        for(int i = 0; i < 16; i++) {
+            perm[i] = i;
+        }
+        rand64_shuffle(&gen, perm, 16, sizeof(uint64_t));
+        for(int i = 0; i < 16; i++) {
+            counts[perm[i] * 16 + i]++;
+        }
+    }
+    for(int b = 0; b < BINS; b++) {
+        prob[b] = 1.0 / BINS;
+    }
+    // Rows and columns both add up to the trials, so there are really 225
+    // degrees of freedom, well inside the bound for 255.
+    print_chi_square("positions of 16", counts, prob, BINS, 50000 * 16);
+
+    // Every element has to be picked k / count of the time, by Floyd when
+    // k is small next to count and by the reservoir otherwise.
+    static const struct {
+        const char *name;
+        size_t      count;
+        size_t      k;
+    } picks[] = {
+        { "floyd 8 of 256",      256,   8 },
+        { "floyd 32 of 256",     256,  32 },
+        { "reservoir 40 of 256", 256,  40 },
+        { "reservoir 200 of 256", 256, 200 },
+    };
+    uint32_t items[256];
+    uint32_t out[256];
+    for(uint32_t i = 0; i < 256; i++) {
+        items[i] = i;
+    }
+    for(size_t c = 0; c < sizeof(picks) / sizeof(picks[0]); c++) {
+        size_t trials = 2000000 / picks[c].k;
+        int    valid  = 1;
+        double chi    = 0;
+        memset(counts, 0, sizeof(counts));
+        for(size_t t = 0; t < trials; t++) {
+            uint8_t seen[256] = { 0 };
+            valid &= rand64_sample_k(&gen, items, picks[c].count, sizeof(uint32_t), out, picks[c].k) == 0;
+            for(size_t i = 0; i < picks[c].k; i++) {
+                valid &= out[i] < 256 && !seen[out[i]];
+                seen[out[i] & 255] = 1;
+                counts[out[i] & 255]++;
+            }
+        }
+        // Each count is binomial, trials draws at p each.
+        double p = (double)picks[c].k / picks[c].count;
+        for(size_t b = 0; b < picks[c].count; b++) {
+            double expect = trials * p;
+            chi += (counts[b] - expect) * (counts[b] - expect) / (expect * (1 - p));
+        }
+        printf("  %-24s %12s %12s  %s\n", picks[c].name, "distinct", "", verdict(valid));
+        print_check("  inclusion chi-square", chi, picks[c].count - 1, sqrt(2.0 * (picks[c].count - 1)));
+    }
+    printf("  %-24s %12s %12s  %s\n", "sample k > count", "", "",
+           verdict(rand64_sample_k(&gen, items, 4, sizeof(uint32_t), out, 5) == -1));
+
+    // The parallel shuffle only depends on the seed. Big enough for several
+    // chunks and buckets, and small enough to take the in cache path.
+    static const size_t lengths[] = { 3 << 20, 5000 };
+    static const int    threads[] = { 1, 2, 5, 8, 0 };
+    int same = 1;
+    perms    = 1;
+    for(size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        uint32_t *first = malloc(lengths[l] * sizeof(uint32_t));
+        uint32_t *again = malloc(lengths[l] * sizeof(uint32_t));
+        if(first == NULL || again == NULL) {
+            fprintf(stderr, "rand64-tests: failed to allocate shuffle buffer\n");
+            exit(1);
+        }
+        for(size_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+            uint32_t *buf = t == 0 ? first : again;
+            index_fill((uint8_t*)buf, lengths[l], sizeof(uint32_t));
+            perms &= rand64_shuffle_parallel(buf, lengths[l], sizeof(uint32_t), 0x5eed, threads[t]) == 0;
+            perms &= is_permutation((uint8_t*)buf, lengths[l], sizeof(uint32_t));
+            same  &= memcmp(first, buf, lengths[l] * sizeof(uint32_t)) == 0;
+        }
+        free(again);
+        free(first);
+    }
+    printf("  %-24s %12s %12s  %s\n", "parallel permutes", "", "", verdict(perms));
+    printf("  %-24s %12s %12s  %s\n", "parallel, 1-8 threads", "same", "", verdict(same));
+    printf("  %-24s %12s %12s  %s\n", "parallel overflow", "", "",
+           verdict(rand64_shuffle_parallel(items, SIZE_MAX / 2, 4, 0x5eed, 1) == -1));
+}
+
+#define FILL_DRAWS 1000
+
+typedef struct BufferedRun {
+    uint64_t draws[FILL_DRAWS];
+    size_t   calls;
+    uint64_t failures;
+} BufferedRun;
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int all_different(uint64_t *values, size_t n) {
+    qsort(values, n, sizeof(uint64_t), cmp_u64);
+    for(size_t i = 1; i < n; i++) {
+        if(values[i] == values[i - 1]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// On its own thread so the buffer starts out empty.
+static void* buffered_draws(void *arg) {
+    BufferedRun *run = arg;
+    size_t   calls    = fill_calls;
+    uint64_t failures = rand64_failures();
+    for(size_t i = 0; i < FILL_DRAWS; i++) {
+        run->draws[i] = rand64_buffered();
+    }
+    run->calls    = fill_calls - calls;
+    run->failures = rand64_failures() - failures;
+    return NULL;
+}
+
+static void buffered_run(BufferedRun *run) {
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, buffered_draws, run) != 0) {
+        fprintf(stderr, "rand64-tests: failed to start a thread\n");
+        exit(1);
+    }
+    pthread_join(thread, NULL);
+}
+
+// rand64_fill only writes what it says it did, callers have to top up the
+// rest themselves. rand64_buffered hands out each value it got once and
+// counts every short or empty refill.
+static void fills(void) {
+    static const Rand64Backend backends[] = { RAND64_RDRAND, RAND64_XOSHIRO, RAND64_PORTABLE, RAND64_CHACHA };
+    static const char         *names[]    = { "rdrand", "xoshiro256**", "portable", "chacha20" };
+    static BufferedRun         run;
+    uint64_t      buf[101];
+    Rand64Backend was = rand64_backend();
+    printf("Fills\n");
+    for(size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+        if(rand64_use(backends[b]) < 0) {
+            printf("  %-28s %s\n", names[b], "not on this CPU");
+            continue;
+        }
+        // Only rdrand may come up short, and never past what it was asked.
+        buf[100]   = 0x5e7;
+        size_t got = rand64_fill(buf, 100);
+        int    ok  = buf[100] == 0x5e7 && got > 0 && (got == 100 || backends[b] == RAND64_RDRAND);
+        printf("  %-28s %3zu of 100  %s\n", names[b], got, verdict(ok));
+    }
+    rand64_use(was);
+    // The default sampler source tops up short fills itself.
+    Rand64Gen gen;
+    rand64_gen_init(&gen);
+    for(size_t i = 0; i < 100; i++) {
+        buf[i] = 0x5e7;
+    }
+    short_by = 40;
+    gen.fill(gen.state, buf, 100);
+    short_by = 0;
+    int topped = 1;
+    for(size_t i = 0; i < 100; i++) {
+        topped &= buf[i] != 0x5e7;
+    }
+    printf("  %-28s %s\n", "default source tops up", verdict(topped));
+    // Full refills, one per 64 values.
+    buffered_run(&run);
+    int ok = run.calls == (FILL_DRAWS + 63) / 64 && run.failures == 0 && all_different(run.draws, FILL_DRAWS);
+    printf("  %-28s %3zu refills  %s\n", "buffered", run.calls, verdict(ok));
+    // Refills 10 short, and two that give nothing before the first one.
+    // Values left over from the refill before must not come out again.
+    short_by    = 10;
+    empty_fills = 2;
+    buffered_run(&run);
+    short_by    = 0;
+    size_t want = (FILL_DRAWS + 53) / 54;
+    ok = run.calls == want + 2 && run.failures == want + 2 && all_different(run.draws, FILL_DRAWS);
+    printf("  %-28s %3zu refills  %s\n", "buffered, short refills", run.calls, verdict(ok));
+    printf("  %-28s %3llu counted  %s\n", "failures", (unsigned long long)run.failures, verdict(ok));
+}
+
+#define BOUNDED_SAMPLES (1 << 20)
+
+static const char *bounded_names[] = { "bounded", "bounded_fill", "maximum", "buffered_max" };
+
+// The maximum ones are asked for range - 1, so a range of 0 is max =
+// UINT64_MAX for them.
+static void bounded_draw(int way, uint64_t *buf, size_t n, uint64_t range) {
+    switch(way) {
+        case 0:
+            for(size_t i = 0; i < n; i++) {
+                buf[i] = rand64_bounded(range);
+            }
+            break;
+        case 1:
+            rand64_bounded_fill(buf, n, range);
+            break;
+        case 2:
+            for(size_t i = 0; i < n; i++) {
+                buf[i] = rand64_maximum(range - 1);
+            }
+            break;
+        default:
+            for(size_t i = 0; i < n; i++) {
+                buf[i] = rand64_buffered_maximum(range - 1);
+            }
+            break;
+    }
+}
+
+// Chi-square of (value >> shift) % bins against equal bins. These draws
+// aren't from a fixed seed, so the bound is 6 deviations after the
+// Wilson-Hilferty cube root, which holds even for a couple of bins where
+// 6 deviations of the raw chi-square would fail about one run in a
+// thousand.
+static void bounded_chi_square(const char *name, const char *what, const uint64_t *buf, int shift, int bins) {
+    uint64_t counts[8] = { 0 };
+    for(size_t i = 0; i < BOUNDED_SAMPLES; i++) {
+        counts[(buf[i] >> shift) % bins]++;
+    }
+    double chi    = 0;
+    double expect = (double)BOUNDED_SAMPLES / bins;
+    for(int b = 0; b < bins; b++) {
+        chi += (counts[b] - expect) * (counts[b] - expect) / expect;
+    }
+    double df = bins - 1;
+    double z  = (cbrt(chi / df) - (1 - 2 / (9 * df))) / sqrt(2 / (9 * df));
+    printf("  %-14s %-24s %9.3f %2d  %s\n", name, what, chi, bins - 1, verdict(z < 6));
+}
+
+static void print_bounded(const char *name, const char *what, int ok) {
+    printf("  %-14s %-24s %12s  %s\n", name, what, "", verdict(ok));
+}
+
+// Edges of the bounded draws on each of the ways to get them. A range of 1
+// only has 0 in it and a range of 0 (max = UINT64_MAX) is all 64 bits.
+// 2^63+1 throws away almost half the draws, and 3*2^62 a quarter of them,
+// where skipping the rejection would give multiples of 3 half the draws
+// instead of a third. Runs on the portable backend so it's quick.
+static void bounds(void) {
+    uint64_t     *buf = malloc(BOUNDED_SAMPLES * sizeof(uint64_t));
+    Rand64Backend was = rand64_backend();
+    if(buf == NULL) {
+        fprintf(stderr, "rand64-tests: failed to allocate samples\n");
+        exit(1);
+    }
+    rand64_use(RAND64_PORTABLE);
+    printf("Bounded draws, chi-square and degrees of freedom\n");
+    for(int way = 0; way < 4; way++) {
+        const char *name = bounded_names[way];
+        bounded_draw(way, buf, BOUNDED_SAMPLES, 1);
+        int ok = 1;
+        for(size_t i = 0; i < BOUNDED_SAMPLES; i++) {
+            ok &= buf[i] == 0;
+        }
+        print_bounded(name, "range 1 all 0", ok);
+        bounded_draw(way, buf, BOUNDED_SAMPLES, 0);
+        bounded_chi_square(name, "range 2^64 top bit", buf, 63, 2);
+        bounded_chi_square(name, "range 2^64 low bit", buf, 0, 2);
+        print_bounded(name, "range 2^64 all different", all_different(buf, BOUNDED_SAMPLES));
+        uint64_t range = ((uint64_t)1 << 63) + 1;
+        bounded_draw(way, buf, BOUNDED_SAMPLES, range);
+        ok = 1;
+        for(size_t i = 0; i < BOUNDED_SAMPLES; i++) {
+            ok &= buf[i] < range;
+        }
+        print_bounded(name, "range 2^63+1 under", ok);
+        bounded_chi_square(name, "range 2^63+1 quarters", buf, 61, 4);
+        bounded_chi_square(name, "range 2^63+1 low bit", buf, 0, 2);
+        range = 3 * ((uint64_t)1 << 62);
+        bounded_draw(way, buf, BOUNDED_SAMPLES, range);
+        bounded_chi_square(name, "range 3*2^62 mod 3", buf, 0, 3);
+        bounded_draw(way, buf, BOUNDED_SAMPLES, 6);
+        bounded_chi_square(name, "range 6", buf, 0, 6);
+    }
+    rand64_use(was);
+    free(buf);
+}
+
+// The default is one nobody can predict from earlier values, xoshiro only
+// runs when asked for, and a backend the CPU can't run is refused.
+static void backends(void) {
+    static const Rand64Backend all[]   = { RAND64_RDRAND, RAND64_XOSHIRO, RAND64_PORTABLE, RAND64_CHACHA };
+    static const char         *names[] = { "rdrand", "xoshiro256**", "portable", "chacha20" };
+    unsigned a, b, c, d;
+    int rdrand = __get_cpuid(1, &a, &b, &c, &d) && (c & bit_RDRND) != 0;
+    int rdseed = __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_RDSEED) != 0;
+    int usable[] = { rdrand, rdrand || rdseed, 1, 1 };
+    printf("Backends\n");
+    Rand64Backend was  = rand64_backend();
+    Rand64Backend want = rdrand ? RAND64_RDRAND : RAND64_CHACHA;
+    printf("  %-28s %-12s  %s\n", "default", names[was], verdict(was == want));
+    for(size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        int used = rand64_use(all[i]) == 0;
+        int ok   = used == usable[i] && (!used || rand64_backend() == all[i]);
+        printf("  %-28s %-12s  %s\n", names[i], used ? "used" : "refused", verdict(ok));
+    }
+    rand64_use(RAND64_PORTABLE);
+    int ok = rand64_use((Rand64Backend)99) == -1 && rand64_use((Rand64Backend)-1) == -1;
+    ok    &= rand64_backend() == RAND64_PORTABLE;
+    printf("  %-28s %-12s  %s\n", "out of range", "refused", verdict(ok));
+    rand64_use(was);
+}
+
+#define FORK_DRAWS 16
+
+// Draws after a fork in both processes, the child sends its values back
+// through a pipe. They all have to be different.
+static int differs_after_fork(uint64_t (*draw)(void)) {
+    uint64_t values[2 * FORK_DRAWS];
+    int      fds[2];
+    draw();
+    if(pipe(fds) != 0) {
+        fprintf(stderr, "rand64-tests: failed to make a pipe\n");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if(pid < 0) {
+        fprintf(stderr, "rand64-tests: failed to fork\n");
+        exit(1);
+    }
+    if(pid == 0) {
+        close(fds[0]);
+        for(size_t i = 0; i < FORK_DRAWS; i++) {
+            values[i] = draw();
+        }
+        ssize_t sent = write(fds[1], values, FORK_DRAWS * sizeof(uint64_t));
+        _exit(sent == FORK_DRAWS * sizeof(uint64_t) ? 0 : 1);
+    }
+    close(fds[1]);
+    for(size_t i = 0; i < FORK_DRAWS; i++) {
+        values[FORK_DRAWS + i] = draw();
+    }
+    size_t got = 0;
+    while(got < FORK_DRAWS * sizeof(uint64_t)) {
+        ssize_t r = read(fds[0], (uint8_t*)values + got, FORK_DRAWS * sizeof(uint64_t) - got);
+        if(r <= 0) {
+            break;
+        }
+        got += r;
+    }
+    close(fds[0]);
+    int status;
+    if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return 0;
+    }
+    return got == FORK_DRAWS * sizeof(uint64_t) && all_different(values, 2 * FORK_DRAWS);
+}
+
+static void forks(void) {
+    static const Rand64Backend all[]   = { RAND64_RDRAND, RAND64_XOSHIRO, RAND64_PORTABLE, RAND64_CHACHA };
+    static const char         *names[] = { "rdrand", "xoshiro256**", "portable", "chacha20" };
+    Rand64Backend was = rand64_backend();
+    printf("Parent and child after fork\n");
+    for(size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        if(rand64_use(all[i]) < 0) {
+            printf("  %-28s %s\n", names[i], "not on this CPU");
+            continue;
+        }
+        printf("  %-28s %s\n", names[i], verdict(differs_after_fork(rand64)));
+    }
+    rand64_use(was);
+    printf("  %-28s %s\n", "rand64_buffered", verdict(differs_after_fork(rand64_buffered)));
+    printf("  %-28s %s\n", "rand64_secure", verdict(differs_after_fork(rand64_secure)));
+}
+
+int main(void) {
+    philox_known_answers();
+    philox_fills();
+    chacha_known_answers();
+    chacha_batches();
+    sampler_distributions();
+    shuffles();
+    bounds();
+    backends();
+    fills();
+    forks();
+    if(failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
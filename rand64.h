@@ -21,9 +21,116 @@ SOFTWARE.
 #ifndef RAND_64_H
 #define RAND_64_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+// Backends rand64 can run on. The first call picks rdrand when CPUID
+// reports it and the ChaCha20 CSPRNG behind rand64_secure otherwise, so
+// values are never predictable from earlier ones. xoshiro256** is several
+// times faster but anyone who sees 4 of its values can work out the rest,
+// so it's only used when rand64_use(RAND64_XOSHIRO) asks for it. It keeps
+// its state per thread and a forked child seeds its own. Aborts if it
+// can't get a seed.
+typedef enum Rand64Backend {
+    RAND64_RDRAND,
+    RAND64_XOSHIRO,  // Seeded from rdseed or rdrand, or the OS for the rest.
+    RAND64_PORTABLE, // Seeded from the OS.
+    RAND64_CHACHA    // rand64_secure.
+} Rand64Backend;
+
 uint64_t rand64(void);
 uint64_t rand64_maximum(uint64_t max);
+// Fills buf with n values. Only rdrand can come up short, if one value
+// still fails after 10 tries it stops early. Returns how many were written.
+size_t   rand64_fill(uint64_t *buf, size_t n);
+
+// Unbiased values in [0, range) by Lemire's multiply and shift, a range of
+// 0 means all 64 bits. It throws a draw away range / 2^64 of the time, where
+// masking could throw away half of them. rand64_maximum(max) is the same as
+// rand64_bounded(max + 1).
+uint64_t rand64_bounded(uint64_t range);
+void     rand64_bounded_fill(uint64_t *buf, size_t n, uint64_t range);
+
+// Philox4x32-10, a counter based generator for when the values have to be
+// the same every run. A seed and a stream id pick a sequence of 2^64
+// values that no other stream id overlaps, so each thread or job can take
+// its own stream and the results don't depend on how work got split up.
+// Seeking anywhere in a stream is O(1). Bulk fills do eight blocks per
+// step with AVX2. The state is only touched by the caller, one per thread.
+typedef struct Rand64Philox {
+    uint32_t key[2];
+    uint64_t stream;
+    uint64_t position; // Index of the next value.
+    uint64_t spare;    // Second half of the block when position is odd.
+} Rand64Philox;
+
+void     rand64_philox_init(Rand64Philox *philox, uint64_t seed, uint64_t stream);
+uint64_t rand64_philox     (Rand64Philox *philox);
+void     rand64_philox_fill(Rand64Philox *philox, uint64_t *buf, size_t n);
+void     rand64_philox_seek(Rand64Philox *philox, uint64_t position);
+void     rand64_philox_skip(Rand64Philox *philox, uint64_t count);
+
+// ChaCha20 CSPRNG for tokens, keys and nonces, one per thread. Keyed from
+// rdseed or /dev/urandom and rekeyed after every 4 KiB batch so bytes that
+// were handed out can't be worked back out of memory later. Fresh entropy
+// goes in every GiB or minute, whichever comes first, and a forked child
+// starts over with its own. Aborts if it can't find any entropy at all.
+uint64_t rand64_secure        (void);
+uint64_t rand64_secure_maximum(uint64_t max);
+size_t   rand64_secure_fill   (uint64_t *buf, size_t n);
+void     rand64_secure_bytes  (void *buf, size_t n);
+
+// Any of the generators above as the source for the samplers below. The
+// default one follows whatever backend rand64 is on.
+typedef struct Rand64Gen {
+    void (*fill)(void *state, uint64_t *buf, size_t n);
+    void  *state;
+} Rand64Gen;
+
+void rand64_gen_init       (Rand64Gen *gen);
+void rand64_gen_init_secure(Rand64Gen *gen);
+// Takes values from philox, which has to outlive gen.
+void rand64_gen_init_philox(Rand64Gen *gen, Rand64Philox *philox);
+
+// Uniform in [0, 1) with 53 random bits for doubles and 24 for floats,
+// standard normal (mean 0, deviation 1) and exponential (rate 1).
+void rand64_double_fill     (const Rand64Gen *gen, double *out, size_t n);
+void rand64_float_fill      (const Rand64Gen *gen, float *out, size_t n);
+void rand64_normal_fill     (const Rand64Gen *gen, double *out, size_t n);
+void rand64_exponential_fill(const Rand64Gen *gen, double *out, size_t n);
+
+// Shuffles count elements of size bytes each in place, every order equally
+// likely.
+void rand64_shuffle(const Rand64Gen *gen, void *base, size_t count, size_t size);
+// Copies k different elements picked at random to out, in no particular
+// order. Uses Floyd's algorithm when k is small next to count and a
+// reservoir otherwise. Returns -1 when k > count or out of memory.
+int  rand64_sample_k(const Rand64Gen *gen, const void *base, size_t count, size_t size, void *out, size_t k);
+// Same as rand64_shuffle for arrays far bigger than the cache. Elements
+// are scattered to cache sized buckets, which are then shuffled on their
+// own across threads (0 for one per CPU). Draws come from Philox streams
+// of seed, so the result only depends on the seed and not the threads.
+// Needs a second buffer as big as the array, returns -1 without one or
+// when count * size doesn't fit in a size_t.
+int  rand64_shuffle_parallel(void *base, size_t count, size_t size, uint64_t seed, int threads);
+
+// Returns -1 when the CPU lacks what the backend needs.
+int           rand64_use(Rand64Backend backend);
+Rand64Backend rand64_backend(void);
+
+// The assembly behind RAND64_RDRAND, only call these when CPUID says the
+// instructions are there. rand64_rdrand_maximum masks and rejects,
+// rand64_rdseed returns 0 when it keeps failing.
+uint64_t rand64_rdrand(void);
+uint64_t rand64_rdrand_maximum(uint64_t max);
+size_t   rand64_rdrand_fill(uint64_t *buf, size_t n);
+int      rand64_rdseed(uint64_t *out);
+
+// Same as rand64 and rand64_maximum but handed out of a per thread buffer
+// that rand64_fill refills in bulk.
+uint64_t rand64_buffered(void);
+uint64_t rand64_buffered_maximum(uint64_t max);
+// How many refills across all threads came back short.
+uint64_t rand64_failures(void);
 
 #endif
\ No newline at end of file
@@ -1,17 +1,23 @@
-    .global rand64
-    .global rand64_maximum
+    .global rand64_rdrand
+    .global rand64_rdrand_maximum
+    .global rand64_rdrand_fill
+    .global rand64_rdseed
     .text
 
-rand64:
+# Intel suggests giving up after 10 failed tries in a row.
+    .set RETRIES, 10
+
+rand64_rdrand:
     rdrand %rax
-    jnc    rand64
+    jnc    rand64_rdrand
     ret
 
-rand64_maximum:
+rand64_rdrand_maximum:
     mov   %rdi, %rcx
     or    $1,   %rcx # Or by 1 to handle zero case
     mov   $-1,  %rdx
-    lzcnt %rcx, %rcx
+    bsr   %rcx, %rcx # Not lzcnt, CPUs without it run that as bsr
+    xor   $63,  %ecx # Turn the top bit index into the leading zero count
     shr   %cl,  %rdx # Mask stored in rdx
 loop:
     rdrand %rax
@@ -21,4 +27,62 @@ loop:
     ja     loop
     ret
 
+# Stores one value at idx of rdi, on failure returns the count so far.
+.macro DRAW idx
+    mov    $RETRIES, %edx
+1:
+    rdrand %r8
+    jc     2f
+    dec    %edx
+    jnz    1b
+    add    $\idx, %rax
+    ret
+2:
+    mov    %r8, 8*\idx(%rdi)
+.endm
+
+# size_t rand64_rdrand_fill(uint64_t *buf, size_t n)
+rand64_rdrand_fill:
+    xor   %eax, %eax # Count filled
+    mov   %rsi, %rcx
+    shr   $2,   %rcx # Groups of four
+    jz    fill_tail
+fill_four:
+    DRAW  0
+    DRAW  1
+    DRAW  2
+    DRAW  3
+    add   $32,  %rdi
+    add   $4,   %rax
+    dec   %rcx
+    jnz   fill_four
+fill_tail:
+    and   $3,   %esi # Remainder
+    jz    fill_done
+fill_one:
+    DRAW  0
+    add   $8,   %rdi
+    inc   %rax
+    dec   %esi
+    jnz   fill_one
+fill_done:
+    ret
+
+# int rand64_rdseed(uint64_t *out), 0 if it kept failing. rdseed runs dry
+# far more often than rdrand so it gets more tries.
+rand64_rdseed:
+    mov    $(RETRIES * 10), %ecx
+seed_loop:
+    rdseed %rax
+    jc     seed_done
+    pause
+    dec    %ecx
+    jnz    seed_loop
+    xor    %eax, %eax
+    ret
+seed_done:
+    mov    %rax, (%rdi)
+    mov    $1,   %eax
+    ret
+
 .section	.note.GNU-stack,"",@progbits